@@ -0,0 +1,1299 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <numeric>
+
+#include "ThreadPool.h"
+
+namespace dae
+{
+	namespace
+	{
+		AABB Intersect(const AABB& a, const AABB& b)
+		{
+			AABB intersection{};
+			intersection.minAABB = Vector3::Max(a.minAABB, b.minAABB);
+			intersection.maxAABB = Vector3::Min(a.maxAABB, b.maxAABB);
+			return intersection;
+		}
+
+		//Spreads the lowest 10 bits of value out so there are two zero bits between each of them
+		uint32_t ExpandBits10(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+
+		//Same for the lowest 21 bits
+		uint64_t ExpandBits21(uint64_t value)
+		{
+			value &= 0x1FFFFFull;
+			value = (value | value << 32) & 0x1F00000000FFFFull;
+			value = (value | value << 16) & 0x1F0000FF0000FFull;
+			value = (value | value << 8) & 0x100F00F00F00F00Full;
+			value = (value | value << 4) & 0x10C30C30C30C30C3ull;
+			value = (value | value << 2) & 0x1249249249249249ull;
+			return value;
+		}
+
+		//Stable LSD radix sort on 12-bit digits, every chunk histograms and scatters its own part of the keys
+		//Wider digits mean fewer passes over the keys, 33-bit Morton codes take 3 instead of 5 with 8-bit digits
+		void RadixSort(ThreadPool* pThreadPool, uint32_t chunkSize, uint32_t keyBits, std::vector<uint64_t>& keys, std::vector<uint32_t>& values)
+		{
+			constexpr uint32_t digitBits{ 12 };
+			constexpr uint32_t digitCount{ 1u << digitBits };
+
+			const uint32_t count{ static_cast<uint32_t>(keys.size()) };
+			const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+
+			std::vector<uint64_t> sortedKeys(count);
+			std::vector<uint32_t> sortedValues(count);
+			std::vector<std::array<uint32_t, digitCount>> chunkOffsets(chunkCount);
+
+			for (uint32_t shift{}; shift < keyBits; shift += digitBits)
+			{
+				ForEachChunk(pThreadPool, count, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+					{
+						std::array<uint32_t, digitCount>& histogram{ chunkOffsets[chunkIndex] };
+						histogram.fill(0);
+						for (uint32_t i{ begin }; i < end; ++i)
+							++histogram[(keys[i] >> shift) & (digitCount - 1)];
+					});
+
+				//Digit major, then chunk order, which keeps equal digits in their original order
+				uint32_t offset{};
+				for (uint32_t digit{}; digit < digitCount; ++digit)
+				{
+					for (std::array<uint32_t, digitCount>& offsets : chunkOffsets)
+					{
+						const uint32_t digitTotal{ offsets[digit] };
+						offsets[digit] = offset;
+						offset += digitTotal;
+					}
+				}
+
+				ForEachChunk(pThreadPool, count, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+					{
+						std::array<uint32_t, digitCount>& offsets{ chunkOffsets[chunkIndex] };
+						for (uint32_t i{ begin }; i < end; ++i)
+						{
+							const uint32_t target{ offsets[(keys[i] >> shift) & (digitCount - 1)]++ };
+							sortedKeys[target] = keys[i];
+							sortedValues[target] = values[i];
+						}
+					});
+
+				keys.swap(sortedKeys);
+				values.swap(sortedValues);
+			}
+		}
+	}
+
+	void BVH::Build(const std::vector<AABB>& primitiveBounds)
+	{
+		Build(primitiveBounds, nullptr);
+	}
+
+	void BVH::Build(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles)
+	{
+		const auto startTime{ std::chrono::steady_clock::now() };
+
+		Clear();
+
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+		if (primitiveCount == 0)
+			return;
+
+		m_PrimitiveCount = primitiveCount;
+
+		m_PrimitiveIndices.resize(primitiveCount);
+		std::iota(m_PrimitiveIndices.begin(), m_PrimitiveIndices.end(), 0u);
+
+		std::vector<Vector3> centroids(primitiveCount);
+		ForEachChunk(m_pThreadPool, primitiveCount, s_PrimitiveChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+					centroids[i] = primitiveBounds[i].GetCenter();
+			});
+
+		switch (m_BuildStrategy)
+		{
+		case BVHBuildStrategy::SweepSAH:
+			BuildSweep(primitiveBounds, centroids);
+			break;
+		case BVHBuildStrategy::BinnedSAH:
+			BuildBinned(primitiveBounds, centroids);
+			break;
+		case BVHBuildStrategy::LinearMorton:
+			BuildLinear(primitiveBounds, centroids);
+			break;
+		case BVHBuildStrategy::SpatialSplitSAH:
+			BuildSpatial(primitiveBounds, pTriangles);
+			break;
+		}
+
+		m_BuildSAHCost = CalculateSAHCost();
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	void BVH::BuildFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		CalculateTriangleBounds(positions, indices, m_TriangleBounds, m_pThreadPool);
+
+		const TriangleSource triangles{ positions, indices };
+		Build(m_TriangleBounds, &triangles);
+	}
+
+	void BVH::Refit(const std::vector<AABB>& primitiveBounds)
+	{
+		assert(primitiveBounds.size() == m_PrimitiveCount);
+
+		//Children are always stored after their parent, so walking backwards visits every child before its parent
+		for (size_t i{ m_Nodes.size() }; i > 0; --i)
+		{
+			RefitNode(static_cast<uint32_t>(i - 1), primitiveBounds);
+		}
+	}
+
+	void BVH::Update(const std::vector<AABB>& primitiveBounds)
+	{
+		Update(primitiveBounds, nullptr);
+	}
+
+	void BVH::Update(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles)
+	{
+		//A different primitive count means the topology changed, the old tree cannot be refitted
+		if (!IsBuilt() || primitiveBounds.size() != m_PrimitiveCount || m_BuildStrategy == BVHBuildStrategy::LinearMorton)
+		{
+			Build(primitiveBounds, pTriangles);
+			return;
+		}
+
+		//Refitting a spatial split tree grows its clipped boxes back to the full primitive bounds, which is conservative but loose
+		Refit(primitiveBounds);
+
+		if (CalculateSAHCost() > m_BuildSAHCost * m_RebuildCostRatio)
+			Build(primitiveBounds, pTriangles);
+	}
+
+	void BVH::UpdateFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		CalculateTriangleBounds(positions, indices, m_TriangleBounds, m_pThreadPool);
+
+		const TriangleSource triangles{ positions, indices };
+		Update(m_TriangleBounds, &triangles);
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_PrimitiveCount = 0;
+		m_BuildSAHCost = 0.f;
+	}
+
+	float BVH::CalculateSAHCost() const
+	{
+		if (m_Nodes.empty())
+			return 0.f;
+
+		const float rootArea{ m_Nodes[0].bounds.Area() };
+		if (rootArea <= 0.f)
+			return 0.f;
+
+		//Runs after every build, so a LinearMorton rebuild every frame would otherwise pay for a serial pass over all nodes
+		const float cost{ ReduceChunks<float>(m_pThreadPool, static_cast<uint32_t>(m_Nodes.size()), s_PrimitiveChunkSize,
+			[this](uint32_t begin, uint32_t end, float& chunkCost)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const BVHNode& node{ m_Nodes[i] };
+					if (node.IsLeaf())
+						chunkCost += s_IntersectionCost * node.primitiveCount * node.bounds.Area();
+					else
+						chunkCost += s_TraversalCost * node.bounds.Area();
+				}
+			},
+			[](float& totalCost, float chunkCost) { totalCost += chunkCost; }) };
+
+		return cost / rootArea;
+	}
+
+	void BVH::CalculateTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<AABB>& triangleBounds, ThreadPool* pThreadPool)
+	{
+		const int triangleVertAmount{ 3 };
+		const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / triangleVertAmount) };
+
+		triangleBounds.resize(triangleCount);
+
+		ForEachChunk(pThreadPool, triangleCount, s_PrimitiveChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					AABB bounds{};
+					bounds.Grow(positions[indices[i * triangleVertAmount]]);
+					bounds.Grow(positions[indices[i * triangleVertAmount + 1]]);
+					bounds.Grow(positions[indices[i * triangleVertAmount + 2]]);
+					triangleBounds[i] = bounds;
+				}
+			});
+	}
+
+	void BVH::UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds)
+	{
+		BVHNode& node{ m_Nodes[nodeIndex] };
+		node.bounds = AABB{};
+
+		for (uint32_t i{}; i < node.primitiveCount; ++i)
+		{
+			node.bounds.Grow(primitiveBounds[m_PrimitiveIndices[node.leftFirst + i]]);
+		}
+	}
+
+	void BVH::RefitNode(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds)
+	{
+		BVHNode& node{ m_Nodes[nodeIndex] };
+		if (node.IsLeaf())
+		{
+			UpdateNodeBounds(nodeIndex, primitiveBounds);
+			return;
+		}
+
+		node.bounds = m_Nodes[node.leftFirst].bounds;
+		node.bounds.Grow(m_Nodes[node.leftFirst + 1].bounds);
+	}
+
+	void BVH::BuildSweep(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes
+		m_Nodes.reserve(2 * static_cast<size_t>(primitiveCount) - 1);
+
+		BVHNode root{};
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		m_Nodes.emplace_back(root);
+		UpdateNodeBounds(0, primitiveBounds);
+
+		std::vector<float> rightAreas(primitiveCount);
+		Subdivide(0, primitiveBounds, centroids, rightAreas);
+	}
+
+	struct BVH::BinnedBuildState
+	{
+		const std::vector<AABB>& primitiveBounds;
+		const std::vector<Vector3>& centroids;
+
+		//Nodes are claimed from this counter, so subtree tasks can add nodes at the same time
+		std::atomic<uint32_t> nodeCount;
+		TaskGroup subtreeTasks{};
+	};
+
+	void BVH::BuildBinned(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes, allocating them all up front means the vector never moves during the build
+		m_Nodes.resize(2 * static_cast<size_t>(primitiveCount) - 1);
+		m_Nodes[0].leftFirst = 0;
+		m_Nodes[0].primitiveCount = primitiveCount;
+		UpdateNodeBounds(0, primitiveBounds);
+
+		BinnedBuildState state{ primitiveBounds, centroids, 1 };
+
+		if (m_pThreadPool)
+		{
+			SubdivideBinnedTopLevels(0, 0, state);
+			m_pThreadPool->Wait(state.subtreeTasks);
+		}
+		else
+		{
+			SubdivideBinned(0, 0, state);
+		}
+
+		m_Nodes.resize(state.nodeCount.load());
+	}
+
+	void BVH::SubdivideBinnedTopLevels(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state)
+	{
+		//Small enough to be built by a single thread, which avoids any synchronization below this node
+		if (m_Nodes[nodeIndex].primitiveCount < s_ParallelSubtreeThreshold)
+		{
+			m_pThreadPool->Run(state.subtreeTasks, [this, nodeIndex, depth, &state] { SubdivideBinned(nodeIndex, depth, state); });
+			return;
+		}
+
+		uint32_t leftChildIndex{};
+		if (!SplitNodeBinned(nodeIndex, depth, state, leftChildIndex))
+			return;
+
+		SubdivideBinnedTopLevels(leftChildIndex, depth + 1, state);
+		SubdivideBinnedTopLevels(leftChildIndex + 1, depth + 1, state);
+	}
+
+	void BVH::SubdivideBinned(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state)
+	{
+		struct SplitTask
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+		};
+		std::vector<SplitTask> nodesToSplit{ { nodeIndex, depth } };
+
+		while (!nodesToSplit.empty())
+		{
+			const SplitTask task{ nodesToSplit.back() };
+			nodesToSplit.pop_back();
+
+			uint32_t leftChildIndex{};
+			if (!SplitNodeBinned(task.nodeIndex, task.depth, state, leftChildIndex))
+				continue;
+
+			nodesToSplit.push_back({ leftChildIndex + 1, task.depth + 1 });
+			nodesToSplit.push_back({ leftChildIndex, task.depth + 1 });
+		}
+	}
+
+	bool BVH::SplitNodeBinned(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state, uint32_t& leftChildIndex)
+	{
+		const BVHNode node{ m_Nodes[nodeIndex] };
+		if (node.primitiveCount <= 1)
+			return false;
+
+		const std::vector<AABB>& primitiveBounds{ state.primitiveBounds };
+		const std::vector<Vector3>& centroids{ state.centroids };
+		uint32_t* const first{ m_PrimitiveIndices.data() + node.leftFirst };
+
+		//Large nodes are processed in chunks, on the thread pool when there is one
+		//The chunked partition is stable, so the tree does not depend on the number of threads
+		const bool isLargeNode{ node.primitiveCount >= s_ParallelSubtreeThreshold };
+		ThreadPool* const pThreadPool{ isLargeNode ? m_pThreadPool : nullptr };
+		const uint32_t chunkSize{ isLargeNode ? s_ParallelChunkSize : node.primitiveCount };
+
+		const AABB centroidBounds{ ReduceChunks<AABB>(pThreadPool, node.primitiveCount, chunkSize,
+			[&](uint32_t begin, uint32_t end, AABB& bounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+					bounds.Grow(centroids[first[i]]);
+			},
+			[](AABB& bounds, const AABB& other) { bounds.Grow(other); }) };
+
+		Vector3 binScale{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float extent{ centroidBounds.maxAABB[axis] - centroidBounds.minAABB[axis] };
+			binScale[axis] = (extent > 0.f) ? s_BinCount / extent : 0.f;
+		}
+
+		const auto getBin{ [&](uint32_t primitiveIndex, int axis)
+			{
+				const float offset{ (centroids[primitiveIndex][axis] - centroidBounds.minAABB[axis]) * binScale[axis] };
+				return std::min(static_cast<uint32_t>(offset), s_BinCount - 1);
+			} };
+
+		int bestAxis{ -1 };
+		uint32_t bestBin{};
+		uint32_t bestLeftCount{};
+		AABB leftBounds{};
+		AABB rightBounds{};
+
+		if (depth < s_MaxSAHDepth)
+		{
+			const BinGrid bins{ ReduceChunks<BinGrid>(pThreadPool, node.primitiveCount, chunkSize,
+				[&](uint32_t begin, uint32_t end, BinGrid& grid)
+				{
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						const uint32_t primitiveIndex{ first[i] };
+						for (int axis{}; axis < 3; ++axis)
+						{
+							if (binScale[axis] == 0.f)
+								continue;
+
+							Bin& bin{ grid[axis][getBin(primitiveIndex, axis)] };
+							bin.bounds.Grow(primitiveBounds[primitiveIndex]);
+							++bin.count;
+						}
+					}
+				},
+				[](BinGrid& grid, const BinGrid& other)
+				{
+					for (int axis{}; axis < 3; ++axis)
+					{
+						for (uint32_t i{}; i < s_BinCount; ++i)
+						{
+							grid[axis][i].bounds.Grow(other[axis][i].bounds);
+							grid[axis][i].count += other[axis][i].count;
+						}
+					}
+				}) };
+
+			//Same sweep as FindBestSplit, but over the split planes between the bins
+			float bestCost{ FLT_MAX };
+			for (int axis{}; axis < 3; ++axis)
+			{
+				if (binScale[axis] == 0.f)
+					continue;
+
+				float rightAreas[s_BinCount]{};
+				uint32_t rightCounts[s_BinCount]{};
+
+				AABB sweepBounds{};
+				uint32_t sweepCount{};
+				for (uint32_t i{ s_BinCount - 1 }; i > 0; --i)
+				{
+					sweepBounds.Grow(bins[axis][i].bounds);
+					sweepCount += bins[axis][i].count;
+					rightAreas[i] = sweepBounds.Area();
+					rightCounts[i] = sweepCount;
+				}
+
+				sweepBounds = AABB{};
+				sweepCount = 0;
+				for (uint32_t split{ 1 }; split < s_BinCount; ++split)
+				{
+					sweepBounds.Grow(bins[axis][split - 1].bounds);
+					sweepCount += bins[axis][split - 1].count;
+
+					if (sweepCount == 0 || rightCounts[split] == 0)
+						continue;
+
+					const float cost{ sweepBounds.Area() * sweepCount + rightAreas[split] * rightCounts[split] };
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = split;
+						bestLeftCount = sweepCount;
+					}
+				}
+			}
+
+			if (bestAxis >= 0)
+			{
+				const float parentArea{ node.bounds.Area() };
+				const float splitCost{ (parentArea > 0.f) ? s_TraversalCost + s_IntersectionCost * bestCost / parentArea : s_TraversalCost };
+				const float leafCost{ s_IntersectionCost * node.primitiveCount };
+
+				if (splitCost >= leafCost && node.primitiveCount <= s_MaxLeafSize)
+					return false;
+
+				//The bins already hold the exact bounds of both children
+				for (uint32_t i{}; i < s_BinCount; ++i)
+				{
+					if (i < bestBin)
+						leftBounds.Grow(bins[bestAxis][i].bounds);
+					else
+						rightBounds.Grow(bins[bestAxis][i].bounds);
+				}
+			}
+		}
+
+		if (bestAxis >= 0)
+		{
+			const auto isLeft{ [&](uint32_t primitiveIndex) { return getBin(primitiveIndex, bestAxis) < bestBin; } };
+
+			if (!isLargeNode)
+			{
+				std::partition(first, first + node.primitiveCount, isLeft);
+			}
+			else
+			{
+				//Count the left primitives of every chunk, then every chunk scatters its primitives to its own part of both halves
+				const uint32_t chunkCount{ (node.primitiveCount + chunkSize - 1) / chunkSize };
+				std::vector<uint32_t> leftOffsets(chunkCount);
+				ForEachChunk(pThreadPool, node.primitiveCount, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+					{
+						leftOffsets[chunkIndex] = static_cast<uint32_t>(std::count_if(first + begin, first + end, isLeft));
+					});
+
+				std::vector<uint32_t> rightOffsets(chunkCount);
+				uint32_t leftOffset{};
+				uint32_t rightOffset{ bestLeftCount };
+				for (uint32_t chunkIndex{}; chunkIndex < chunkCount; ++chunkIndex)
+				{
+					const uint32_t chunkLeftCount{ leftOffsets[chunkIndex] };
+					const uint32_t chunkPrimitiveCount{ std::min(chunkSize, node.primitiveCount - chunkIndex * chunkSize) };
+
+					leftOffsets[chunkIndex] = leftOffset;
+					rightOffsets[chunkIndex] = rightOffset;
+					leftOffset += chunkLeftCount;
+					rightOffset += chunkPrimitiveCount - chunkLeftCount;
+				}
+				assert(leftOffset == bestLeftCount);
+
+				const std::vector<uint32_t> sourceIndices(first, first + node.primitiveCount);
+				ForEachChunk(pThreadPool, node.primitiveCount, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+					{
+						uint32_t leftIndex{ leftOffsets[chunkIndex] };
+						uint32_t rightIndex{ rightOffsets[chunkIndex] };
+						for (uint32_t i{ begin }; i < end; ++i)
+						{
+							const uint32_t primitiveIndex{ sourceIndices[i] };
+							if (isLeft(primitiveIndex))
+								first[leftIndex++] = primitiveIndex;
+							else
+								first[rightIndex++] = primitiveIndex;
+						}
+					});
+			}
+		}
+		else
+		{
+			//Too deep for unbalanced SAH splits, or every centroid is in the same place: split at the median
+			if (node.primitiveCount <= s_MaxLeafSize)
+				return false;
+
+			const Vector3 extent{ centroidBounds.maxAABB - centroidBounds.minAABB };
+			const int axis{ (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2 };
+
+			bestLeftCount = node.primitiveCount / 2;
+			std::nth_element(first, first + bestLeftCount, first + node.primitiveCount, [&centroids, axis](uint32_t a, uint32_t b)
+				{
+					if (centroids[a][axis] == centroids[b][axis])
+						return a < b;
+
+					return centroids[a][axis] < centroids[b][axis];
+				});
+
+			for (uint32_t i{}; i < node.primitiveCount; ++i)
+			{
+				if (i < bestLeftCount)
+					leftBounds.Grow(primitiveBounds[first[i]]);
+				else
+					rightBounds.Grow(primitiveBounds[first[i]]);
+			}
+		}
+
+		assert(depth < s_MaxDepth);
+		leftChildIndex = state.nodeCount.fetch_add(2, std::memory_order_relaxed);
+
+		m_Nodes[leftChildIndex] = BVHNode{ leftBounds, node.leftFirst, bestLeftCount };
+		m_Nodes[leftChildIndex + 1] = BVHNode{ rightBounds, node.leftFirst + bestLeftCount, node.primitiveCount - bestLeftCount };
+
+		m_Nodes[nodeIndex].leftFirst = leftChildIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+		return true;
+	}
+
+	struct BVH::LinearBuildState
+	{
+		//Sorted, mortonCodes[i] belongs to m_PrimitiveIndices[i]
+		const std::vector<uint64_t>& mortonCodes;
+		const std::vector<AABB>& primitiveBounds;
+
+		std::atomic<uint32_t> nodeCount;
+		TaskGroup subtreeTasks{};
+
+		//Nodes split before the subtrees were handed out, parents before their children, refitted once every subtree is done
+		std::vector<uint32_t> topLevelNodes{};
+	};
+
+	void BVH::BuildLinear(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		const AABB centroidBounds{ ReduceChunks<AABB>(m_pThreadPool, primitiveCount, s_RadixSortChunkSize,
+			[&](uint32_t begin, uint32_t end, AABB& bounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+					bounds.Grow(centroids[i]);
+			},
+			[](AABB& bounds, const AABB& other) { bounds.Grow(other); }) };
+
+		//Bits of sqrt(primitiveCount) rounded up, plus one
+		const uint32_t sqrtBits{ (static_cast<uint32_t>(std::bit_width(primitiveCount - 1)) + 1) / 2 };
+		const uint32_t bitsPerAxis{ std::clamp(sqrtBits + 1, s_MinMortonBitsPerAxis, s_MaxMortonBitsPerAxis) };
+		const bool useWideCodes{ bitsPerAxis > 10 };
+		const float cellCount{ static_cast<float>(1u << bitsPerAxis) };
+
+		Vector3 cellScale{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float extent{ centroidBounds.maxAABB[axis] - centroidBounds.minAABB[axis] };
+			cellScale[axis] = (extent > 0.f) ? cellCount / extent : 0.f;
+		}
+
+		std::vector<uint64_t> mortonCodes(primitiveCount);
+		ForEachChunk(m_pThreadPool, primitiveCount, s_RadixSortChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					uint32_t cells[3]{};
+					for (int axis{}; axis < 3; ++axis)
+					{
+						const float offset{ (centroids[i][axis] - centroidBounds.minAABB[axis]) * cellScale[axis] };
+						cells[axis] = std::min(static_cast<uint32_t>(offset), (1u << bitsPerAxis) - 1);
+					}
+
+					if (useWideCodes)
+						mortonCodes[i] = ExpandBits21(cells[0]) << 2 | ExpandBits21(cells[1]) << 1 | ExpandBits21(cells[2]);
+					else
+						mortonCodes[i] = ExpandBits10(cells[0]) << 2 | ExpandBits10(cells[1]) << 1 | ExpandBits10(cells[2]);
+				}
+			});
+
+		RadixSort(m_pThreadPool, s_RadixSortChunkSize, bitsPerAxis * 3, mortonCodes, m_PrimitiveIndices);
+
+		//Only the topology is built top down, every subtree refits its bounds bottom up once it is split
+		m_Nodes.resize(2 * static_cast<size_t>(primitiveCount) - 1);
+		m_Nodes[0].leftFirst = 0;
+		m_Nodes[0].primitiveCount = primitiveCount;
+
+		LinearBuildState state{ mortonCodes, primitiveBounds, 1 };
+
+		if (m_pThreadPool)
+		{
+			SubdivideLinearTopLevels(0, 0, state);
+			m_pThreadPool->Wait(state.subtreeTasks);
+
+			for (auto it{ state.topLevelNodes.rbegin() }; it != state.topLevelNodes.rend(); ++it)
+				RefitNode(*it, primitiveBounds);
+		}
+		else
+		{
+			SubdivideLinear(0, 0, state);
+		}
+
+		m_Nodes.resize(state.nodeCount.load());
+	}
+
+	void BVH::SubdivideLinearTopLevels(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state)
+	{
+		if (m_Nodes[nodeIndex].primitiveCount < s_ParallelSubtreeThreshold)
+		{
+			m_pThreadPool->Run(state.subtreeTasks, [this, nodeIndex, depth, &state] { SubdivideLinear(nodeIndex, depth, state); });
+			return;
+		}
+
+		state.topLevelNodes.push_back(nodeIndex);
+
+		uint32_t leftChildIndex{};
+		if (!SplitNodeLinear(nodeIndex, depth, state, leftChildIndex))
+			return;
+
+		SubdivideLinearTopLevels(leftChildIndex, depth + 1, state);
+		SubdivideLinearTopLevels(leftChildIndex + 1, depth + 1, state);
+	}
+
+	void BVH::SubdivideLinear(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state)
+	{
+		struct SplitTask
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+		};
+		std::vector<SplitTask> nodesToSplit{ { nodeIndex, depth } };
+
+		//Every node of the subtree in the order it was split, parents before their children
+		std::vector<uint32_t> visitedNodes{};
+
+		while (!nodesToSplit.empty())
+		{
+			const SplitTask task{ nodesToSplit.back() };
+			nodesToSplit.pop_back();
+			visitedNodes.push_back(task.nodeIndex);
+
+			uint32_t leftChildIndex{};
+			if (!SplitNodeLinear(task.nodeIndex, task.depth, state, leftChildIndex))
+				continue;
+
+			nodesToSplit.push_back({ leftChildIndex + 1, task.depth + 1 });
+			nodesToSplit.push_back({ leftChildIndex, task.depth + 1 });
+		}
+
+		//Children are visited after their parent, so walking backwards refits every child first
+		for (auto it{ visitedNodes.rbegin() }; it != visitedNodes.rend(); ++it)
+			RefitNode(*it, state.primitiveBounds);
+	}
+
+	bool BVH::SplitNodeLinear(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state, uint32_t& leftChildIndex)
+	{
+		const BVHNode node{ m_Nodes[nodeIndex] };
+		if (node.primitiveCount <= s_MaxLinearLeafSize)
+			return false;
+
+		const auto first{ state.mortonCodes.begin() + node.leftFirst };
+		const auto last{ first + node.primitiveCount };
+
+		//Every code in the range shares the bits above the highest bit where the first and last code differ
+		//Splitting where that bit flips from 0 to 1 halves the range spatially
+		//Equal codes, or a tree deep enough to risk overflowing the traversal stack, are split in the middle
+		uint32_t leftCount{ node.primitiveCount / 2 };
+
+		const uint64_t differentBits{ *first ^ *(last - 1) };
+		if (differentBits != 0 && depth < s_MaxSAHDepth)
+		{
+			const int splitBit{ 63 - std::countl_zero(differentBits) };
+			const auto split{ std::partition_point(first, last, [splitBit](uint64_t code) { return ((code >> splitBit) & 1) == 0; }) };
+			leftCount = static_cast<uint32_t>(split - first);
+		}
+
+		assert(depth < s_MaxDepth);
+		leftChildIndex = state.nodeCount.fetch_add(2, std::memory_order_relaxed);
+
+		m_Nodes[leftChildIndex] = BVHNode{ AABB{}, node.leftFirst, leftCount };
+		m_Nodes[leftChildIndex + 1] = BVHNode{ AABB{}, node.leftFirst + leftCount, node.primitiveCount - leftCount };
+
+		m_Nodes[nodeIndex].leftFirst = leftChildIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+		return true;
+	}
+
+	void BVH::BuildSpatial(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		std::vector<Reference> references{};
+		references.reserve(primitiveCount);
+
+		BVHNode root{};
+		for (uint32_t i{}; i < primitiveCount; ++i)
+		{
+			references.push_back({ primitiveBounds[i], i });
+			root.bounds.Grow(primitiveBounds[i]);
+		}
+
+		const float rootArea{ root.bounds.Area() };
+		uint32_t splitBudget{ static_cast<uint32_t>(primitiveCount * std::max(m_SpatialSplitReferenceLimit - 1.f, 0.f)) };
+
+		//Leaves append their references as they are created, so the index list is rebuilt from scratch
+		m_PrimitiveIndices.clear();
+		m_PrimitiveIndices.reserve(static_cast<size_t>(primitiveCount) + splitBudget);
+		m_Nodes.reserve(2 * (static_cast<size_t>(primitiveCount) + splitBudget) - 1);
+		m_Nodes.emplace_back(root);
+
+		struct SplitTask
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+			std::vector<Reference> references;
+		};
+		std::vector<SplitTask> nodesToSplit{};
+		nodesToSplit.push_back({ 0, 0, std::move(references) });
+
+		while (!nodesToSplit.empty())
+		{
+			SplitTask task{ std::move(nodesToSplit.back()) };
+			nodesToSplit.pop_back();
+
+			std::vector<Reference> leftReferences{};
+			std::vector<Reference> rightReferences{};
+			AABB leftBounds{};
+			AABB rightBounds{};
+
+			if (!SplitReferences(m_Nodes[task.nodeIndex].bounds, task.depth, rootArea, splitBudget, pTriangles, task.references, leftReferences, rightReferences, leftBounds, rightBounds))
+			{
+				BVHNode& leaf{ m_Nodes[task.nodeIndex] };
+				leaf.leftFirst = static_cast<uint32_t>(m_PrimitiveIndices.size());
+				leaf.primitiveCount = static_cast<uint32_t>(task.references.size());
+
+				for (const Reference& reference : task.references)
+					m_PrimitiveIndices.push_back(reference.primitiveIndex);
+				continue;
+			}
+
+			assert(task.depth < s_MaxDepth);
+			const uint32_t leftChildIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+			m_Nodes.push_back(BVHNode{ leftBounds, 0, 0 });
+			m_Nodes.push_back(BVHNode{ rightBounds, 0, 0 });
+
+			m_Nodes[task.nodeIndex].leftFirst = leftChildIndex;
+			m_Nodes[task.nodeIndex].primitiveCount = 0;
+
+			nodesToSplit.push_back({ leftChildIndex + 1, task.depth + 1, std::move(rightReferences) });
+			nodesToSplit.push_back({ leftChildIndex, task.depth + 1, std::move(leftReferences) });
+		}
+	}
+
+	bool BVH::SplitReferences(const AABB& nodeBounds, uint32_t depth, float rootArea, uint32_t& splitBudget, const TriangleSource* pTriangles,
+		std::vector<Reference>& references, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences, AABB& leftBounds, AABB& rightBounds) const
+	{
+		const uint32_t referenceCount{ static_cast<uint32_t>(references.size()) };
+		if (referenceCount <= 1)
+			return false;
+
+		AABB centroidBounds{};
+		for (const Reference& reference : references)
+			centroidBounds.Grow(reference.bounds.GetCenter());
+
+		//Object split, binned on the centroids of the references
+		int objectAxis{ -1 };
+		uint32_t objectBin{};
+		float objectCost{ FLT_MAX };
+		Vector3 binScale{};
+
+		const auto getObjectBin{ [&](const Reference& reference, int axis)
+			{
+				const float offset{ (reference.bounds.GetCenter()[axis] - centroidBounds.minAABB[axis]) * binScale[axis] };
+				return std::min(static_cast<uint32_t>(offset), s_BinCount - 1);
+			} };
+
+		//Spatial split, binned on planes evenly spread over the node
+		int spatialAxis{ -1 };
+		float spatialPosition{};
+		float spatialCost{ FLT_MAX };
+
+		if (depth < s_MaxSAHDepth)
+		{
+			for (int axis{}; axis < 3; ++axis)
+			{
+				const float extent{ centroidBounds.maxAABB[axis] - centroidBounds.minAABB[axis] };
+				binScale[axis] = (extent > 0.f) ? s_BinCount / extent : 0.f;
+			}
+
+			BinGrid bins{};
+			for (const Reference& reference : references)
+			{
+				for (int axis{}; axis < 3; ++axis)
+				{
+					if (binScale[axis] == 0.f)
+						continue;
+
+					Bin& bin{ bins[axis][getObjectBin(reference, axis)] };
+					bin.bounds.Grow(reference.bounds);
+					++bin.count;
+				}
+			}
+
+			AABB objectLeftBounds{};
+			AABB objectRightBounds{};
+			for (int axis{}; axis < 3; ++axis)
+			{
+				if (binScale[axis] == 0.f)
+					continue;
+
+				AABB sweepRightBounds[s_BinCount]{};
+				uint32_t rightCounts[s_BinCount]{};
+
+				AABB sweepBounds{};
+				uint32_t sweepCount{};
+				for (uint32_t i{ s_BinCount - 1 }; i > 0; --i)
+				{
+					sweepBounds.Grow(bins[axis][i].bounds);
+					sweepCount += bins[axis][i].count;
+					sweepRightBounds[i] = sweepBounds;
+					rightCounts[i] = sweepCount;
+				}
+
+				sweepBounds = AABB{};
+				sweepCount = 0;
+				for (uint32_t split{ 1 }; split < s_BinCount; ++split)
+				{
+					sweepBounds.Grow(bins[axis][split - 1].bounds);
+					sweepCount += bins[axis][split - 1].count;
+
+					if (sweepCount == 0 || rightCounts[split] == 0)
+						continue;
+
+					const float cost{ sweepBounds.Area() * sweepCount + sweepRightBounds[split].Area() * rightCounts[split] };
+					if (cost < objectCost)
+					{
+						objectCost = cost;
+						objectAxis = axis;
+						objectBin = split;
+						objectLeftBounds = sweepBounds;
+						objectRightBounds = sweepRightBounds[split];
+					}
+				}
+			}
+
+			//Spatial splits only pay off where the object split children overlap a lot, which is where long thin primitives are
+			const AABB overlap{ Intersect(objectLeftBounds, objectRightBounds) };
+			const Vector3 overlapExtent{ overlap.maxAABB - overlap.minAABB };
+			const bool childrenOverlap{ objectAxis < 0
+				|| (overlapExtent.x >= 0.f && overlapExtent.y >= 0.f && overlapExtent.z >= 0.f && overlap.Area() > s_SpatialSplitOverlapRatio * rootArea) };
+
+			if (splitBudget > 0 && childrenOverlap)
+			{
+				struct SpatialBin
+				{
+					AABB bounds{};
+					uint32_t entryCount{};
+					uint32_t exitCount{};
+				};
+
+				for (int axis{}; axis < 3; ++axis)
+				{
+					const float nodeMin{ nodeBounds.minAABB[axis] };
+					const float binWidth{ (nodeBounds.maxAABB[axis] - nodeMin) / s_BinCount };
+					if (binWidth <= 0.f)
+						continue;
+
+					const auto getSpatialBin{ [&](float position)
+						{
+							const float offset{ std::max((position - nodeMin) / binWidth, 0.f) };
+							return std::min(static_cast<uint32_t>(offset), s_BinCount - 1);
+						} };
+
+					SpatialBin spatialBins[s_BinCount]{};
+					for (const Reference& reference : references)
+					{
+						const uint32_t firstBin{ getSpatialBin(reference.bounds.minAABB[axis]) };
+						const uint32_t lastBin{ std::max(getSpatialBin(reference.bounds.maxAABB[axis]), firstBin) };
+
+						//Clip the reference bin by bin, each bin only grows by the part inside it
+						Reference remainder{ reference };
+						for (uint32_t bin{ firstBin }; bin < lastBin; ++bin)
+						{
+							Reference inside{};
+							Reference outside{};
+							SplitReference(remainder, axis, nodeMin + binWidth * (bin + 1), pTriangles, inside, outside);
+
+							spatialBins[bin].bounds.Grow(inside.bounds);
+							remainder = outside;
+						}
+						spatialBins[lastBin].bounds.Grow(remainder.bounds);
+
+						++spatialBins[firstBin].entryCount;
+						++spatialBins[lastBin].exitCount;
+					}
+
+					float rightAreas[s_BinCount]{};
+					uint32_t rightCounts[s_BinCount]{};
+
+					AABB sweepBounds{};
+					uint32_t sweepCount{};
+					for (uint32_t i{ s_BinCount - 1 }; i > 0; --i)
+					{
+						sweepBounds.Grow(spatialBins[i].bounds);
+						sweepCount += spatialBins[i].exitCount;
+						rightAreas[i] = sweepBounds.Area();
+						rightCounts[i] = sweepCount;
+					}
+
+					sweepBounds = AABB{};
+					sweepCount = 0;
+					for (uint32_t split{ 1 }; split < s_BinCount; ++split)
+					{
+						sweepBounds.Grow(spatialBins[split - 1].bounds);
+						sweepCount += spatialBins[split - 1].entryCount;
+
+						if (sweepCount == 0 || rightCounts[split] == 0)
+							continue;
+
+						const float cost{ sweepBounds.Area() * sweepCount + rightAreas[split] * rightCounts[split] };
+						if (cost < spatialCost)
+						{
+							spatialCost = cost;
+							spatialAxis = axis;
+							spatialPosition = nodeMin + binWidth * split;
+						}
+					}
+				}
+			}
+
+			const float bestCost{ std::min(objectCost, spatialCost) };
+			if (bestCost < FLT_MAX)
+			{
+				const float parentArea{ nodeBounds.Area() };
+				const float splitCost{ (parentArea > 0.f) ? s_TraversalCost + s_IntersectionCost * bestCost / parentArea : s_TraversalCost };
+				const float leafCost{ s_IntersectionCost * referenceCount };
+
+				if (splitCost >= leafCost && referenceCount <= s_MaxLeafSize)
+					return false;
+			}
+		}
+
+		leftBounds = AABB{};
+		rightBounds = AABB{};
+
+		if (spatialAxis >= 0 && spatialCost < objectCost)
+		{
+			const uint32_t straddleCount{ static_cast<uint32_t>(std::count_if(references.begin(), references.end(), [&](const Reference& reference)
+				{
+					return reference.bounds.minAABB[spatialAxis] < spatialPosition && reference.bounds.maxAABB[spatialAxis] > spatialPosition;
+				})) };
+
+			//Out of budget, fall back to the object split
+			if (straddleCount <= splitBudget)
+			{
+				for (const Reference& reference : references)
+				{
+					if (reference.bounds.maxAABB[spatialAxis] <= spatialPosition)
+					{
+						leftReferences.push_back(reference);
+						leftBounds.Grow(reference.bounds);
+					}
+					else if (reference.bounds.minAABB[spatialAxis] >= spatialPosition)
+					{
+						rightReferences.push_back(reference);
+						rightBounds.Grow(reference.bounds);
+					}
+					else
+					{
+						Reference left{};
+						Reference right{};
+						SplitReference(reference, spatialAxis, spatialPosition, pTriangles, left, right);
+
+						leftReferences.push_back(left);
+						leftBounds.Grow(left.bounds);
+						rightReferences.push_back(right);
+						rightBounds.Grow(right.bounds);
+					}
+				}
+
+				if (!leftReferences.empty() && !rightReferences.empty())
+				{
+					splitBudget -= straddleCount;
+					return true;
+				}
+
+				leftReferences.clear();
+				rightReferences.clear();
+				leftBounds = AABB{};
+				rightBounds = AABB{};
+			}
+		}
+
+		if (objectAxis >= 0)
+		{
+			for (const Reference& reference : references)
+			{
+				if (getObjectBin(reference, objectAxis) < objectBin)
+				{
+					leftReferences.push_back(reference);
+					leftBounds.Grow(reference.bounds);
+				}
+				else
+				{
+					rightReferences.push_back(reference);
+					rightBounds.Grow(reference.bounds);
+				}
+			}
+			return true;
+		}
+
+		//Too deep for unbalanced SAH splits, or every centroid is in the same place: split at the median
+		if (referenceCount <= s_MaxLeafSize)
+			return false;
+
+		const Vector3 extent{ centroidBounds.maxAABB - centroidBounds.minAABB };
+		const int axis{ (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2 };
+
+		const uint32_t leftCount{ referenceCount / 2 };
+		std::nth_element(references.begin(), references.begin() + leftCount, references.end(), [axis](const Reference& a, const Reference& b)
+			{
+				const float centerA{ a.bounds.GetCenter()[axis] };
+				const float centerB{ b.bounds.GetCenter()[axis] };
+				if (centerA == centerB)
+					return a.primitiveIndex < b.primitiveIndex;
+
+				return centerA < centerB;
+			});
+
+		for (uint32_t i{}; i < referenceCount; ++i)
+		{
+			if (i < leftCount)
+			{
+				leftReferences.push_back(references[i]);
+				leftBounds.Grow(references[i].bounds);
+			}
+			else
+			{
+				rightReferences.push_back(references[i]);
+				rightBounds.Grow(references[i].bounds);
+			}
+		}
+		return true;
+	}
+
+	void BVH::SplitReference(const Reference& reference, int axis, float position, const TriangleSource* pTriangles, Reference& left, Reference& right)
+	{
+		left = Reference{ AABB{}, reference.primitiveIndex };
+		right = Reference{ AABB{}, reference.primitiveIndex };
+
+		if (pTriangles)
+		{
+			//Every vertex lands on its side of the plane, every edge crossing the plane adds the crossing point to both sides
+			const size_t firstIndex{ static_cast<size_t>(reference.primitiveIndex) * 3 };
+			const Vector3* vertices[3]{
+				&pTriangles->positions[pTriangles->indices[firstIndex]],
+				&pTriangles->positions[pTriangles->indices[firstIndex + 1]],
+				&pTriangles->positions[pTriangles->indices[firstIndex + 2]]
+			};
+
+			for (int i{}; i < 3; ++i)
+			{
+				const Vector3& start{ *vertices[i] };
+				const Vector3& end{ *vertices[(i + 1) % 3] };
+
+				if (start[axis] <= position)
+					left.bounds.Grow(start);
+				if (start[axis] >= position)
+					right.bounds.Grow(start);
+
+				if ((start[axis] < position && end[axis] > position) || (start[axis] > position && end[axis] < position))
+				{
+					const float t{ (position - start[axis]) / (end[axis] - start[axis]) };
+					Vector3 crossing{ start + (end - start) * t };
+					crossing[axis] = position;
+
+					left.bounds.Grow(crossing);
+					right.bounds.Grow(crossing);
+				}
+			}
+		}
+		else
+		{
+			//Without the geometry only the box itself can be cut
+			left.bounds = reference.bounds;
+			right.bounds = reference.bounds;
+		}
+
+		left.bounds.maxAABB[axis] = std::min(left.bounds.maxAABB[axis], position);
+		right.bounds.minAABB[axis] = std::max(right.bounds.minAABB[axis], position);
+
+		//The reference may already have been clipped by an earlier split
+		left.bounds = Intersect(left.bounds, reference.bounds);
+		right.bounds = Intersect(right.bounds, reference.bounds);
+
+		//Rounding can leave a side empty when the triangle only touches the plane, cutting the box is still conservative
+		const auto isEmpty{ [](const AABB& bounds)
+			{
+				return bounds.minAABB.x > bounds.maxAABB.x || bounds.minAABB.y > bounds.maxAABB.y || bounds.minAABB.z > bounds.maxAABB.z;
+			} };
+
+		if (isEmpty(left.bounds))
+		{
+			left.bounds = reference.bounds;
+			left.bounds.maxAABB[axis] = std::max(std::min(left.bounds.maxAABB[axis], position), left.bounds.minAABB[axis]);
+		}
+		if (isEmpty(right.bounds))
+		{
+			right.bounds = reference.bounds;
+			right.bounds.minAABB[axis] = std::min(std::max(right.bounds.minAABB[axis], position), right.bounds.maxAABB[axis]);
+		}
+	}
+
+	void BVH::Subdivide(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, std::vector<float>& rightAreas)
+	{
+		//Iterative instead of recursive, badly shaped meshes can create very deep trees
+		struct SplitTask
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+		};
+		std::vector<SplitTask> nodesToSplit{ { nodeIndex, 0 } };
+
+		while (!nodesToSplit.empty())
+		{
+			const SplitTask task{ nodesToSplit.back() };
+			nodesToSplit.pop_back();
+
+			const BVHNode node{ m_Nodes[task.nodeIndex] };
+			if (node.primitiveCount <= 1)
+				continue;
+
+			int bestAxis{ -1 };
+			uint32_t bestLeftCount{};
+
+			if (task.depth < s_MaxSAHDepth)
+			{
+				const float splitCost{ FindBestSplit(node, primitiveBounds, centroids, rightAreas, bestAxis, bestLeftCount) };
+				const float leafCost{ s_IntersectionCost * node.primitiveCount };
+
+				if (bestAxis >= 0 && splitCost >= leafCost && node.primitiveCount <= s_MaxLeafSize)
+					continue;
+			}
+
+			if (bestAxis < 0)
+			{
+				//Deep enough that unbalanced SAH splits could overflow the traversal stack, keep the rest balanced
+				//Also taken when no split had a finite cost, so leaves never exceed s_MaxLeafSize
+				if (node.primitiveCount <= s_MaxLeafSize)
+					continue;
+
+				const Vector3 extent{ node.bounds.maxAABB - node.bounds.minAABB };
+				bestAxis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+				bestLeftCount = node.primitiveCount / 2;
+			}
+
+			SortPrimitives(node, centroids, bestAxis);
+
+			assert(task.depth < s_MaxDepth);
+			const uint32_t leftChildIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+
+			BVHNode leftChild{};
+			leftChild.leftFirst = node.leftFirst;
+			leftChild.primitiveCount = bestLeftCount;
+
+			BVHNode rightChild{};
+			rightChild.leftFirst = node.leftFirst + bestLeftCount;
+			rightChild.primitiveCount = node.primitiveCount - bestLeftCount;
+
+			m_Nodes.emplace_back(leftChild);
+			m_Nodes.emplace_back(rightChild);
+
+			UpdateNodeBounds(leftChildIndex, primitiveBounds);
+			UpdateNodeBounds(leftChildIndex + 1, primitiveBounds);
+
+			m_Nodes[task.nodeIndex].leftFirst = leftChildIndex;
+			m_Nodes[task.nodeIndex].primitiveCount = 0;
+
+			nodesToSplit.push_back({ leftChildIndex + 1, task.depth + 1 });
+			nodesToSplit.push_back({ leftChildIndex, task.depth + 1 });
+		}
+	}
+
+	float BVH::FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, std::vector<float>& rightAreas, int& bestAxis, uint32_t& bestLeftCount)
+	{
+		//Full sweep: sort the primitives along every axis and evaluate every split position
+		const float parentArea{ node.bounds.Area() };
+		float bestCost{ FLT_MAX };
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			SortPrimitives(node, centroids, axis);
+
+			//Sweep from the right, storing the area of every right-hand side
+			AABB rightBounds{};
+			for (uint32_t i{ node.primitiveCount - 1 }; i > 0; --i)
+			{
+				rightBounds.Grow(primitiveBounds[m_PrimitiveIndices[node.leftFirst + i]]);
+				rightAreas[i] = rightBounds.Area();
+			}
+
+			//Sweep from the left and evaluate the SAH at every split position
+			AABB leftBounds{};
+			for (uint32_t leftCount{ 1 }; leftCount < node.primitiveCount; ++leftCount)
+			{
+				leftBounds.Grow(primitiveBounds[m_PrimitiveIndices[node.leftFirst + leftCount - 1]]);
+
+				const float cost{ leftBounds.Area() * leftCount + rightAreas[leftCount] * (node.primitiveCount - leftCount) };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestLeftCount = leftCount;
+				}
+			}
+		}
+
+		if (parentArea <= 0.f)
+			return s_TraversalCost;
+
+		return s_TraversalCost + s_IntersectionCost * bestCost / parentArea;
+	}
+
+	void BVH::SortPrimitives(const BVHNode& node, const std::vector<Vector3>& centroids, int axis)
+	{
+		const auto first{ m_PrimitiveIndices.begin() + node.leftFirst };
+		std::sort(first, first + node.primitiveCount, [&centroids, axis](uint32_t a, uint32_t b)
+			{
+				//Break ties on the index so every sort along the same axis gives the same order
+				if (centroids[a][axis] == centroids[b][axis])
+					return a < b;
+
+				return centroids[a][axis] < centroids[b][axis];
+			});
+	}
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	class ThreadPool;
+
+	struct AABB
+	{
+		Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const Vector3& point)
+		{
+			minAABB = Vector3::Min(minAABB, point);
+			maxAABB = Vector3::Max(maxAABB, point);
+		}
+
+		void Grow(const AABB& other)
+		{
+			minAABB = Vector3::Min(minAABB, other.minAABB);
+			maxAABB = Vector3::Max(maxAABB, other.maxAABB);
+		}
+
+		//Half of the surface area, only used as a ratio by the SAH
+		float Area() const
+		{
+			const Vector3 extent{ maxAABB - minAABB };
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+
+		Vector3 GetCenter() const
+		{
+			return (minAABB + maxAABB) * 0.5f;
+		}
+	};
+
+	struct BVHNode
+	{
+		AABB bounds{};
+
+		//Interior node: index of the left child (right child is leftFirst + 1)
+		//Leaf node: index of the first primitive in the primitive index list
+		uint32_t leftFirst{};
+		uint32_t primitiveCount{};
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	//How Build chooses the split of every node
+	enum class BVHBuildStrategy
+	{
+		//Evaluates the SAH at every primitive along every axis, slightly better trees but O(n log^2 n) and single threaded
+		SweepSAH,
+		//Evaluates the SAH between a fixed number of bins, the top levels are binned and partitioned on the thread pool
+		BinnedSAH,
+		//Sorts the primitives along a Morton curve and splits where the codes differ (LBVH)
+		//Update() always rebuilds instead of refitting, 1M triangles take about 200 ms on one core of which about 30 ms do not run on the thread pool
+		//That only fits a frame on many cores or for meshes of a few hundred thousand triangles
+		LinearMorton,
+		//SBVH: besides object splits also tries splitting space, clipping the primitives that straddle the plane into both children
+		//Built single threaded, meant for static meshes with long thin triangles, a primitive may then be listed in several leaves
+		SpatialSplitSAH
+	};
+
+	//Binary bounding volume hierarchy built with the surface area heuristic (SAH)
+	//Primitives are never moved, the hierarchy only stores a reordered list of their indices
+	//Only a SpatialSplitSAH build lists a primitive more than once
+	//Update() refits the existing tree in place and only rebuilds once its SAH cost degraded past the rebuild ratio
+	class BVH final
+	{
+	public:
+		//Deepest node any build strategy creates, the root is at depth 0
+		static constexpr uint32_t s_MaxDepth{ 64 };
+		//Depth first traversal holds at most one pending sibling per level above the current node, plus both children it pushes
+		static constexpr int s_MaxTraversalStackSize{ static_cast<int>(s_MaxDepth) + 1 };
+		//Most primitives any build strategy puts in one leaf
+		static constexpr uint32_t s_MaxLeafPrimitiveCount{ 8 };
+
+		BVH() = default;
+		~BVH() = default;
+
+		void Build(const std::vector<AABB>& primitiveBounds);
+		void BuildFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void Refit(const std::vector<AABB>& primitiveBounds);
+		void Update(const std::vector<AABB>& primitiveBounds);
+		void UpdateFromTriangles(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void Clear();
+
+		void SetBuildStrategy(BVHBuildStrategy strategy) { m_BuildStrategy = strategy; }
+		BVHBuildStrategy GetBuildStrategy() const { return m_BuildStrategy; }
+
+		//Builds run on this pool when set, the pool has to outlive the BVH
+		void SetThreadPool(ThreadPool* pThreadPool) { m_pThreadPool = pThreadPool; }
+		ThreadPool* GetThreadPool() const { return m_pThreadPool; }
+
+		//Milliseconds the last full Build took, refits are not included
+		float GetBuildTime() const { return m_BuildTime; }
+
+		//A SpatialSplitSAH build stops splitting primitives once the index list holds primitiveCount * ratio entries
+		void SetSpatialSplitReferenceLimit(float ratio) { m_SpatialSplitReferenceLimit = ratio; }
+		float GetSpatialSplitReferenceLimit() const { return m_SpatialSplitReferenceLimit; }
+
+		//Rebuild once the refitted SAH cost exceeds the cost right after the last build by this ratio
+		void SetRebuildCostRatio(float ratio) { m_RebuildCostRatio = ratio; }
+		float GetRebuildCostRatio() const { return m_RebuildCostRatio; }
+		float GetBuildSAHCost() const { return m_BuildSAHCost; }
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+		const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+
+		//Bytes used by the nodes and primitive indices
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(BVHNode) + m_PrimitiveIndices.size() * sizeof(uint32_t); }
+
+		float CalculateSAHCost() const;
+
+		static void CalculateTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices, std::vector<AABB>& triangleBounds, ThreadPool* pThreadPool = nullptr);
+
+	private:
+		std::vector<BVHNode> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+		std::vector<AABB> m_TriangleBounds{};
+		uint32_t m_PrimitiveCount{};
+
+		float m_BuildSAHCost{};
+		float m_RebuildCostRatio{ 1.5f };
+		float m_BuildTime{};
+
+		BVHBuildStrategy m_BuildStrategy{ BVHBuildStrategy::BinnedSAH };
+		ThreadPool* m_pThreadPool{};
+		float m_SpatialSplitReferenceLimit{ 1.3f };
+
+		static constexpr float s_TraversalCost{ 1.f };
+		static constexpr float s_IntersectionCost{ 1.f };
+		static constexpr uint32_t s_MaxLeafSize{ 8 };
+
+		//Below this depth nodes are split in the middle, which keeps the tree shallow enough for a fixed size traversal stack
+		static constexpr uint32_t s_MaxSAHDepth{ 32 };
+		//Every builder halves the primitive count of a node past s_MaxSAHDepth, 32 more levels reduce any uint32_t count to a single primitive
+		static_assert(s_MaxSAHDepth + 32 <= s_MaxDepth, "Median splits past s_MaxSAHDepth could exceed s_MaxDepth");
+
+		static constexpr uint32_t s_BinCount{ 16 };
+		//Nodes with at least this many primitives are binned and partitioned in chunks on the thread pool, smaller nodes become one subtree task
+		static constexpr uint32_t s_ParallelSubtreeThreshold{ 8192 };
+		static constexpr uint32_t s_ParallelChunkSize{ 2048 };
+		//Passes over every primitive, like the triangle bounds and the centroids, run in chunks of this size on the thread pool
+		static constexpr uint32_t s_PrimitiveChunkSize{ 16384 };
+
+		struct Bin
+		{
+			AABB bounds{};
+			uint32_t count{};
+		};
+		using BinGrid = std::array<std::array<Bin, s_BinCount>, 3>;
+
+		struct BinnedBuildState;
+
+		static constexpr uint32_t s_MaxLinearLeafSize{ 4 };
+		static_assert(s_MaxLeafSize <= s_MaxLeafPrimitiveCount && s_MaxLinearLeafSize <= s_MaxLeafPrimitiveCount, "Leaves can exceed s_MaxLeafPrimitiveCount");
+		//A surface of N triangles spans about sqrt(N) triangles per axis, one bit more than that separates neighbouring primitives
+		//Every bit less saves radix sort work, 1M triangles sort 33-bit codes in 3 passes instead of 63-bit codes in 8
+		static constexpr uint32_t s_MinMortonBitsPerAxis{ 10 };
+		static constexpr uint32_t s_MaxMortonBitsPerAxis{ 21 };
+		static constexpr uint32_t s_RadixSortChunkSize{ 16384 };
+
+		struct LinearBuildState;
+
+		//Spatial splits are only tried when the children of the best object split overlap by more than this part of the root area
+		static constexpr float s_SpatialSplitOverlapRatio{ 1e-5f };
+
+		//Triangles behind the primitive bounds, lets the spatial split builder clip them instead of their boxes
+		struct TriangleSource
+		{
+			const std::vector<Vector3>& positions;
+			const std::vector<int>& indices;
+		};
+
+		//Part of a primitive that ended up in a node, bounds are clipped by every spatial split above it
+		struct Reference
+		{
+			AABB bounds{};
+			uint32_t primitiveIndex{};
+		};
+
+		void UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds);
+		//Bounds of a leaf's primitives or of an interior node's two children, which have to be up to date
+		void RefitNode(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds);
+
+		void BuildSweep(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids);
+		void BuildBinned(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids);
+		void SubdivideBinnedTopLevels(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state);
+		void SubdivideBinned(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state);
+		bool SplitNodeBinned(uint32_t nodeIndex, uint32_t depth, BinnedBuildState& state, uint32_t& leftChildIndex);
+
+		void Build(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles);
+		void Update(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles);
+
+		void BuildSpatial(const std::vector<AABB>& primitiveBounds, const TriangleSource* pTriangles);
+		bool SplitReferences(const AABB& nodeBounds, uint32_t depth, float rootArea, uint32_t& splitBudget, const TriangleSource* pTriangles,
+			std::vector<Reference>& references, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences, AABB& leftBounds, AABB& rightBounds) const;
+		static void SplitReference(const Reference& reference, int axis, float position, const TriangleSource* pTriangles, Reference& left, Reference& right);
+
+		void BuildLinear(const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids);
+		void SubdivideLinearTopLevels(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state);
+		void SubdivideLinear(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state);
+		bool SplitNodeLinear(uint32_t nodeIndex, uint32_t depth, LinearBuildState& state, uint32_t& leftChildIndex);
+
+		void Subdivide(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, std::vector<float>& rightAreas);
+		float FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, std::vector<float>& rightAreas, int& bestAxis, uint32_t& bestLeftCount);
+		void SortPrimitives(const BVHNode& node, const std::vector<Vector3>& centroids, int axis);
+	};
+}
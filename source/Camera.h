@@ -42,7 +42,8 @@ namespace dae
 			return cameraToWorld;
 		}
 
-		void Update(Timer* pTimer)
+		//Returns whether the camera moved or turned
+		bool Update(Timer* pTimer)
 		{
 			const float deltaTime = pTimer->GetElapsed();
 			const float movementSpeed{ 8.f };
@@ -123,6 +124,8 @@ namespace dae
 			{
 				CalculateCameraToWorld();
 			}
+
+			return hasMoved;
 		}	
 
 	};
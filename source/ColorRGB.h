@@ -1,13 +1,28 @@
 #pragma once
 #include "MathHelpers.h"
+#include "SIMD.h"
 
 namespace dae
 {
+#if defined(DAE_SIMD_MATH)
+	//One aligned SSE register per color, the fourth lane is padding and stays zero
+	struct alignas(16) ColorRGB
+#else
 	struct ColorRGB
+#endif
 	{
 		float r{};
 		float g{};
 		float b{};
+#if defined(DAE_SIMD_MATH)
+		float padding{};
+
+		__m128 Load() const { return _mm_load_ps(&r); }
+		void Store(__m128 v) { _mm_store_ps(&r, v); }
+
+		//Clears the padding lane, a 0 / 0 there would leave a NaN behind
+		static __m128 MaskPadding(__m128 v) { return _mm_and_ps(v, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))); }
+#endif
 
 		void MaxToOne()
 		{
@@ -24,9 +39,13 @@ namespace dae
 		#pragma region ColorRGB (Member) Operators
 		const ColorRGB& operator+=(const ColorRGB& c)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(_mm_add_ps(Load(), c.Load()));
+#else
 			r += c.r;
 			g += c.g;
 			b += c.b;
+#endif
 
 			return *this;
 		}
@@ -38,14 +57,24 @@ namespace dae
 
 		ColorRGB operator+(const ColorRGB& c) const
 		{
+#if defined(DAE_SIMD_MATH)
+			ColorRGB result;
+			result.Store(_mm_add_ps(Load(), c.Load()));
+			return result;
+#else
 			return { r + c.r, g + c.g, b + c.b };
+#endif
 		}
 
 		const ColorRGB& operator-=(const ColorRGB& c)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(_mm_sub_ps(Load(), c.Load()));
+#else
 			r -= c.r;
 			g -= c.g;
 			b -= c.b;
+#endif
 
 			return *this;
 		}
@@ -57,14 +86,24 @@ namespace dae
 
 		ColorRGB operator-(const ColorRGB& c) const
 		{
+#if defined(DAE_SIMD_MATH)
+			ColorRGB result;
+			result.Store(_mm_sub_ps(Load(), c.Load()));
+			return result;
+#else
 			return { r - c.r, g - c.g, b - c.b };
+#endif
 		}
 
 		const ColorRGB& operator*=(const ColorRGB& c)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(_mm_mul_ps(Load(), c.Load()));
+#else
 			r *= c.r;
 			g *= c.g;
 			b *= c.b;
+#endif
 
 			return *this;
 		}
@@ -76,14 +115,24 @@ namespace dae
 
 		ColorRGB operator*(const ColorRGB& c) const
 		{
+#if defined(DAE_SIMD_MATH)
+			ColorRGB result;
+			result.Store(_mm_mul_ps(Load(), c.Load()));
+			return result;
+#else
 			return { r * c.r, g * c.g, b * c.b };
+#endif
 		}
 
 		const ColorRGB& operator/=(const ColorRGB& c)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(MaskPadding(_mm_div_ps(Load(), c.Load())));
+#else
 			r /= c.r;
 			g /= c.g;
 			b /= c.b;
+#endif
 
 			return *this;
 		}
@@ -95,9 +144,13 @@ namespace dae
 
 		const ColorRGB& operator*=(float s)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(_mm_mul_ps(Load(), _mm_set1_ps(s)));
+#else
 			r *= s;
 			g *= s;
 			b *= s;
+#endif
 
 			return *this;
 		}
@@ -109,14 +162,24 @@ namespace dae
 
 		ColorRGB operator*(float s) const
 		{
+#if defined(DAE_SIMD_MATH)
+			ColorRGB result;
+			result.Store(_mm_mul_ps(Load(), _mm_set1_ps(s)));
+			return result;
+#else
 			return { r * s, g * s,b * s };
+#endif
 		}
 
 		const ColorRGB& operator/=(float s)
 		{
+#if defined(DAE_SIMD_MATH)
+			Store(MaskPadding(_mm_div_ps(Load(), _mm_set1_ps(s))));
+#else
 			r /= s;
 			g /= s;
 			b /= s;
+#endif
 
 			return *this;
 		}
@@ -1,7 +1,13 @@
 #pragma once
 #include <cassert>
+#include <cmath>
 
 #include "Math.h"
+#include "BVH.h"
+#include "TransformBounds.h"
+#include "ThreadPool.h"
+#include "TriangleBlock.h"
+#include "WideBVH.h"
 #include "vector"
 
 namespace dae
@@ -54,6 +60,20 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Everything the Moller-Trumbore test needs, precomputed once per mesh triangle
+	struct PrecomputedTriangle
+	{
+		Vector3 v0{};
+		Vector3 edge1{};
+		Vector3 edge2{};
+
+		//Decides culling and grazing rays, kept so results match HitTest_Triangle
+		Vector3 normal{};
+	};
+
+	//Per triangle and per node passes of a mesh update run in chunks of this size on the BVH's thread pool
+	constexpr uint32_t MESH_UPDATE_CHUNK_SIZE{ 16384 };
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -64,8 +84,8 @@ namespace dae
 			//Calculate Normals
 			CalculateNormals();
 
-			transformedPositions.reserve(_positions.size());
-			transformedNormals.reserve(normals.size());
+			UpdateAABB();
+			UpdateBVH();
 
 			//Update Transforms
 			UpdateTransforms();
@@ -74,8 +94,8 @@ namespace dae
 		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, const std::vector<Vector3>& _normals, TriangleCullMode _cullMode) :
 			positions(_positions), indices(_indices), normals(_normals), cullMode(_cullMode)
 		{
-			transformedPositions.reserve(_positions.size());
-			transformedNormals.reserve(_normals.size());
+			UpdateAABB();
+			UpdateBVH();
 
 			UpdateTransforms();
 		}
@@ -96,9 +116,32 @@ namespace dae
 
 		Vector3 transformedMinAABB{};
 		Vector3 transformedMaxAABB{};
+		//Bounds the transformed positions themselves instead of the top BVH boxes, tighter but a pass over every vertex on each UpdateTransforms
+		//Only worth it for meshes that rarely move
+		bool useVertexBounds{ false };
+
+		//Rays are transformed into object space, so moving the mesh never touches its vertices
+		Matrix transform{};
+		Matrix inverseTransform{};
 
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
+		//Triangle i is the triangle starting at indices[i * 3], refreshed by UpdateBVH
+		std::vector<PrecomputedTriangle> precomputedTriangles{};
+
+		//The triangles of every BVH leaf packed into consecutive blocks, in BVH order
+		//leafBlockIndices[first primitive of a leaf] is the first block of that leaf, the other entries are unused
+		//Every layout shares the primitive order of the binary BVH, so one set of blocks serves them all
+		std::vector<TriangleBlock> triangleBlocks{};
+		std::vector<uint32_t> leafBlockIndices{};
+
+		//Built over the object space positions, primitive i is the triangle starting at indices[i * 3]
+		BVH bvh{};
+
+		//Layout the ray traversal uses, only the wide BVH matching it is kept up to date
+		BVHLayout bvhLayout{ DEFAULT_BVH_LAYOUT };
+		WideBVH<4> bvh4{};
+		WideBVH<8> bvh8{};
+		QuantizedWideBVH<4> bvh4Quantized{};
+		QuantizedWideBVH<8> bvh8Quantized{};
 
 		void Translate(const Vector3& translation)
 		{
@@ -129,9 +172,12 @@ namespace dae
 
 			normals.push_back(triangle.normal);
 
-			//Not ideal, but making sure all vertices are updated
-			if(!ignoreTransformUpdate)
+			//Not ideal, but making sure the BVH contains the new triangle
+			if (!ignoreTransformUpdate)
+			{
+				UpdateBVH();
 				UpdateTransforms();
+			}
 		}
 
 		void CalculateNormals()
@@ -148,24 +194,173 @@ namespace dae
 		{
 			//Calculate Final Transform 
 			//const auto finalTransform = ...
-			const Matrix trs{ scaleTransform * rotationTransform * translationTransform };
+			transform = scaleTransform * rotationTransform * translationTransform;
+			inverseTransform = Matrix::Inverse(transform);
+
+			UpdateTransformedAABB(transform);
+		}
 
-			transformedPositions.clear();
-			transformedNormals.clear();
+		//Call after changing positions, refits the BVH and only rebuilds it when the refitted tree became too slow
+		void UpdateBVH()
+		{
+			UpdatePrecomputedTriangles();
 
-			//Transform Positions (positions > transformedPositions)
-			for (int i{}; i < positions.size(); i++)
+			bvh.UpdateFromTriangles(positions, indices);
+			UpdateTriangleBlocks();
+			UpdateWideBVH();
+		}
+
+		void UpdatePrecomputedTriangles()
+		{
+			const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+			precomputedTriangles.resize(triangleCount);
+
+			ForEachChunk(bvh.GetThreadPool(), triangleCount, MESH_UPDATE_CHUNK_SIZE, [this](uint32_t begin, uint32_t end, uint32_t)
+				{
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						const Vector3& v0{ positions[indices[i * 3]] };
+
+						PrecomputedTriangle& triangle{ precomputedTriangles[i] };
+						triangle.v0 = v0;
+						triangle.edge1 = positions[indices[i * 3 + 1]] - v0;
+						triangle.edge2 = positions[indices[i * 3 + 2]] - v0;
+						triangle.normal = normals[i].Normalized();
+					}
+				});
+		}
+
+		//Rebuilds the BVH from scratch with the new strategy
+		//LinearMorton rebuilds every update, so it switches to the binary layout: collapsing and quantizing a wide tree every frame costs more than it saves
+		//SetBVHLayout afterwards still selects a wide layout for it
+		void SetBVHBuildStrategy(BVHBuildStrategy strategy)
+		{
+			bvh.SetBuildStrategy(strategy);
+			if (strategy == BVHBuildStrategy::LinearMorton)
+				bvhLayout = BVHLayout::Binary;
+
+			bvh.BuildFromTriangles(positions, indices);
+			UpdateTriangleBlocks();
+			UpdateWideBVH();
+		}
+
+		//Repacks the leaf triangles, the BVH and the precomputed triangles have to be up to date
+		void UpdateTriangleBlocks()
+		{
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+			leafBlockIndices.assign(primitiveIndices.size(), 0);
+
+			//Every leaf starts a new block, so the first block of each leaf is known before any block is filled
+			uint32_t blockCount{};
+			for (const BVHNode& node : nodes)
 			{
-				transformedPositions.emplace_back(trs.TransformPoint(positions[i]));
+				if (!node.IsLeaf())
+					continue;
+
+				leafBlockIndices[node.leftFirst] = blockCount;
+				blockCount += GetTriangleBlockCount(node.primitiveCount);
 			}
 
-			//Transform Normals (normals > transformedNormals)
-			for (int i{}; i < normals.size(); i++)
+			triangleBlocks.resize(blockCount);
+
+			ForEachChunk(bvh.GetThreadPool(), static_cast<uint32_t>(nodes.size()), MESH_UPDATE_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t)
+				{
+					for (uint32_t nodeIndex{ begin }; nodeIndex < end; ++nodeIndex)
+					{
+						const BVHNode& node{ nodes[nodeIndex] };
+						if (!node.IsLeaf())
+							continue;
+
+						for (uint32_t i{}; i < node.primitiveCount; ++i)
+						{
+							const uint32_t lane{ i % TriangleBlock::s_Width };
+							const uint32_t triangleIndex{ primitiveIndices[node.leftFirst + i] };
+							const PrecomputedTriangle& triangle{ precomputedTriangles[triangleIndex] };
+
+							//Blocks are reused between updates, so the unused lanes of the last block are cleared here
+							TriangleBlock& block{ triangleBlocks[leafBlockIndices[node.leftFirst] + i / TriangleBlock::s_Width] };
+							if (lane == 0)
+								block = TriangleBlock{};
+
+							block.v0X[lane] = triangle.v0.x;
+							block.v0Y[lane] = triangle.v0.y;
+							block.v0Z[lane] = triangle.v0.z;
+							block.edge1X[lane] = triangle.edge1.x;
+							block.edge1Y[lane] = triangle.edge1.y;
+							block.edge1Z[lane] = triangle.edge1.z;
+							block.edge2X[lane] = triangle.edge2.x;
+							block.edge2Y[lane] = triangle.edge2.y;
+							block.edge2Z[lane] = triangle.edge2.z;
+							block.normalX[lane] = triangle.normal.x;
+							block.normalY[lane] = triangle.normal.y;
+							block.normalZ[lane] = triangle.normal.z;
+							block.triangleIndex[lane] = triangleIndex;
+						}
+					}
+				});
+		}
+
+		void SetBVHLayout(BVHLayout layout)
+		{
+			bvhLayout = layout;
+			UpdateWideBVH();
+		}
+
+		//Collapses the binary BVH into the active wide layout, the refit/rebuild decision is always made on the binary tree
+		void UpdateWideBVH()
+		{
+			if (bvhLayout == BVHLayout::Wide4)
+				bvh4.Build(bvh);
+			else
+				bvh4.Clear();
+
+			if (bvhLayout == BVHLayout::Wide8)
+				bvh8.Build(bvh);
+			else
+				bvh8.Clear();
+
+			if (bvhLayout == BVHLayout::Wide4Quantized)
+				bvh4Quantized.Build(bvh);
+			else
+				bvh4Quantized.Clear();
+
+			if (bvhLayout == BVHLayout::Wide8Quantized)
+				bvh8Quantized.Build(bvh);
+			else
+				bvh8Quantized.Clear();
+		}
+
+		//Bytes the traversed layout takes, the binary BVH is always kept as well and is not included
+		size_t GetBVHMemoryUsage() const
+		{
+			switch (bvhLayout)
 			{
-				transformedNormals.emplace_back(trs.TransformVector(normals[i]).Normalized());
+			case BVHLayout::Wide4:
+				return bvh4.GetMemoryUsage();
+			case BVHLayout::Wide8:
+				return bvh8.GetMemoryUsage();
+			case BVHLayout::Wide4Quantized:
+				return bvh4Quantized.GetMemoryUsage();
+			case BVHLayout::Wide8Quantized:
+				return bvh8Quantized.GetMemoryUsage();
+			default:
+				return bvh.GetMemoryUsage();
 			}
+		}
 
-			UpdateTransformedAABB(trs);
+		//Bytes the quantized layouts save compared to the same tree with float bounds, 0 for the other layouts
+		size_t GetBVHMemorySaved() const
+		{
+			switch (bvhLayout)
+			{
+			case BVHLayout::Wide4Quantized:
+				return bvh4Quantized.GetMemorySaved();
+			case BVHLayout::Wide8Quantized:
+				return bvh8Quantized.GetMemorySaved();
+			default:
+				return 0;
+			}
 		}
 
 		void UpdateAABB()
@@ -183,44 +378,100 @@ namespace dae
 			}
 		}
 
+		//Call after UpdateBVH, the bounds come from the transformed boxes of the top BVH nodes
 		void UpdateTransformedAABB(const Matrix& finalTransform)
 		{
-			Vector3 tMinAABB{ finalTransform.TransformPoint(minAABB) };
+			CalculateTransformedAABB(finalTransform, transformedMinAABB, transformedMaxAABB);
+		}
+
+		void CalculateTransformedAABB(const Matrix& finalTransform, Vector3& outMinAABB, Vector3& outMaxAABB) const
+		{
+			if (useVertexBounds && !positions.empty())
+			{
+				const AABB bounds{ CalculateTransformedBounds(finalTransform, positions, bvh.GetThreadPool()) };
+				outMinAABB = bounds.minAABB;
+				outMaxAABB = bounds.maxAABB;
+				return;
+			}
+
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+			if (nodes.empty())
+			{
+				TransformAABB(finalTransform, minAABB, maxAABB, outMinAABB, outMaxAABB);
+				return;
+			}
+
+			//The corners of a few smaller boxes stick out less than those of the root box once the mesh rotates, at the same cost for any mesh size
+			AABB bounds{};
+			uint32_t nodeStack[s_TransformedBoundsDepth + 1]{};
+			uint32_t depthStack[s_TransformedBoundsDepth + 1]{};
+			uint32_t stackSize{ 1 };
+			while (stackSize > 0)
+			{
+				--stackSize;
+				const BVHNode& node{ nodes[nodeStack[stackSize]] };
+				const uint32_t depth{ depthStack[stackSize] };
+
+				if (node.IsLeaf() || depth == s_TransformedBoundsDepth)
+				{
+					AABB nodeBounds{};
+					TransformAABB(finalTransform, node.bounds.minAABB, node.bounds.maxAABB, nodeBounds.minAABB, nodeBounds.maxAABB);
+					bounds.Grow(nodeBounds);
+					continue;
+				}
+
+				nodeStack[stackSize] = node.leftFirst;
+				depthStack[stackSize++] = depth + 1;
+				nodeStack[stackSize] = node.leftFirst + 1;
+				depthStack[stackSize++] = depth + 1;
+			}
+
+			outMinAABB = bounds.minAABB;
+			outMaxAABB = bounds.maxAABB;
+		}
+
+		//Bounds of the 8 transformed corners of [localMinAABB, localMaxAABB]
+		static void TransformAABB(const Matrix& finalTransform, const Vector3& localMinAABB, const Vector3& localMaxAABB, Vector3& outMinAABB, Vector3& outMaxAABB)
+		{
+			Vector3 tMinAABB{ finalTransform.TransformPoint(localMinAABB) };
 			Vector3 tMaxAABB = tMinAABB;
 
-			Vector3 tAABB{ finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z) };
+			Vector3 tAABB{ finalTransform.TransformPoint(localMaxAABB.x, localMinAABB.y, localMinAABB.z) };
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
+			tAABB = finalTransform.TransformPoint(localMaxAABB.x, localMinAABB.y, localMaxAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
+			tAABB = finalTransform.TransformPoint(localMinAABB.x, localMinAABB.y, localMaxAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
+			tAABB = finalTransform.TransformPoint(localMinAABB.x, localMaxAABB.y, localMinAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
+			tAABB = finalTransform.TransformPoint(localMaxAABB.x, localMaxAABB.y, localMinAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(maxAABB);
+			tAABB = finalTransform.TransformPoint(localMaxAABB);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
+			tAABB = finalTransform.TransformPoint(localMinAABB.x, localMaxAABB.y, localMaxAABB.z);
 			tMinAABB = Vector3::Min(tAABB, tMinAABB);
 			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
 
-			transformedMinAABB = tMinAABB;
-			transformedMaxAABB = tMaxAABB;
+			outMinAABB = tMinAABB;
+			outMaxAABB = tMaxAABB;
 		}
 
 	private:
+		//Levels below the root whose boxes bound the transformed mesh, at most 2^depth boxes
+		static constexpr uint32_t s_TransformedBoundsDepth{ 3 };
+
 		Vector3 CalculateNormal(const Vector3& v0, const Vector3& v1, const Vector3& v2)
 		{
 			Vector3 edgeA{ v1 - v0 };
@@ -228,6 +479,48 @@ namespace dae
 			return Vector3::Cross(edgeA, edgeB).Normalized();
 		}
 	};
+
+	//Places a TriangleMesh somewhere else without copying it
+	//Positions, normals, indices, cull mode and BVH are shared with the mesh, only the transform and material are per instance
+	struct TriangleMeshInstance
+	{
+		//Index into the scene's triangle meshes, stays valid when the mesh vector reallocates
+		uint32_t meshIndex{};
+		unsigned char materialIndex{};
+
+		Matrix rotationTransform{};
+		Matrix translationTransform{};
+		Matrix scaleTransform{};
+
+		Matrix transform{};
+		Matrix inverseTransform{};
+
+		Vector3 transformedMinAABB{};
+		Vector3 transformedMaxAABB{};
+
+		void Translate(const Vector3& translation)
+		{
+			translationTransform = Matrix::CreateTranslation(translation);
+		}
+
+		void RotateY(float yaw)
+		{
+			rotationTransform = Matrix::CreateRotationY(yaw);
+		}
+
+		void Scale(const Vector3& scale)
+		{
+			scaleTransform = Matrix::CreateScale(scale);
+		}
+
+		void UpdateTransforms(const TriangleMesh& mesh)
+		{
+			transform = scaleTransform * rotationTransform * translationTransform;
+			inverseTransform = Matrix::Inverse(transform);
+
+			mesh.CalculateTransformedAABB(transform, transformedMinAABB, transformedMaxAABB);
+		}
+	};
 #pragma endregion
 #pragma region LIGHT
 	enum class LightType
@@ -256,6 +549,82 @@ namespace dae
 		float max{ FLT_MAX };
 	};
 
+	//Up to 16 rays from one origin that are traced together, like the primary rays of a small screen tile
+	//Stored per component so a single vector operation handles several rays, a lane only counts when its bit is in the active mask
+	struct alignas(32) RayPacket
+	{
+		static constexpr uint32_t s_MaxSize{ 16 };
+
+		//The arrays come first so each starts on a 32 byte boundary for the aligned vector loads
+		float directionX[s_MaxSize]{};
+		float directionY[s_MaxSize]{};
+		float directionZ[s_MaxSize]{};
+		float invDirectionX[s_MaxSize]{};
+		float invDirectionY[s_MaxSize]{};
+		float invDirectionZ[s_MaxSize]{};
+		float min[s_MaxSize]{};
+		float max[s_MaxSize]{};
+
+		Vector3 origin{};
+		uint32_t size{};
+
+		//Range of the inverse directions over the active rays, the frustum the interval test culls nodes with
+		Vector3 minInvDirection{};
+		Vector3 maxInvDirection{};
+
+		uint32_t GetFullMask() const { return (1u << size) - 1; }
+
+		void SetRay(uint32_t lane, const Vector3& direction, float tMin = 0.0001f, float tMax = FLT_MAX)
+		{
+			directionX[lane] = direction.x;
+			directionY[lane] = direction.y;
+			directionZ[lane] = direction.z;
+			invDirectionX[lane] = 1.f / direction.x;
+			invDirectionY[lane] = 1.f / direction.y;
+			invDirectionZ[lane] = 1.f / direction.z;
+			min[lane] = tMin;
+			max[lane] = tMax;
+		}
+
+		Vector3 GetDirection(uint32_t lane) const
+		{
+			return { directionX[lane], directionY[lane], directionZ[lane] };
+		}
+
+		Ray GetRay(uint32_t lane) const
+		{
+			return { origin, GetDirection(lane), min[lane], max[lane] };
+		}
+
+		//Returns false when the active rays do not agree on the sign of every direction component, or run parallel to an axis
+		//The interval test cannot bound such a packet, it has to be traced ray by ray
+		bool UpdateFrustum(uint32_t activeMask)
+		{
+			minInvDirection = { FLT_MAX, FLT_MAX, FLT_MAX };
+			maxInvDirection = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			for (uint32_t lane{}; lane < size; ++lane)
+			{
+				if ((activeMask & (1u << lane)) == 0)
+					continue;
+
+				const Vector3 invDirection{ invDirectionX[lane], invDirectionY[lane], invDirectionZ[lane] };
+				minInvDirection = Vector3::Min(minInvDirection, invDirection);
+				maxInvDirection = Vector3::Max(maxInvDirection, invDirection);
+			}
+
+			for (int axis{}; axis < 3; ++axis)
+			{
+				if (!std::isfinite(minInvDirection[axis]) || !std::isfinite(maxInvDirection[axis]))
+					return false;
+
+				if ((minInvDirection[axis] < 0.f) != (maxInvDirection[axis] < 0.f))
+					return false;
+			}
+			return true;
+		}
+	};
+
 	struct HitRecord
 	{
 		Vector3 origin{};
@@ -1,5 +1,8 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
+
+#include "SIMD.h"
 
 namespace dae
 {
@@ -18,6 +21,32 @@ namespace dae
 		return a * a;
 	}
 
+	//1 / sqrt(a) from the hardware estimate refined by one Newton-Raphson step, within 5e-7 relative error of 1 / sqrt(a)
+	inline float InvSqrtFast(float a)
+	{
+#if defined(DAE_SSE)
+		const float estimate{ _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(a))) };
+		return estimate * (1.5f - 0.5f * a * estimate * estimate);
+#else
+		return 1.f / sqrtf(a);
+#endif
+	}
+
+	//Mirrors the digits of index in the given base behind the decimal point, base 2 and 3 together give the Halton sequence
+	inline float RadicalInverse(uint32_t index, uint32_t base)
+	{
+		const float invBase{ 1.f / float(base) };
+		float factor{ invBase };
+		float result{};
+		while (index > 0)
+		{
+			result += float(index % base) * factor;
+			index /= base;
+			factor *= invBase;
+		}
+		return result;
+	}
+
 	inline float Lerpf(float a, float b, float factor)
 	{
 		return ((1 - factor) * a) + (factor * b);
@@ -1,4 +1,9 @@
 #pragma once
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+
+#include "SIMD.h"
 #include "Vector3.h"
 #include "Vector4.h"
 
@@ -6,46 +11,239 @@ namespace dae {
 	struct Matrix
 	{
 		Matrix() = default;
-		Matrix(
+		constexpr Matrix(
 			const Vector3& xAxis,
 			const Vector3& yAxis,
 			const Vector3& zAxis,
-			const Vector3& t);
+			const Vector3& t) :
+			Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
+		{
+		}
 
-		Matrix(
+		constexpr Matrix(
 			const Vector4& xAxis,
 			const Vector4& yAxis,
 			const Vector4& zAxis,
-			const Vector4& t);
+			const Vector4& t)
+		{
+			data[0] = xAxis;
+			data[1] = yAxis;
+			data[2] = zAxis;
+			data[3] = t;
+		}
+
+		constexpr Matrix(const Matrix& m) = default;
+
+		constexpr Vector3 TransformVector(const Vector3& v) const
+		{
+			return TransformVector(v[0], v[1], v[2]);
+		}
+
+		constexpr Vector3 TransformVector(float x, float y, float z) const
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				const __m128 result{ _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(data[0].Load(), _mm_set1_ps(x)),
+					_mm_mul_ps(data[1].Load(), _mm_set1_ps(y))),
+					_mm_mul_ps(data[2].Load(), _mm_set1_ps(z))) };
+				return ToVector3(result);
+			}
+#endif
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z,
+				data[0].y * x + data[1].y * y + data[2].y * z,
+				data[0].z * x + data[1].z * y + data[2].z * z
+			};
+		}
+
+		constexpr Vector3 TransformPoint(const Vector3& p) const
+		{
+			return TransformPoint(p[0], p[1], p[2]);
+		}
+
+		constexpr Vector3 TransformPoint(float x, float y, float z) const
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				const __m128 result{ _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(data[0].Load(), _mm_set1_ps(x)),
+					_mm_mul_ps(data[1].Load(), _mm_set1_ps(y))),
+					_mm_mul_ps(data[2].Load(), _mm_set1_ps(z))),
+					data[3].Load()) };
+				return ToVector3(result);
+			}
+#endif
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z + data[3].x,
+				data[0].y * x + data[1].y * y + data[2].y * z + data[3].y,
+				data[0].z * x + data[1].z * y + data[2].z * z + data[3].z,
+			};
+		}
+
+		constexpr const Matrix& Transpose()
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				__m128 row0{ data[0].Load() };
+				__m128 row1{ data[1].Load() };
+				__m128 row2{ data[2].Load() };
+				__m128 row3{ data[3].Load() };
+				_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+				data[0].Store(row0);
+				data[1].Store(row1);
+				data[2].Store(row2);
+				data[3].Store(row3);
+				return *this;
+			}
+#endif
+			Matrix result{};
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					result[r][c] = data[c][r];
+				}
+			}
 
-		Matrix(const Matrix& m);
+			data[0] = result[0];
+			data[1] = result[1];
+			data[2] = result[2];
+			data[3] = result[3];
 
-		Vector3 TransformVector(const Vector3& v) const;
-		Vector3 TransformVector(float x, float y, float z) const;
-		Vector3 TransformPoint(const Vector3& p) const;
-		Vector3 TransformPoint(float x, float y, float z) const;
-		const Matrix& Transpose();
+			return *this;
+		}
+
+		constexpr const Matrix& Inverse();
+
+		constexpr Vector3 GetAxisX() const
+		{
+			return data[0];
+		}
 
-		Vector3 GetAxisX() const;
-		Vector3 GetAxisY() const;
-		Vector3 GetAxisZ() const;
-		Vector3 GetTranslation() const;
+		constexpr Vector3 GetAxisY() const
+		{
+			return data[1];
+		}
+
+		constexpr Vector3 GetAxisZ() const
+		{
+			return data[2];
+		}
+
+		constexpr Vector3 GetTranslation() const
+		{
+			return data[3];
+		}
+
+		static constexpr Matrix CreateTranslation(float x, float y, float z)
+		{
+			Matrix matrix{};
+
+			matrix[3][0] = x;
+			matrix[3][1] = y;
+			matrix[3][2] = z;
+
+			return matrix;
+		}
+
+		static constexpr Matrix CreateTranslation(const Vector3& t)
+		{
+			return { Vector3::UnitX, Vector3::UnitY, Vector3::UnitZ, t };
+		}
 
-		static Matrix CreateTranslation(float x, float y, float z);
-		static Matrix CreateTranslation(const Vector3& t);
 		static Matrix CreateRotationX(float pitch);
 		static Matrix CreateRotationY(float yaw);
 		static Matrix CreateRotationZ(float roll);
 		static Matrix CreateRotation(float pitch, float yaw, float roll);
 		static Matrix CreateRotation(const Vector3& r);
-		static Matrix CreateScale(float sx, float sy, float sz);
-		static Matrix CreateScale(const Vector3& s);
-		static Matrix Transpose(const Matrix& m);
 
-		Vector4& operator[](int index);
-		Vector4 operator[](int index) const;
-		Matrix operator*(const Matrix& m) const;
-		const Matrix& operator*=(const Matrix& m);
+		static constexpr Matrix CreateScale(float sx, float sy, float sz)
+		{
+			Matrix matrix{};
+
+			matrix[0][0] = sx;
+			matrix[1][1] = sy;
+			matrix[2][2] = sz;
+
+			return matrix;
+		}
+
+		static constexpr Matrix CreateScale(const Vector3& s)
+		{
+			return CreateScale(s[0], s[1], s[2]);
+		}
+
+		static constexpr Matrix Transpose(const Matrix& m)
+		{
+			Matrix out{ m };
+			out.Transpose();
+
+			return out;
+		}
+
+		static constexpr Matrix Inverse(const Matrix& m)
+		{
+			Matrix out{ m };
+			out.Inverse();
+
+			return out;
+		}
+
+		constexpr Vector4& operator[](int index)
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		constexpr Vector4 operator[](int index) const
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		constexpr Matrix operator*(const Matrix& m) const
+		{
+			Matrix result{ *this };
+			result *= m;
+
+			return result;
+		}
+
+		constexpr const Matrix& operator*=(const Matrix& m)
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				//Row r of the result is the sum of the rows of m weighted by row r of this matrix, in the same order as Vector4::Dot
+				for (int r{ 0 }; r < 4; ++r)
+				{
+					const Vector4 row{ data[r] };
+					data[r].Store(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(_mm_set1_ps(row.x), m.data[0].Load()),
+						_mm_mul_ps(_mm_set1_ps(row.y), m.data[1].Load())),
+						_mm_mul_ps(_mm_set1_ps(row.z), m.data[2].Load())),
+						_mm_mul_ps(_mm_set1_ps(row.w), m.data[3].Load())));
+				}
+				return *this;
+			}
+#endif
+			Matrix copy{ *this };
+			Matrix m_transposed = Transpose(m);
+
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					data[r][c] = Vector4::Dot(copy[r], m_transposed[c]);
+				}
+			}
+
+			return *this;
+		}
 
 	private:
 
@@ -62,5 +260,122 @@ namespace dae {
 		// v1x v1y v1z v1w
 		// v2x v2y v2z v2w
 		// v3x v3y v3z v3w
+
+#if defined(DAE_SIMD_MATH)
+		static Vector3 ToVector3(__m128 v)
+		{
+			alignas(16) float values[4];
+			_mm_store_ps(values, v);
+			return { values[0], values[1], values[2] };
+		}
+#endif
 	};
-}
\ No newline at end of file
+
+	constexpr const Matrix& Matrix::Inverse()
+	{
+		//Cofactor expansion using the 2x2 sub-determinants of the upper and lower two rows
+		const Matrix m{ *this };
+
+		const float s0{ m[0][0] * m[1][1] - m[1][0] * m[0][1] };
+		const float s1{ m[0][0] * m[1][2] - m[1][0] * m[0][2] };
+		const float s2{ m[0][0] * m[1][3] - m[1][0] * m[0][3] };
+		const float s3{ m[0][1] * m[1][2] - m[1][1] * m[0][2] };
+		const float s4{ m[0][1] * m[1][3] - m[1][1] * m[0][3] };
+		const float s5{ m[0][2] * m[1][3] - m[1][2] * m[0][3] };
+
+		const float c5{ m[2][2] * m[3][3] - m[3][2] * m[2][3] };
+		const float c4{ m[2][1] * m[3][3] - m[3][1] * m[2][3] };
+		const float c3{ m[2][1] * m[3][2] - m[3][1] * m[2][2] };
+		const float c2{ m[2][0] * m[3][3] - m[3][0] * m[2][3] };
+		const float c1{ m[2][0] * m[3][2] - m[3][0] * m[2][2] };
+		const float c0{ m[2][0] * m[3][1] - m[3][0] * m[2][1] };
+
+		const float determinant{ s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0 };
+		assert(determinant != 0.f && "Matrix is not invertible");
+
+		const float invDeterminant{ 1.f / determinant };
+
+		data[0][0] = ( m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3) * invDeterminant;
+		data[0][1] = (-m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3) * invDeterminant;
+		data[0][2] = ( m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3) * invDeterminant;
+		data[0][3] = (-m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3) * invDeterminant;
+
+		data[1][0] = (-m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1) * invDeterminant;
+		data[1][1] = ( m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1) * invDeterminant;
+		data[1][2] = (-m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1) * invDeterminant;
+		data[1][3] = ( m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1) * invDeterminant;
+
+		data[2][0] = ( m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0) * invDeterminant;
+		data[2][1] = (-m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0) * invDeterminant;
+		data[2][2] = ( m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0) * invDeterminant;
+		data[2][3] = (-m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0) * invDeterminant;
+
+		data[3][0] = (-m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0) * invDeterminant;
+		data[3][1] = ( m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0) * invDeterminant;
+		data[3][2] = (-m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0) * invDeterminant;
+		data[3][3] = ( m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0) * invDeterminant;
+
+		return *this;
+	}
+
+	inline Matrix Matrix::CreateRotationX(float pitch)
+	{
+		//todo W1 - DONE
+		float cos{ cosf(pitch) };
+		float sin{ sinf(pitch) };
+
+		Matrix pitchMat
+		{
+			{1.f, 0.f,  0.f, 0.f},
+			{0.f, cos, -sin, 0.f},
+			{0.f, sin,  cos, 0.f},
+			{0.f, 0.f,  0.f, 1.f}
+		};
+
+		return pitchMat;
+	}
+
+	inline Matrix Matrix::CreateRotationY(float yaw)
+	{
+		//todo W1 - DONE
+		float cos{ cosf(yaw) };
+		float sin{ sinf(yaw) };
+
+		Matrix yawMat
+		{
+			{cos, 0.f, -sin, 0.f},
+			{0.f, 1.f,  0.f, 0.f},
+			{sin, 0.f,  cos, 0.f},
+			{0.f, 0.f,  0.f, 1.f}
+		};
+
+		return yawMat;
+	}
+
+	inline Matrix Matrix::CreateRotationZ(float roll)
+	{
+		//todo W1 - DONE
+		float cos{ cosf(roll) };
+		float sin{ sinf(roll) };
+
+		Matrix rollMat
+		{
+			{ cos, sin,  0.f, 0.f},
+			{-sin, cos,  0.f, 0.f},
+			{ 0.f, 0.f,  1.f, 0.f},
+			{ 0.f, 0.f,  0.f, 1.f}
+		};
+
+		return rollMat;
+	}
+
+	inline Matrix Matrix::CreateRotation(const Vector3& r)
+	{
+		return  CreateRotationX(r.x) * CreateRotationY(r.y) * CreateRotationZ(r.z);
+	}
+
+	inline Matrix Matrix::CreateRotation(float pitch, float yaw, float roll)
+	{
+		return CreateRotation({ pitch, yaw, roll });
+	}
+}
@@ -2,9 +2,18 @@
 #include "SDL.h"
 #include "SDL_surface.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
 #include <thread>
-#include <future> //async stuff
+
+//parallel_for is Windows only, elsewhere the ParallelFor scheduler is skipped
+#if defined(_MSC_VER)
 #include <ppl.h> //parallel stuff
+#define PARALLEL_FOR
+#endif
 
 //Project includes
 #include "Renderer.h"
@@ -12,95 +21,222 @@
 #include "Matrix.h"
 #include "Material.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 using namespace dae;
 
-//#define ASYNC
-#define PARALLEL_FOR
-
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
+	m_pThreadPool(new ThreadPool()),
 	m_pBuffer(SDL_GetWindowSurface(pWindow))
 {
+	static std::atomic<uint64_t> s_NextId{ 1 };
+	m_Id = s_NextId++;
+
 	//Initialize
-	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
+	SDL_GetWindowSize(pWindow, &m_WindowWidth, &m_WindowHeight);
+	m_Width = m_WindowWidth;
+	m_Height = m_WindowHeight;
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
 }
 
+Renderer::~Renderer()
+{
+	delete m_pThreadPool;
+	m_pThreadPool = nullptr;
+
+	for (OcclusionCache*& pCache : m_pOcclusionCaches)
+	{
+		delete pCache;
+		pCache = nullptr;
+	}
+}
+
 void Renderer::Render(Scene* pScene) const
 {
 	Camera& camera = pScene->GetCamera();
 	auto& materials = pScene->GetMaterials();
 	auto& lights = pScene->GetLights();
 
-	float aspectRatio{ float(m_Width) / float(m_Height) };
-	float angleRad{ PI / 180.f * camera.fovAngle };
-	float fov{ tanf(angleRad / 2.f) };
+	//A still being accumulated renders at window resolution, only frames in motion are scaled down
+	m_IsRenderingStill = m_ProgressiveEnabled && !pScene->HasChanged();
+	const int resolutionLevel{ int((m_IsRenderingStill || !m_DynamicResolutionEnabled) ? s_ResolutionLevelCount : m_ResolutionLevel) };
+	const int width{ std::max(m_WindowWidth * resolutionLevel / int(s_ResolutionLevelCount), 1) };
+	const int height{ std::max(m_WindowHeight * resolutionLevel / int(s_ResolutionLevelCount), 1) };
+	if (width != m_Width || height != m_Height)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_AccumulatedSampleCount = 0;
+	}
 
-	const uint32_t numPixels{ uint32_t(m_Width * m_Height) };
+	const bool isUpscaling{ m_Width != m_WindowWidth || m_Height != m_WindowHeight };
+	if (isUpscaling)
+		m_ScaledColors.resize(size_t(m_Width) * size_t(m_Height));
+
+	//Only frames in motion are checkerboarded, a still traces every pixel
+	m_IsCheckerboardFrame = m_CheckerboardEnabled && !m_IsRenderingStill;
+	if (m_IsCheckerboardFrame)
+	{
+		m_CheckerboardColors.resize(size_t(m_Width) * size_t(m_Height));
+		m_CheckerboardDepths.resize(size_t(m_Width) * size_t(m_Height));
+	}
+	else
+	{
+		m_HasPreviousFrame = false;
+	}
 
-#if defined(ASYNC)
-	//Async logic
-	const uint32_t numCores{ std::thread::hardware_concurrency()};
-	std::vector<std::future<void>> async_futures{};
+	//The window's aspect ratio, rounding the scaled resolution must not stretch the image
+	float aspectRatio{ float(m_WindowWidth) / float(m_WindowHeight) };
+	float angleRad{ PI / 180.f * camera.fovAngle };
+	float fov{ tanf(angleRad / 2.f) };
 
-	const uint32_t numPixelsPerTask{ numPixels / numCores };
-	uint32_t numUnassignedPixels{ numPixels % numCores };
-	uint32_t currentPixelIndex{ 0 };
+	//A moved camera, an animated scene or another scene throws the accumulated samples away
+	if (!m_ProgressiveEnabled || pScene->HasChanged() || pScene != m_pAccumulatedScene)
+		m_AccumulatedSampleCount = 0;
+	m_pAccumulatedScene = pScene;
 
-	//create tasks
-	for (uint32_t coreId{}; coreId < numCores; ++coreId)
+	m_SampleOffsetX = 0.5f;
+	m_SampleOffsetY = 0.5f;
+	if (m_ProgressiveEnabled)
 	{
-		uint32_t taskSize{ numPixelsPerTask };
-		if (numUnassignedPixels > 0)
+		//Converged, the framebuffer still holds the average of every sample
+		if (m_AccumulatedSampleCount >= s_MaxAccumulatedSamples)
 		{
-			++taskSize;
-			--numUnassignedPixels;
+			SDL_UpdateWindowSurface(m_pWindow);
+			return;
 		}
 
-		async_futures.push_back(
-			std::async(std::launch::async, [=, this] 
-				{
-					const uint32_t pixelIndexEnd{currentPixelIndex + taskSize};
-					for (uint32_t pixelIndex{ currentPixelIndex }; pixelIndex < pixelIndexEnd; pixelIndex++)
-					{
-						RenderPixel(pScene, pixelIndex, fov, aspectRatio, camera, lights, materials);
-					}
-				})
-		);
-
-		currentPixelIndex += taskSize;
+		//The first sample goes through the pixel centers like without accumulation, the next ones follow the Halton sequence shifted by half a pixel
+		m_AccumulationBuffer.resize(size_t(m_Width) * size_t(m_Height));
+		m_SampleOffsetX = std::fmod(0.5f + RadicalInverse(m_AccumulatedSampleCount, 2), 1.f);
+		m_SampleOffsetY = std::fmod(0.5f + RadicalInverse(m_AccumulatedSampleCount, 3), 1.f);
 	}
 
-	//Wait for all tasks
-	for (const std::future<void>& f : async_futures)
+	UpdateTileChunks();
+	const uint32_t numChunks{ static_cast<uint32_t>(m_TileChunks.size()) };
+
+	//Every thread that renders takes a slot with its first chunk, so no scheduler can use more slots than there are chunks
+	m_ThreadRenderTimes.assign(numChunks, 0.f);
+	m_RenderThreadCount.store(0, std::memory_order_relaxed);
+	++m_TileFrameIndex;
+
+	switch (m_TileScheduler)
 	{
-		f.wait();
+	case TileScheduler::WorkStealing:
+	{
+		//One task per chunk, workers that run out of chunks take them from the others
+		TaskGroup renderTasks{};
+		for (uint32_t chunkIndex : m_TileChunkOrder)
+		{
+			m_pThreadPool->Run(renderTasks, [=, this, &camera, &lights, &materials]
+				{
+					RenderTileChunk(pScene, chunkIndex, fov, aspectRatio, camera, lights, materials);
+				});
+		}
+
+		//The calling thread renders chunks as well until the frame is done
+		m_pThreadPool->Wait(renderTasks);
+		break;
 	}
 
-#elif defined(PARALLEL_FOR)
-	//parallel logic
-	concurrency::parallel_for(0u, numPixels, [=, this](int i)
+#if defined(PARALLEL_FOR)
+	case TileScheduler::ParallelFor:
+		concurrency::parallel_for(0u, numChunks, [=, this, &camera, &lights, &materials](uint32_t chunkIndex)
+			{
+				RenderTileChunk(pScene, chunkIndex, fov, aspectRatio, camera, lights, materials);
+			});
+		break;
+#endif
+
+	case TileScheduler::Serial:
+	default:
+		for (uint32_t chunkIndex{}; chunkIndex < numChunks; ++chunkIndex)
 		{
-			RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
-		});
+			RenderTileChunk(pScene, chunkIndex, fov, aspectRatio, camera, lights, materials);
+		}
+		break;
+	}
 
-#else
+	UpdateTileCosts();
 
-	for (uint32_t i{}; i < numPixels; i++)
-	{
-		RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
-	}
+	if (m_IsCheckerboardFrame)
+		ReconstructCheckerboard(camera, fov, aspectRatio);
 
-#endif
+	if (isUpscaling)
+		UpscaleToWindow();
 
+	if (m_ProgressiveEnabled)
+		++m_AccumulatedSampleCount;
 
 	//@END
 	//Update SDL Surface
 	SDL_UpdateWindowSurface(m_pWindow);
 }
 
+void Renderer::PrintOcclusionCacheStats() const
+{
+	uint64_t rayCount{};
+	uint64_t lookupCount{};
+	uint64_t hitCount{};
+
+	//Only called between frames, no worker is touching its cache
+	std::lock_guard lock{ m_OcclusionCacheMutex };
+	for (OcclusionCache* pCache : m_pOcclusionCaches)
+	{
+		rayCount += pCache->rayCount;
+		lookupCount += pCache->lookupCount;
+		hitCount += pCache->hitCount;
+		pCache->rayCount = 0;
+		pCache->lookupCount = 0;
+		pCache->hitCount = 0;
+	}
+
+	if (rayCount == 0 || lookupCount == 0)
+		return;
+
+	std::cout << "Shadow occluder cache: " << 100.0 * hitCount / lookupCount << "% hit rate, "
+		<< 100.0 * hitCount / rayCount << "% of " << rayCount << " shadow rays skipped traversal" << std::endl;
+}
+
+void Renderer::PrintTileBalanceStats() const
+{
+	if (m_TileImbalanceFrameCount == 0)
+		return;
+
+	const char* pSchedulerName{ "serial" };
+	if (m_TileScheduler == TileScheduler::WorkStealing)
+		pSchedulerName = "work stealing";
+	else if (m_TileScheduler == TileScheduler::ParallelFor)
+		pSchedulerName = "parallel_for";
+
+	std::cout << "Tile imbalance (" << pSchedulerName << "): slowest thread took " << m_TileImbalanceSum / m_TileImbalanceFrameCount << "x the average over "
+		<< m_TileImbalanceFrameCount << " frames, " << m_TileChunks.size() << " chunks per frame"
+		<< (m_CostPredictiveTilesEnabled ? " balanced by last frame's tile costs" : " of one screen tile") << std::endl;
+
+	m_TileImbalanceSum = 0.f;
+	m_TileImbalanceFrameCount = 0;
+}
+
+OcclusionCache& Renderer::GetOcclusionCache() const
+{
+	//Every renderer hands out its own caches, a thread that rendered for an earlier one gets a fresh cache
+	thread_local OcclusionCache* pCache{};
+	thread_local uint64_t cacheOwnerId{};
+
+	if (cacheOwnerId != m_Id)
+	{
+		pCache = new OcclusionCache{};
+		cacheOwnerId = m_Id;
+
+		std::lock_guard lock{ m_OcclusionCacheMutex };
+		m_pOcclusionCaches.push_back(pCache);
+	}
+
+	return *pCache;
+}
+
 bool Renderer::SaveBufferToImage() const
 {
 	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
@@ -108,8 +244,8 @@ bool Renderer::SaveBufferToImage() const
 
 Vector3 Renderer::RasterSpaceToCameraSpace(float x, float y, int width, int height, float aspectRatio, float fov) const
 {
-	x += 0.5f;
-	y += 0.5f;
+	x += m_SampleOffsetX;
+	y += m_SampleOffsetY;
 
 	Vector3 result{};
 	result.x = ((2.f * x / float(width)) - 1.f) * (aspectRatio * fov);
@@ -119,75 +255,895 @@ Vector3 Renderer::RasterSpaceToCameraSpace(float x, float y, int width, int heig
 	return result.Normalized();
 }
 
+uint32_t Renderer::GetTileSize() const
+{
+	return m_WavefrontEnabled ? s_WavefrontTileSize : s_TileSize;
+}
+
+uint32_t Renderer::GetRoundedScreenTileSize() const
+{
+	const uint32_t tileSize{ GetTileSize() };
+	return (m_ScreenTileSize + tileSize - 1) / tileSize * tileSize;
+}
+
+uint32_t Renderer::GetScreenTileCount() const
+{
+	const uint32_t screenTileSize{ GetRoundedScreenTileSize() };
+	const uint32_t numScreenTilesX{ (uint32_t(m_Width) + screenTileSize - 1) / screenTileSize };
+	const uint32_t numScreenTilesY{ (uint32_t(m_Height) + screenTileSize - 1) / screenTileSize };
+	return numScreenTilesX * numScreenTilesY;
+}
+
+void Renderer::UpdateTileChunks() const
+{
+	const uint32_t numScreenTiles{ GetScreenTileCount() };
+	const uint32_t screenTileSize{ GetRoundedScreenTileSize() };
+	const uint32_t rowsPerScreenTile{ screenTileSize / GetTileSize() };
+
+	//Costs of another layout say nothing about these tiles, until a frame is measured every tile costs the same
+	if (m_TileCosts.size() != numScreenTiles || m_TileCostsScreenTileSize != screenTileSize)
+	{
+		m_TileCosts.assign(numScreenTiles, 1.f);
+		m_TileCostsScreenTileSize = screenTileSize;
+	}
+
+	m_TileChunks.clear();
+	if (!m_CostPredictiveTilesEnabled)
+	{
+		for (uint32_t screenTileIndex{}; screenTileIndex < numScreenTiles; ++screenTileIndex)
+		{
+			m_TileChunks.push_back({ screenTileIndex, 1, 0, rowsPerScreenTile, m_TileCosts[screenTileIndex] });
+		}
+	}
+	else
+	{
+		float totalCost{};
+		for (float cost : m_TileCosts)
+		{
+			totalCost += cost;
+		}
+
+		const uint32_t threadCount{ m_pThreadPool->GetThreadCount() + 1 };
+		const float targetCost{ totalCost / float(threadCount * s_TileChunksPerThread) };
+
+		TileChunk chunk{};
+		for (uint32_t screenTileIndex{}; screenTileIndex < numScreenTiles; ++screenTileIndex)
+		{
+			const float cost{ m_TileCosts[screenTileIndex] };
+
+			//A tile that costs more than a chunk should is split in bands of rows, assuming its cost is spread evenly over them
+			if (cost > targetCost && rowsPerScreenTile > 1)
+			{
+				if (chunk.screenTileCount > 0)
+				{
+					m_TileChunks.push_back(chunk);
+					chunk = {};
+				}
+
+				const uint32_t partCount{ std::min(rowsPerScreenTile, uint32_t(std::ceil(cost / targetCost))) };
+				for (uint32_t part{}; part < partCount; ++part)
+				{
+					const uint32_t firstRow{ part * rowsPerScreenTile / partCount };
+					const uint32_t endRow{ (part + 1) * rowsPerScreenTile / partCount };
+					m_TileChunks.push_back({ screenTileIndex, 1, firstRow, endRow - firstRow, cost * float(endRow - firstRow) / float(rowsPerScreenTile) });
+				}
+				continue;
+			}
+
+			//Cheap tiles are merged with the ones after them until the chunk is worth a task
+			if (chunk.screenTileCount == 0)
+			{
+				chunk.firstScreenTile = screenTileIndex;
+				chunk.rowCount = rowsPerScreenTile;
+			}
+			++chunk.screenTileCount;
+			chunk.predictedCost += cost;
+
+			if (chunk.predictedCost >= targetCost)
+			{
+				m_TileChunks.push_back(chunk);
+				chunk = {};
+			}
+		}
+
+		if (chunk.screenTileCount > 0)
+			m_TileChunks.push_back(chunk);
+	}
+
+	m_TileChunkOrder.resize(m_TileChunks.size());
+	for (uint32_t chunkIndex{}; chunkIndex < m_TileChunkOrder.size(); ++chunkIndex)
+	{
+		m_TileChunkOrder[chunkIndex] = chunkIndex;
+	}
+	std::stable_sort(m_TileChunkOrder.begin(), m_TileChunkOrder.end(), [this](uint32_t a, uint32_t b)
+		{
+			return m_TileChunks[a].predictedCost < m_TileChunks[b].predictedCost;
+		});
+}
+
+void Renderer::UpdateTileCosts() const
+{
+	//A chunk of whole tiles stored the cost of every tile itself, the parts of a split tile add up to its cost
+	for (const TileChunk& chunk : m_TileChunks)
+	{
+		if (chunk.screenTileCount == 1 && chunk.firstRow == 0)
+			m_TileCosts[chunk.firstScreenTile] = 0.f;
+	}
+	for (const TileChunk& chunk : m_TileChunks)
+	{
+		if (chunk.screenTileCount == 1)
+			m_TileCosts[chunk.firstScreenTile] += chunk.measuredCost;
+	}
+
+	//Threads the scheduler could have kept busy, one that rendered nothing still lowers the average
+	uint32_t threadCount{ m_RenderThreadCount.load(std::memory_order_relaxed) };
+	switch (m_TileScheduler)
+	{
+	case TileScheduler::WorkStealing:
+		threadCount = std::max(threadCount, m_pThreadPool->GetThreadCount() + 1);
+		break;
+	case TileScheduler::ParallelFor:
+		threadCount = std::max(threadCount, std::thread::hardware_concurrency());
+		break;
+	case TileScheduler::Serial:
+	default:
+		break;
+	}
+
+	float totalTime{};
+	float slowestTime{};
+	for (float time : m_ThreadRenderTimes)
+	{
+		totalTime += time;
+		slowestTime = std::max(slowestTime, time);
+	}
+
+	if (totalTime <= 0.f)
+		return;
+
+	m_TileImbalance = slowestTime * float(threadCount) / totalTime;
+	m_TileImbalanceSum += m_TileImbalance;
+	++m_TileImbalanceFrameCount;
+}
+
+void Renderer::RenderTileChunk(Scene* pScene, uint32_t chunkIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
+{
+	using Clock = std::chrono::steady_clock;
+
+	TileChunk& chunk{ m_TileChunks[chunkIndex] };
+	const Clock::time_point chunkStart{ Clock::now() };
+
+	Clock::time_point tileStart{ chunkStart };
+	for (uint32_t screenTileIndex{ chunk.firstScreenTile }; screenTileIndex < chunk.firstScreenTile + chunk.screenTileCount; ++screenTileIndex)
+	{
+		RenderScreenTile(pScene, screenTileIndex, chunk.firstRow, chunk.rowCount, fov, aspectRatio, camera, lights, pMaterials);
+
+		//Only this chunk renders these tiles, a split tile's parts are added up after the frame
+		const Clock::time_point tileEnd{ Clock::now() };
+		if (chunk.screenTileCount > 1)
+			m_TileCosts[screenTileIndex] = std::chrono::duration<float, std::milli>(tileEnd - tileStart).count();
+		tileStart = tileEnd;
+	}
+
+	chunk.measuredCost = std::chrono::duration<float, std::milli>(tileStart - chunkStart).count();
+
+	//Every thread only adds to its own slot, the scheduler finishing the frame orders the adds before they are read
+	m_ThreadRenderTimes[GetRenderThreadSlot()] += chunk.measuredCost;
+}
+
+uint32_t Renderer::GetRenderThreadSlot() const
+{
+	//A thread takes the next slot the first time it renders a chunk of a frame, for any scheduler
+	thread_local uint64_t slotOwnerId{};
+	thread_local uint32_t slotFrameIndex{};
+	thread_local uint32_t slot{};
+
+	if (slotOwnerId != m_Id || slotFrameIndex != m_TileFrameIndex)
+	{
+		slot = m_RenderThreadCount.fetch_add(1, std::memory_order_relaxed);
+		slotOwnerId = m_Id;
+		slotFrameIndex = m_TileFrameIndex;
+	}
+
+	return slot;
+}
+
+void Renderer::RenderScreenTile(Scene* pScene, uint32_t screenTileIndex, uint32_t firstRow, uint32_t rowCount, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
+{
+	const uint32_t screenTileSize{ GetRoundedScreenTileSize() };
+	const uint32_t numScreenTilesX{ (uint32_t(m_Width) + screenTileSize - 1) / screenTileSize };
+	const uint32_t screenTileX{ (screenTileIndex % numScreenTilesX) * screenTileSize };
+	const uint32_t screenTileY{ (screenTileIndex / numScreenTilesX) * screenTileSize };
+
+	const uint32_t tileSize{ GetTileSize() };
+	const uint32_t screenTileEndX{ std::min(screenTileX + screenTileSize, uint32_t(m_Width)) };
+	const uint32_t screenTileEndY{ std::min(screenTileY + (firstRow + rowCount) * tileSize, uint32_t(m_Height)) };
+
+	for (uint32_t tileY{ screenTileY + firstRow * tileSize }; tileY < screenTileEndY; tileY += tileSize)
+	{
+		for (uint32_t tileX{ screenTileX }; tileX < screenTileEndX; tileX += tileSize)
+		{
+			RenderTile(pScene, tileX, tileY, fov, aspectRatio, camera, lights, pMaterials);
+		}
+	}
+}
+
+void Renderer::RenderTile(Scene* pScene, uint32_t tileX, uint32_t tileY, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
+{
+	const uint32_t tileSize{ GetTileSize() };
+
+	//Tiles on the right and bottom edge can be cut off by the screen
+	const uint32_t tileEndX{ std::min(tileX + tileSize, uint32_t(m_Width)) };
+	const uint32_t tileEndY{ std::min(tileY + tileSize, uint32_t(m_Height)) };
+
+	if (m_WavefrontEnabled)
+	{
+		RenderTileWavefront(pScene, tileX, tileY, tileEndX, tileEndY, fov, aspectRatio, camera, lights, pMaterials);
+		return;
+	}
+
+	if (!m_PacketTracingEnabled)
+	{
+		for (uint32_t py{ tileY }; py < tileEndY; ++py)
+		{
+			for (uint32_t px{ tileX }; px < tileEndX; ++px)
+			{
+				if (!IsPixelTraced(px, py))
+					continue;
+
+				RenderPixel(pScene, px + (py * m_Width), fov, aspectRatio, camera, lights, pMaterials);
+			}
+		}
+		return;
+	}
+
+	uint32_t pixelIndices[RayPacket::s_MaxSize]{};
+	Vector3 rayDirections[RayPacket::s_MaxSize]{};
+	HitRecord hitStats[RayPacket::s_MaxSize]{};
+	const uint32_t rayCount{ TracePrimaryPacket(pScene, tileX, tileY, tileEndX, tileEndY, fov, aspectRatio, camera, pixelIndices, rayDirections, hitStats) };
+
+	for (uint32_t i{}; i < rayCount; ++i)
+	{
+		ShadePixel(pScene, pixelIndices[i], hitStats[i], rayDirections[i], lights, pMaterials);
+	}
+}
+
+namespace
+{
+	//Scratch memory of the wavefront stages, one set per thread that grows to the largest tile it rendered
+	struct WavefrontBuffers
+	{
+		std::vector<uint32_t> pixelIndices{};
+		std::vector<Vector3> rayDirections{};
+		std::vector<HitRecord> hits{};
+		//Indices of the rays that hit something, grouped by material
+		std::vector<uint32_t> sortedHits{};
+		//Per ray and light whether nothing blocks the light, and the shadow ray that found out
+		std::vector<uint8_t> isLit{};
+		std::vector<Vector3> directionsToLight{};
+		std::vector<float> distancesToLight{};
+		std::vector<ColorRGB> colors{};
+	};
+}
+
+void Renderer::RenderTileWavefront(Scene* pScene, uint32_t tileX, uint32_t tileY, uint32_t tileEndX, uint32_t tileEndY, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
+{
+	thread_local WavefrontBuffers buffers{};
+
+	const uint32_t maxRayCount{ (tileEndX - tileX) * (tileEndY - tileY) };
+	const uint32_t lightCount{ static_cast<uint32_t>(lights.size()) };
+	if (buffers.hits.size() < maxRayCount)
+	{
+		buffers.pixelIndices.resize(maxRayCount);
+		buffers.rayDirections.resize(maxRayCount);
+		buffers.hits.resize(maxRayCount);
+		buffers.sortedHits.resize(maxRayCount);
+		buffers.colors.resize(maxRayCount);
+	}
+	if (buffers.isLit.size() < maxRayCount * lightCount)
+	{
+		buffers.isLit.resize(maxRayCount * lightCount);
+		buffers.directionsToLight.resize(maxRayCount * lightCount);
+		buffers.distancesToLight.resize(maxRayCount * lightCount);
+	}
+
+	//Primary rays of the whole tile, as packets when packet tracing is on
+	uint32_t rayCount{};
+	for (uint32_t y{ tileY }; y < tileEndY; y += s_TileSize)
+	{
+		for (uint32_t x{ tileX }; x < tileEndX; x += s_TileSize)
+		{
+			const uint32_t endX{ std::min(x + s_TileSize, tileEndX) };
+			const uint32_t endY{ std::min(y + s_TileSize, tileEndY) };
+
+			if (m_PacketTracingEnabled)
+			{
+				rayCount += TracePrimaryPacket(pScene, x, y, endX, endY, fov, aspectRatio, camera,
+					&buffers.pixelIndices[rayCount], &buffers.rayDirections[rayCount], &buffers.hits[rayCount]);
+				continue;
+			}
+
+			for (uint32_t py{ y }; py < endY; ++py)
+			{
+				for (uint32_t px{ x }; px < endX; ++px)
+				{
+					if (!IsPixelTraced(px, py))
+						continue;
+
+					const Vector3 rayDirection{ GetPrimaryRayDirection(px, py, fov, aspectRatio, camera) };
+
+					buffers.pixelIndices[rayCount] = px + (py * m_Width);
+					buffers.rayDirections[rayCount] = rayDirection;
+					buffers.hits[rayCount] = HitRecord{};
+					pScene->GetClosestHit(Ray{ camera.origin, rayDirection }, buffers.hits[rayCount]);
+					++rayCount;
+				}
+			}
+		}
+	}
+
+	//Counting sort of the hits by material, stable so every batch stays in screen order, misses are done right away
+	uint32_t materialOffsets[UINT8_MAX + 2]{};
+	for (uint32_t i{}; i < rayCount; ++i)
+	{
+		const HitRecord& hit{ buffers.hits[i] };
+		if (hit.didHit)
+			++materialOffsets[hit.materialIndex + 1];
+		else
+			WritePixel(buffers.pixelIndices[i], ColorRGB{}, FLT_MAX);
+	}
+
+	for (uint32_t materialIndex{ 1 }; materialIndex <= UINT8_MAX + 1; ++materialIndex)
+	{
+		materialOffsets[materialIndex] += materialOffsets[materialIndex - 1];
+	}
+
+	const uint32_t hitCount{ materialOffsets[UINT8_MAX + 1] };
+	for (uint32_t i{}; i < rayCount; ++i)
+	{
+		const HitRecord& hit{ buffers.hits[i] };
+		if (hit.didHit)
+			buffers.sortedHits[materialOffsets[hit.materialIndex]++] = i;
+	}
+
+	//Shadow rays, light by light in screen order, which keeps the occluder cache of every light warm
+	OcclusionCache& occlusionCache{ GetOcclusionCache() };
+	for (uint32_t lightIndex{}; lightIndex < lightCount; ++lightIndex)
+	{
+		for (uint32_t rayIndex{}; rayIndex < rayCount; ++rayIndex)
+		{
+			const HitRecord& hit{ buffers.hits[rayIndex] };
+			if (!hit.didHit)
+				continue;
+
+			const uint32_t sampleIndex{ rayIndex * lightCount + lightIndex };
+			const Ray toLightRay{ GetRayToLight(hit.origin, lights[lightIndex]) };
+			buffers.isLit[sampleIndex] = !m_ShadowEnabled || !pScene->DoesHit(toLightRay, occlusionCache, lightIndex);
+			buffers.directionsToLight[sampleIndex] = toLightRay.direction;
+			buffers.distancesToLight[sampleIndex] = toLightRay.max;
+		}
+	}
+
+	//Shading, one material at a time so the same Shade implementation runs over the whole batch, blocked lights are skipped
+	for (uint32_t sortedIndex{}; sortedIndex < hitCount; ++sortedIndex)
+	{
+		const uint32_t rayIndex{ buffers.sortedHits[sortedIndex] };
+		const HitRecord& hit{ buffers.hits[rayIndex] };
+		Material* pMaterial{ pMaterials[hit.materialIndex] };
+
+		ColorRGB& finalColor{ buffers.colors[rayIndex] };
+		finalColor = { 0.f, 0.f, 0.f };
+
+		for (uint32_t lightIndex{}; lightIndex < lightCount; ++lightIndex)
+		{
+			const uint32_t sampleIndex{ rayIndex * lightCount + lightIndex };
+			if (!buffers.isLit[sampleIndex])
+				continue;
+
+			finalColor += GetLightContribution(lights[lightIndex], hit, buffers.directionsToLight[sampleIndex], buffers.distancesToLight[sampleIndex], buffers.rayDirections[rayIndex], pMaterial);
+		}
+	}
+
+	for (uint32_t rayIndex{}; rayIndex < rayCount; ++rayIndex)
+	{
+		if (buffers.hits[rayIndex].didHit)
+			WritePixel(buffers.pixelIndices[rayIndex], buffers.colors[rayIndex], buffers.hits[rayIndex].t);
+	}
+}
+
+uint32_t Renderer::TracePrimaryPacket(Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float fov, float aspectRatio, const Camera& camera,
+	uint32_t* pPixelIndices, Vector3* pRayDirections, HitRecord* pHitStats) const
+{
+	assert((endX - startX) * (endY - startY) <= RayPacket::s_MaxSize && "A tile has to fit in one packet");
+	static_assert(s_TileSize * s_TileSize <= RayPacket::s_MaxSize, "A tile has to fit in one packet");
+
+	RayPacket packet{};
+	packet.origin = camera.origin;
+
+	for (uint32_t py{ startY }; py < endY; ++py)
+	{
+		for (uint32_t px{ startX }; px < endX; ++px)
+		{
+			if (!IsPixelTraced(px, py))
+				continue;
+
+			pPixelIndices[packet.size] = px + (py * m_Width);
+			pRayDirections[packet.size] = GetPrimaryRayDirection(px, py, fov, aspectRatio, camera);
+			packet.SetRay(packet.size, pRayDirections[packet.size]);
+			++packet.size;
+		}
+	}
+
+	for (uint32_t lane{}; lane < packet.size; ++lane)
+	{
+		pHitStats[lane] = HitRecord{};
+	}
+	pScene->GetClosestHits(packet, pHitStats);
+
+	return packet.size;
+}
+
 void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
 {
 	const uint32_t px{ pixelIndex % m_Width };
 	const uint32_t py{ pixelIndex / m_Width };
 
-	Vector3 rayDirection{ RasterSpaceToCameraSpace(float(px), float(py), m_Width, m_Height, aspectRatio, fov) };
-	rayDirection = camera.cameraToWorld.TransformVector(rayDirection);
+	const Vector3 rayDirection{ GetPrimaryRayDirection(px, py, fov, aspectRatio, camera) };
 
 	Ray hitRay{ camera.origin, rayDirection };
-
-	ColorRGB finalColor{};
 	HitRecord hitStats{};
 
 	pScene->GetClosestHit(hitRay, hitStats);
 
+	ShadePixel(pScene, pixelIndex, hitStats, rayDirection, lights, pMaterials);
+}
+
+void Renderer::ShadePixel(Scene* pScene, uint32_t pixelIndex, const HitRecord& hitStats, const Vector3& rayDirection, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const
+{
+	ColorRGB finalColor{};
+
 	if (hitStats.didHit)
 	{
 		finalColor = { 0.f, 0.f, 0.f };
 
-		for (const Light& light : lights)
+		OcclusionCache& occlusionCache{ GetOcclusionCache() };
+
+		for (uint32_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
 		{
-			Vector3 directionToLight{ light.origin - hitStats.origin };
-			Ray toLightRay{};
-			toLightRay.max = directionToLight.Normalize();
-			toLightRay.min = 0.001f;
+			const Light& light{ lights[lightIndex] };
+			const Ray toLightRay{ GetRayToLight(hitStats.origin, light) };
 
-			toLightRay.direction = directionToLight;
-			toLightRay.origin = hitStats.origin;
+			bool canSeeLight{ (m_ShadowEnabled) ? !pScene->DoesHit(toLightRay, occlusionCache, lightIndex) : true };
 
-			bool canSeeLight{ (m_ShadowEnabled) ? !pScene->DoesHit(toLightRay) : true };
+			if (canSeeLight)
+				finalColor += GetLightContribution(light, hitStats, toLightRay.direction, toLightRay.max, rayDirection, pMaterials[hitStats.materialIndex]);
+		}
+	}
 
-			ColorRGB brdfRgb{ pMaterials[hitStats.materialIndex]->Shade(hitStats, directionToLight, -rayDirection) };
+	WritePixel(pixelIndex, finalColor, hitStats.didHit ? hitStats.t : FLT_MAX);
+}
 
-			if (canSeeLight)
+Vector3 Renderer::GetPrimaryRayDirection(uint32_t px, uint32_t py, float fov, float aspectRatio, const Camera& camera) const
+{
+	const Vector3 rayDirection{ RasterSpaceToCameraSpace(float(px), float(py), m_Width, m_Height, aspectRatio, fov) };
+	return camera.cameraToWorld.TransformVector(rayDirection);
+}
+
+Ray Renderer::GetRayToLight(const Vector3& origin, const Light& light) const
+{
+	Vector3 directionToLight{ light.origin - origin };
+	Ray toLightRay{};
+	toLightRay.max = directionToLight.Normalize();
+	toLightRay.min = 0.001f;
+
+	toLightRay.direction = directionToLight;
+	toLightRay.origin = origin;
+	return toLightRay;
+}
+
+ColorRGB Renderer::GetLightContribution(const Light& light, const HitRecord& hitStats, const Vector3& directionToLight, float distanceToLight, const Vector3& rayDirection, Material* pMaterial) const
+{
+	float cosTheta{ Vector3::Dot(hitStats.normal, directionToLight) };
+	if (cosTheta < 0.f)
+	{
+		cosTheta = 0.f;
+	}
+
+	switch (m_LightingMode)
+	{
+	case LightingMode::ObservedArea:
+		return ColorRGB{ 1.f, 1.f, 1.f } *cosTheta;
+
+	case LightingMode::Radiance:
+		return LightUtils::GetRadiance(light, distanceToLight);
+
+	case LightingMode::BRDF:
+		return Shade(pMaterial, hitStats, directionToLight, rayDirection);
+
+	case LightingMode::Combined:
+	default:
+		ColorRGB brdfRgb{ Shade(pMaterial, hitStats, directionToLight, rayDirection) };
+		ColorRGB radiance{ LightUtils::GetRadiance(light, distanceToLight) };
+		return radiance * brdfRgb * cosTheta;
+	}
+}
+
+void Renderer::SetTileScheduler(TileScheduler scheduler)
+{
+#if !defined(PARALLEL_FOR)
+	if (scheduler == TileScheduler::ParallelFor)
+		scheduler = TileScheduler::WorkStealing;
+#endif
+	m_TileScheduler = scheduler;
+
+	//The next print only averages frames of the new scheduler
+	m_TileImbalanceSum = 0.f;
+	m_TileImbalanceFrameCount = 0;
+}
+
+void Renderer::CycleTileScheduler()
+{
+	TileScheduler next{ (m_TileScheduler == TileScheduler::ParallelFor) ? TileScheduler::Serial : TileScheduler(int(m_TileScheduler) + 1) };
+#if !defined(PARALLEL_FOR)
+	if (next == TileScheduler::ParallelFor)
+		next = TileScheduler::Serial;
+#endif
+	SetTileScheduler(next);
+}
+
+ColorRGB Renderer::Shade(Material* pMaterial, const HitRecord& hitStats, const Vector3& directionToLight, const Vector3& rayDirection) const
+{
+	if (m_FastBRDFEnabled)
+		return pMaterial->ShadeFast(hitStats, directionToLight, -rayDirection);
+
+	return pMaterial->Shade(hitStats, directionToLight, -rayDirection);
+}
+
+bool Renderer::IsPixelTraced(uint32_t px, uint32_t py) const
+{
+	return !m_IsCheckerboardFrame || ((px + py + m_CheckerboardParity) & 1) == 0;
+}
+
+void Renderer::WritePixel(uint32_t pixelIndex, ColorRGB finalColor, float hitDistance) const
+{
+	//Update Color in Buffer
+	finalColor.MaxToOne();
+
+	//A checkerboard frame keeps its traced pixels until the others are rebuilt from them
+	if (m_IsCheckerboardFrame)
+	{
+		m_CheckerboardColors[pixelIndex] = finalColor;
+		m_CheckerboardDepths[pixelIndex] = hitDistance;
+		return;
+	}
+
+	OutputPixel(pixelIndex, finalColor);
+}
+
+void Renderer::OutputPixel(uint32_t pixelIndex, ColorRGB color) const
+{
+	//Every pixel is written by one thread, the sum of its samples needs no lock
+	if (m_ProgressiveEnabled)
+	{
+		ColorRGB& sampleSum{ m_AccumulationBuffer[pixelIndex] };
+		if (m_AccumulatedSampleCount == 0)
+			sampleSum = color;
+		else
+			sampleSum += color;
+
+		color = sampleSum;
+		color /= float(m_AccumulatedSampleCount + 1);
+	}
+
+	//A scaled down frame is upscaled to the window once every pixel is done
+	if (m_Width != m_WindowWidth || m_Height != m_WindowHeight)
+	{
+		m_ScaledColors[pixelIndex] = color;
+		return;
+	}
+
+	PresentPixel(pixelIndex, color);
+}
+
+void Renderer::ReconstructCheckerboard(const Camera& camera, float fov, float aspectRatio) const
+{
+	const bool hasPreviousFrame{ m_HasPreviousFrame && m_PreviousWidth == m_Width && m_PreviousHeight == m_Height };
+
+	//Rebuilt pixels only read traced ones, which nothing writes anymore
+	ForEachChunk(m_pThreadPool, uint32_t(m_Height), s_ScreenPassRowsPerTask, [&](uint32_t beginY, uint32_t endY, uint32_t)
+		{
+			for (uint32_t py{ beginY }; py < endY; ++py)
 			{
-				float cosTheta{ Vector3::Dot(hitStats.normal, directionToLight) };
-				if (cosTheta < 0.f)
+				for (uint32_t px{}; px < uint32_t(m_Width); ++px)
 				{
-					cosTheta = 0.f;
+					if (!IsPixelTraced(px, py))
+						ReconstructPixel(px, py, camera, fov, aspectRatio, hasPreviousFrame);
+
+					const uint32_t pixelIndex{ px + py * uint32_t(m_Width) };
+					OutputPixel(pixelIndex, m_CheckerboardColors[pixelIndex]);
 				}
+			}
+		});
+
+	//This frame is the history of the next one, which traces the other color
+	std::swap(m_CheckerboardColors, m_PreviousColors);
+	std::swap(m_CheckerboardDepths, m_PreviousDepths);
+	m_HasPreviousFrame = true;
+	m_PreviousWidth = m_Width;
+	m_PreviousHeight = m_Height;
+	m_PreviousFov = fov;
+	m_PreviousCameraOrigin = camera.origin;
+	m_PreviousWorldToCamera = Matrix::Inverse(camera.cameraToWorld);
+	m_CheckerboardParity ^= 1;
+}
+
+void Renderer::ReconstructPixel(uint32_t px, uint32_t py, const Camera& camera, float fov, float aspectRatio, bool hasPreviousFrame) const
+{
+	const uint32_t width{ uint32_t(m_Width) };
+	const uint32_t pixelIndex{ px + py * width };
+
+	//Left, right, up and down, all traced, UINT32_MAX past the screen border
+	const uint32_t neighbours[4]
+	{
+		(px > 0) ? pixelIndex - 1 : UINT32_MAX,
+		(px + 1 < width) ? pixelIndex + 1 : UINT32_MAX,
+		(py > 0) ? pixelIndex - width : UINT32_MAX,
+		(py + 1 < uint32_t(m_Height)) ? pixelIndex + width : UINT32_MAX
+	};
+
+	if (hasPreviousFrame)
+	{
+		float minDepth{ FLT_MAX };
+		float maxDepth{ 0.f };
+		for (uint32_t neighbour : neighbours)
+		{
+			if (neighbour == UINT32_MAX || m_CheckerboardDepths[neighbour] == FLT_MAX)
+				continue;
+
+			minDepth = std::min(minDepth, m_CheckerboardDepths[neighbour]);
+			maxDepth = std::max(maxDepth, m_CheckerboardDepths[neighbour]);
+		}
 
-				switch (m_LightingMode)
+		const Vector3 rayDirection{ GetPrimaryRayDirection(px, py, fov, aspectRatio, camera) };
+		for (uint32_t neighbour : neighbours)
+		{
+			if (neighbour == UINT32_MAX)
+				continue;
+
+			const float depth{ m_CheckerboardDepths[neighbour] };
+			const bool isMiss{ depth == FLT_MAX };
+
+			const Vector3 point{ isMiss ? rayDirection : camera.origin + depth * rayDirection };
+
+			float rasterX{};
+			float rasterY{};
+			if (!ProjectToPreviousFrame(point, isMiss, aspectRatio, rasterX, rasterY))
+				continue;
+
+			const uint32_t previousIndex{ uint32_t(rasterX) + uint32_t(rasterY) * width };
+
+			//A miss only continues a miss, a hit has to be at a distance the traced neighbours agree with
+			const float previousDepth{ m_PreviousDepths[previousIndex] };
+			if (isMiss != (previousDepth == FLT_MAX))
+				continue;
+
+			if (!isMiss)
+			{
+				const float expectedDepth{ (point - m_PreviousCameraOrigin).Magnitude() };
+				if (std::abs(previousDepth - expectedDepth) > expectedDepth * s_ReprojectionDepthTolerance + (maxDepth - minDepth))
+					continue;
+			}
+
+			//Clamped to the colors around it, so a slightly misplaced or stale history pixel cannot drift further every frame
+			ColorRGB minColor{ FLT_MAX, FLT_MAX, FLT_MAX };
+			ColorRGB maxColor{ 0.f, 0.f, 0.f };
+			for (uint32_t clampNeighbour : neighbours)
+			{
+				if (clampNeighbour == UINT32_MAX)
+					continue;
+
+				const ColorRGB& color{ m_CheckerboardColors[clampNeighbour] };
+				minColor = { std::min(minColor.r, color.r), std::min(minColor.g, color.g), std::min(minColor.b, color.b) };
+				maxColor = { std::max(maxColor.r, color.r), std::max(maxColor.g, color.g), std::max(maxColor.b, color.b) };
+			}
+
+			const ColorRGB previousColor{ SamplePreviousColor(rasterX, rasterY) };
+			m_CheckerboardColors[pixelIndex] =
+			{
+				std::clamp(previousColor.r, minColor.r, maxColor.r),
+				std::clamp(previousColor.g, minColor.g, maxColor.g),
+				std::clamp(previousColor.b, minColor.b, maxColor.b)
+			};
+			m_CheckerboardDepths[pixelIndex] = depth;
+			return;
+		}
+	}
+
+	//Disoccluded: the neighbour pair that differs least lies along an edge rather than across it
+	const auto getLuminance = [this](uint32_t index)
+		{
+			const ColorRGB& color{ m_CheckerboardColors[index] };
+			return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+		};
+
+	const bool hasHorizontalPair{ neighbours[0] != UINT32_MAX && neighbours[1] != UINT32_MAX };
+	const bool hasVerticalPair{ neighbours[2] != UINT32_MAX && neighbours[3] != UINT32_MAX };
+
+	uint32_t first{};
+	uint32_t second{};
+	if (hasHorizontalPair && hasVerticalPair)
+	{
+		const bool isHorizontal{ std::abs(getLuminance(neighbours[0]) - getLuminance(neighbours[1])) <= std::abs(getLuminance(neighbours[2]) - getLuminance(neighbours[3])) };
+		first = isHorizontal ? neighbours[0] : neighbours[2];
+		second = isHorizontal ? neighbours[1] : neighbours[3];
+	}
+	else if (hasHorizontalPair || hasVerticalPair)
+	{
+		first = hasHorizontalPair ? neighbours[0] : neighbours[2];
+		second = hasHorizontalPair ? neighbours[1] : neighbours[3];
+	}
+	else
+	{
+		//A corner, or a screen one pixel wide: the neighbours that exist
+		first = (neighbours[0] != UINT32_MAX) ? neighbours[0] : neighbours[1];
+		second = (neighbours[2] != UINT32_MAX) ? neighbours[2] : neighbours[3];
+		if (first == UINT32_MAX)
+			first = second;
+		if (second == UINT32_MAX)
+			second = first;
+	}
+
+	//A 1x1 screen has no neighbours at all, but then its one pixel is always traced
+	const ColorRGB& firstColor{ m_CheckerboardColors[first] };
+	const ColorRGB& secondColor{ m_CheckerboardColors[second] };
+	m_CheckerboardColors[pixelIndex] = 0.5f * (firstColor + secondColor);
+	m_CheckerboardDepths[pixelIndex] = std::min(m_CheckerboardDepths[first], m_CheckerboardDepths[second]);
+}
+
+bool Renderer::ProjectToPreviousFrame(const Vector3& v, bool isDirection, float aspectRatio, float& rasterX, float& rasterY) const
+{
+	const Vector3 local{ isDirection ? m_PreviousWorldToCamera.TransformVector(v) : m_PreviousWorldToCamera.TransformPoint(v) };
+	if (local.z <= 0.f)
+		return false;
+
+	//RasterSpaceToCameraSpace backwards, for the pixel centers the previous frame traced through
+	rasterX = (local.x / local.z / (aspectRatio * m_PreviousFov) + 1.f) * 0.5f * float(m_Width);
+	rasterY = (1.f - local.y / (local.z * m_PreviousFov)) * 0.5f * float(m_Height);
+	return rasterX >= 0.f && rasterY >= 0.f && rasterX < float(m_Width) && rasterY < float(m_Height);
+}
+
+ColorRGB Renderer::SamplePreviousColor(float rasterX, float rasterY) const
+{
+	const float sourceX{ std::max(rasterX - 0.5f, 0.f) };
+	const float sourceY{ std::max(rasterY - 0.5f, 0.f) };
+	const uint32_t x0{ std::min(uint32_t(sourceX), uint32_t(m_Width) - 1) };
+	const uint32_t y0{ std::min(uint32_t(sourceY), uint32_t(m_Height) - 1) };
+	const uint32_t x1{ std::min(x0 + 1, uint32_t(m_Width) - 1) };
+	const uint32_t y1{ std::min(y0 + 1, uint32_t(m_Height) - 1) };
+	const float fractionX{ sourceX - float(x0) };
+	const float fractionY{ sourceY - float(y0) };
+
+	const uint32_t width{ uint32_t(m_Width) };
+	const ColorRGB top{ ColorRGB::Lerp(m_PreviousColors[x0 + y0 * width], m_PreviousColors[x1 + y0 * width], fractionX) };
+	const ColorRGB bottom{ ColorRGB::Lerp(m_PreviousColors[x0 + y1 * width], m_PreviousColors[x1 + y1 * width], fractionX) };
+	return ColorRGB::Lerp(top, bottom, fractionY);
+}
+
+void Renderer::PresentPixel(uint32_t windowPixelIndex, const ColorRGB& color) const
+{
+	m_pBufferPixels[windowPixelIndex] = SDL_MapRGB(m_pBuffer->format,
+		static_cast<uint8_t>(color.r * 255),
+		static_cast<uint8_t>(color.g * 255),
+		static_cast<uint8_t>(color.b * 255));
+}
+
+void Renderer::UpscaleToWindow() const
+{
+	const float scaleX{ float(m_Width) / float(m_WindowWidth) };
+	const float scaleY{ float(m_Height) / float(m_WindowHeight) };
+
+	const auto getLuminance = [](const ColorRGB& color)
+		{
+			return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+		};
+
+	ForEachChunk(m_pThreadPool, uint32_t(m_WindowHeight), s_ScreenPassRowsPerTask, [&](uint32_t beginY, uint32_t endY, uint32_t)
+		{
+			for (uint32_t y{ beginY }; y < endY; ++y)
+			{
+				const float sourceY{ std::max((float(y) + 0.5f) * scaleY - 0.5f, 0.f) };
+				const int y0{ std::min(int(sourceY), m_Height - 1) };
+				const int y1{ std::min(y0 + 1, m_Height - 1) };
+				const float fractionY{ sourceY - float(y0) };
+
+				for (uint32_t x{}; x < uint32_t(m_WindowWidth); ++x)
 				{
-				case LightingMode::ObservedArea:
-					finalColor += ColorRGB{ 1.f, 1.f, 1.f } *cosTheta;
-					break;
-
-				case LightingMode::Radiance:
-					finalColor += LightUtils::GetRadiance(light, hitStats.origin);
-					break;
-
-				case LightingMode::BRDF:
-					finalColor += brdfRgb;
-					break;
-
-				case LightingMode::Combined:
-					ColorRGB radiance{ LightUtils::GetRadiance(light, hitStats.origin) };
-					finalColor += radiance * brdfRgb * cosTheta;
-					break;
+					const float sourceX{ std::max((float(x) + 0.5f) * scaleX - 0.5f, 0.f) };
+					const int x0{ std::min(int(sourceX), m_Width - 1) };
+					const int x1{ std::min(x0 + 1, m_Width - 1) };
+					const float fractionX{ sourceX - float(x0) };
+
+					const ColorRGB taps[4]
+					{
+						m_ScaledColors[x0 + y0 * m_Width],
+						m_ScaledColors[x1 + y0 * m_Width],
+						m_ScaledColors[x0 + y1 * m_Width],
+						m_ScaledColors[x1 + y1 * m_Width]
+					};
+					const float bilinearWeights[4]
+					{
+						(1.f - fractionX) * (1.f - fractionY),
+						fractionX * (1.f - fractionY),
+						(1.f - fractionX) * fractionY,
+						fractionX * fractionY
+					};
+
+					//The nearest render pixel decides which side of an edge this pixel is on, taps across the edge are left out
+					//It has the largest bilinear weight and keeps all of it, so the weights never sum to 0
+					const uint32_t nearestTap{ (fractionX < 0.5f ? 0u : 1u) + (fractionY < 0.5f ? 0u : 2u) };
+					const float nearestLuminance{ getLuminance(taps[nearestTap]) };
+
+					ColorRGB color{};
+					float weightSum{};
+					for (uint32_t i{}; i < 4; ++i)
+					{
+						const float edgeWeight{ std::max(1.f - std::abs(getLuminance(taps[i]) - nearestLuminance) * s_UpscaleEdgeSharpness, 0.f) };
+						const float weight{ bilinearWeights[i] * edgeWeight };
+						color += weight * taps[i];
+						weightSum += weight;
+					}
+					color /= weightSum;
+
+					PresentPixel(x + y * uint32_t(m_WindowWidth), color);
 				}
 			}
-		}
+		});
+}
+
+void Renderer::UpdateResolutionScale(float elapsedSeconds)
+{
+	if (!m_DynamicResolutionEnabled)
+	{
+		m_ResolutionLevel = s_ResolutionLevelCount;
+		return;
 	}
 
-	//Update Color in Buffer
-	finalColor.MaxToOne();
+	//Stills render at window resolution or not at all, their frame times say nothing about the frames in motion
+	if (m_IsRenderingStill)
+		return;
+
+	const float frameTime{ elapsedSeconds * 1000.f };
+	if (m_ResolutionSettleCount > 0)
+	{
+		--m_ResolutionSettleCount;
+		m_SmoothedFrameTime = frameTime;
+		return;
+	}
+	if (m_SmoothedFrameTime <= 0.f)
+		m_SmoothedFrameTime = frameTime;
+	else
+		m_SmoothedFrameTime += (frameTime - m_SmoothedFrameTime) * 0.25f;
+
+	//The cost of a frame goes with its pixel count, the square of the level
+	const float level{ float(m_ResolutionLevel) };
+	uint32_t newLevel{ m_ResolutionLevel };
+	if (m_SmoothedFrameTime > m_TargetFrameTime * s_ResolutionDownThreshold)
+	{
+		//Straight down to the level predicted to meet the target, a frame over budget is worse than a blurry one
+		const float predictedLevel{ level * std::sqrt(m_TargetFrameTime / m_SmoothedFrameTime) };
+		newLevel = std::max(std::min(uint32_t(predictedLevel), m_ResolutionLevel - 1), s_MinResolutionLevel);
+	}
+	else if (m_ResolutionLevel < s_ResolutionLevelCount)
+	{
+		//Up one step at a time, and only when the step is predicted to stay under the target with room to spare
+		const float nextLevel{ level + 1.f };
+		if (m_SmoothedFrameTime * (nextLevel * nextLevel) / (level * level) < m_TargetFrameTime * s_ResolutionUpThreshold)
+			newLevel = m_ResolutionLevel + 1;
+	}
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	if (newLevel != m_ResolutionLevel)
+	{
+		m_ResolutionLevel = newLevel;
+		m_ResolutionSettleCount = s_ResolutionSettleFrames;
+	}
 }
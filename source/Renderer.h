@@ -1,24 +1,33 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <vector>
 
+#include "Matrix.h"
+
 struct SDL_Window;
 struct SDL_Surface;
 
 namespace dae
 {
 	class Scene;
-	struct Vector3;
+	class ThreadPool;
 	class Material;
 	struct Light;
 	struct Camera;
+	struct OcclusionCache;
+	struct HitRecord;
+	struct Ray;
+	struct ColorRGB;
 
 	class Renderer final
 	{
 	public:
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
@@ -28,17 +37,80 @@ namespace dae
 		void Render(Scene* pScene) const;
 		bool SaveBufferToImage() const;
 
-		void ToggleShadows() { m_ShadowEnabled = !m_ShadowEnabled; }
-		void ToggleLightingMode() { m_LightingMode = (int(m_LightingMode) < 3) ? LightingMode(int(m_LightingMode) + 1) : LightingMode(0); }
+		//Worker threads shared by rendering and BVH builds
+		ThreadPool* GetThreadPool() const { return m_pThreadPool; }
+
+		//Hit rate of the shadow occluder caches since the previous call, then starts counting again
+		void PrintOcclusionCacheStats() const;
+		//Slowest thread's render time over the average thread's since the previous call, then starts counting again
+		void PrintTileBalanceStats() const;
+
+		//Settings that change the image start the accumulation over, the ones that only change how it is rendered do not
+		void ToggleShadows() { m_ShadowEnabled = !m_ShadowEnabled; m_AccumulatedSampleCount = 0; }
+		void ToggleLightingMode() { m_LightingMode = (int(m_LightingMode) < 3) ? LightingMode(int(m_LightingMode) + 1) : LightingMode(0); m_AccumulatedSampleCount = 0; }
+		void TogglePacketTracing() { m_PacketTracingEnabled = !m_PacketTracingEnabled; }
+		void ToggleWavefront() { m_WavefrontEnabled = !m_WavefrontEnabled; }
+		void ToggleFastBRDF() { m_FastBRDFEnabled = !m_FastBRDFEnabled; m_AccumulatedSampleCount = 0; }
+		void ToggleCostPredictiveTiles() { m_CostPredictiveTilesEnabled = !m_CostPredictiveTilesEnabled; }
+		void ToggleProgressive() { m_ProgressiveEnabled = !m_ProgressiveEnabled; m_AccumulatedSampleCount = 0; }
+
+		//Samples averaged in the framebuffer, 0 while the view keeps changing or progressive mode is off
+		uint32_t GetAccumulatedSampleCount() const { return m_AccumulatedSampleCount; }
+
+		//Checkerboard: frames in motion trace every other pixel, switching colors each frame, the rest is reprojected from the frame before
+		void ToggleCheckerboard() { m_CheckerboardEnabled = !m_CheckerboardEnabled; }
+
+		//Dynamic resolution: frames in motion render fewer pixels while they take longer than the target, then get upscaled to the window
+		//A still that is being accumulated always renders at window resolution
+		void ToggleDynamicResolution() { m_DynamicResolutionEnabled = !m_DynamicResolutionEnabled; }
+		void SetTargetFrameTime(float milliseconds) { m_TargetFrameTime = std::max(milliseconds, 1.f); }
+		float GetTargetFrameTime() const { return m_TargetFrameTime; }
+		//Call once per frame with Timer::GetElapsed, picks the resolution of the next frame
+		void UpdateResolutionScale(float elapsedSeconds);
+		//Fraction of the window's width and height the frames in motion render at
+		float GetResolutionScale() const { return float(m_ResolutionLevel) / float(s_ResolutionLevelCount); }
+
+		//How the screen tiles of a frame are spread over the cores
+		enum class TileScheduler
+		{
+			Serial = 0,
+			WorkStealing = 1,
+			ParallelFor = 2 //concurrency::parallel_for, only available with MSVC
+		};
+
+		void SetTileScheduler(TileScheduler scheduler);
+		void CycleTileScheduler();
+		TileScheduler GetTileScheduler() const { return m_TileScheduler; }
+
+		//Pixels per side of the screen tiles handed out as tasks, rounded up to a multiple of the tile size the render mode works in
+		void SetScreenTileSize(uint32_t size) { m_ScreenTileSize = std::max(size, 1u); }
+		uint32_t GetScreenTileSize() const { return m_ScreenTileSize; }
+
+		//Slowest thread's render time over the average thread's in the last frame, 1 is perfectly balanced
+		//Threads the scheduler could use but that rendered nothing count towards the average with zero
+		float GetTileImbalance() const { return m_TileImbalance; }
 
 	private:
+		//Tests/RendererTests.cpp runs the stages of a frame one at a time on made up tile costs, frame times and framebuffers
+		friend class RendererTests;
+
 		SDL_Window* m_pWindow{};
+		ThreadPool* m_pThreadPool{};
 
 		SDL_Surface* m_pBuffer{};
 		uint32_t* m_pBufferPixels{};
 
-		int m_Width{};
-		int m_Height{};
+		int m_WindowWidth{};
+		int m_WindowHeight{};
+		//Resolution rays are traced at, the window's unless dynamic resolution scaled it down
+		mutable int m_Width{};
+		mutable int m_Height{};
+
+		//One cache per thread that ever rendered a pixel, owned by the renderer
+		//Threads tell renderers apart by id, a new renderer can get the address of one that was deleted
+		mutable std::vector<OcclusionCache*> m_pOcclusionCaches{};
+		mutable std::mutex m_OcclusionCacheMutex{};
+		uint64_t m_Id{};
 
 		enum class LightingMode
 		{
@@ -50,9 +122,140 @@ namespace dae
 
 		LightingMode m_LightingMode{ LightingMode::Combined };
 		bool m_ShadowEnabled{ true };
+		//Materials shade with their approximate BRDF math, off renders the exact reference
+		bool m_FastBRDFEnabled{ false };
+
+		//The screen is rendered in square tiles, with packet tracing on the primary rays of a tile are traced as one packet
+		static constexpr uint32_t s_TileSize{ 4 };
+		bool m_PacketTracingEnabled{ true };
+
+		//Wavefront mode renders bigger tiles in stages: primary rays, shadow rays, then shading sorted by material
+		//The per pixel path stays the reference it has to match
+		static constexpr uint32_t s_WavefrontTileSize{ 32 };
+		bool m_WavefrontEnabled{ false };
+
+		//Progressive mode: while the camera and scene hold still, every frame adds a jittered sample to the running average of each pixel
+		//Once it has this many samples the image is done and frames stop tracing rays until something changes
+		static constexpr uint32_t s_MaxAccumulatedSamples{ 256 };
+		bool m_ProgressiveEnabled{ false };
+		mutable std::vector<ColorRGB> m_AccumulationBuffer{};
+		mutable uint32_t m_AccumulatedSampleCount{};
+		mutable const Scene* m_pAccumulatedScene{};
+		//Where in the pixel this frame's primary rays go through, the center unless samples are accumulated
+		mutable float m_SampleOffsetX{ 0.5f };
+		mutable float m_SampleOffsetY{ 0.5f };
+
+		//The render resolution goes in steps of a sixteenth of the window per side, down to a quarter
+		static constexpr uint32_t s_ResolutionLevelCount{ 16 };
+		static constexpr uint32_t s_MinResolutionLevel{ 4 };
+		//Hysteresis: a level drops once frames run 10% over the target, and only goes up a step when that step is predicted to stay 15% under it
+		//After a change the frame time is left to settle for a few frames before it is trusted again
+		static constexpr float s_ResolutionDownThreshold{ 1.1f };
+		static constexpr float s_ResolutionUpThreshold{ 0.85f };
+		static constexpr uint32_t s_ResolutionSettleFrames{ 8 };
+		//Render pixels whose luminance differs from the nearest one by more than 1 / sharpness are not blended in by the upscale
+		static constexpr float s_UpscaleEdgeSharpness{ 8.f };
+		//Rows per task of the passes over the whole screen after the tiles are done
+		static constexpr uint32_t s_ScreenPassRowsPerTask{ 16 };
+		bool m_DynamicResolutionEnabled{ false };
+		float m_TargetFrameTime{ 1000.f / 30.f };
+		uint32_t m_ResolutionLevel{ s_ResolutionLevelCount };
+		uint32_t m_ResolutionSettleCount{};
+		float m_SmoothedFrameTime{};
+		mutable bool m_IsRenderingStill{ false };
+		//Colors of a scaled down frame, kept until the upscale writes them to the window
+		mutable std::vector<ColorRGB> m_ScaledColors{};
+
+		//A pixel that was not traced tries the depth of each traced neighbour: the point at that depth is projected into the previous frame,
+		//and the color seen there is used when that frame's depth agrees, give or take the spread of the neighbours' depths
+		//Otherwise it is disoccluded and takes the average of the neighbour pair across which the luminance changes least
+		static constexpr float s_ReprojectionDepthTolerance{ 0.05f };
+		bool m_CheckerboardEnabled{ false };
+		mutable bool m_IsCheckerboardFrame{ false };
+		mutable uint32_t m_CheckerboardParity{};
+		//Colors and hit distances of this frame and the one before, FLT_MAX where the primary ray missed
+		mutable std::vector<ColorRGB> m_CheckerboardColors{};
+		mutable std::vector<float> m_CheckerboardDepths{};
+		mutable std::vector<ColorRGB> m_PreviousColors{};
+		mutable std::vector<float> m_PreviousDepths{};
+		mutable bool m_HasPreviousFrame{ false };
+		mutable int m_PreviousWidth{};
+		mutable int m_PreviousHeight{};
+		mutable float m_PreviousFov{};
+		mutable Vector3 m_PreviousCameraOrigin{};
+		mutable Matrix m_PreviousWorldToCamera{};
+
+		TileScheduler m_TileScheduler{ TileScheduler::WorkStealing };
+		uint32_t m_ScreenTileSize{ 32 };
 
+		//A frame is handed out in chunks of screen tiles, balanced by what every tile cost to render the frame before
+		//Cheap neighbouring tiles are merged into one chunk, an expensive tile is split in rows of render tiles
+		struct TileChunk
+		{
+			uint32_t firstScreenTile{};
+			uint32_t screenTileCount{};
+			//Rows of render tiles within the screen tile, only a split tile does not cover all of them
+			uint32_t firstRow{};
+			uint32_t rowCount{};
+			float predictedCost{};
+			float measuredCost{};
+		};
+
+		//Chunks per thread when the costs are known, a few more than one so stealing can still even out mispredictions
+		static constexpr uint32_t s_TileChunksPerThread{ 4 };
+		bool m_CostPredictiveTilesEnabled{ true };
+
+		//Milliseconds every screen tile took last frame, reset when the tile layout changes
+		mutable std::vector<float> m_TileCosts{};
+		mutable uint32_t m_TileCostsScreenTileSize{};
+		mutable std::vector<TileChunk> m_TileChunks{};
+		//Chunk indices from the cheapest to the most expensive, workers run the newest task of their deque first
+		mutable std::vector<uint32_t> m_TileChunkOrder{};
+		//Milliseconds every thread spent rendering this frame, in the order the threads started their first chunk
+		mutable std::vector<float> m_ThreadRenderTimes{};
+		mutable std::atomic<uint32_t> m_RenderThreadCount{};
+		mutable uint32_t m_TileFrameIndex{};
+		mutable float m_TileImbalance{ 1.f };
+		mutable float m_TileImbalanceSum{};
+		mutable uint32_t m_TileImbalanceFrameCount{};
+
+		OcclusionCache& GetOcclusionCache() const;
 		Vector3 RasterSpaceToCameraSpace(float x, float y, int width, int height, float aspectRatio, float fov) const;
+		uint32_t GetTileSize() const;
+		uint32_t GetRoundedScreenTileSize() const;
+		uint32_t GetScreenTileCount() const;
+		void UpdateTileChunks() const;
+		void UpdateTileCosts() const;
+		uint32_t GetRenderThreadSlot() const;
+		void RenderTileChunk(Scene* pScene, uint32_t chunkIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+		void RenderScreenTile(Scene* pScene, uint32_t screenTileIndex, uint32_t firstRow, uint32_t rowCount, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+		void RenderTile(Scene* pScene, uint32_t tileX, uint32_t tileY, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+		void RenderTileWavefront(Scene* pScene, uint32_t tileX, uint32_t tileY, uint32_t tileEndX, uint32_t tileEndY, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+		//Traces the primary rays of [startX, endX) x [startY, endY) as one packet, returns the number of rays
+		uint32_t TracePrimaryPacket(Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float fov, float aspectRatio, const Camera& camera,
+			uint32_t* pPixelIndices, Vector3* pRayDirections, HitRecord* pHitStats) const;
 		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+		void ShadePixel(Scene* pScene, uint32_t pixelIndex, const HitRecord& hitStats, const Vector3& rayDirection, const std::vector<Light>& lights, const std::vector<Material*>& pMaterials) const;
+
+		Vector3 GetPrimaryRayDirection(uint32_t px, uint32_t py, float fov, float aspectRatio, const Camera& camera) const;
+		Ray GetRayToLight(const Vector3& origin, const Light& light) const;
+		//What one light adds to a hit it is not blocked from, depends on the lighting mode
+		ColorRGB GetLightContribution(const Light& light, const HitRecord& hitStats, const Vector3& directionToLight, float distanceToLight, const Vector3& rayDirection, Material* pMaterial) const;
+		ColorRGB Shade(Material* pMaterial, const HitRecord& hitStats, const Vector3& directionToLight, const Vector3& rayDirection) const;
+		bool IsPixelTraced(uint32_t px, uint32_t py) const;
+		void WritePixel(uint32_t pixelIndex, ColorRGB finalColor, float hitDistance) const;
+		//Accumulates a finished pixel and hands it to the window or the upscale
+		void OutputPixel(uint32_t pixelIndex, ColorRGB color) const;
+		//Fills in the pixels a checkerboard frame did not trace and outputs the whole frame
+		void ReconstructCheckerboard(const Camera& camera, float fov, float aspectRatio) const;
+		void ReconstructPixel(uint32_t px, uint32_t py, const Camera& camera, float fov, float aspectRatio, bool hasPreviousFrame) const;
+		//Raster position in the previous frame a world space point (or direction, for misses) was seen at, false when it was off screen
+		bool ProjectToPreviousFrame(const Vector3& v, bool isDirection, float aspectRatio, float& rasterX, float& rasterY) const;
+		//Bilinear between the pixel centers of the previous frame
+		ColorRGB SamplePreviousColor(float rasterX, float rasterY) const;
+		void PresentPixel(uint32_t windowPixelIndex, const ColorRGB& color) const;
+		//Edge-aware bilinear upscale of m_ScaledColors to the window
+		void UpscaleToWindow() const;
 
 	};
 }
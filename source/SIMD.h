@@ -0,0 +1,23 @@
+#pragma once
+
+//Instruction sets the SIMD code paths may use, decided at compile time
+//DAE_SSE: 4-wide float vectors, always available on x64
+//DAE_AVX2: 8-wide float vectors, enabled by /arch:AVX2 (or -mavx2)
+//Without either, every SIMD routine falls back to plain scalar code
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define DAE_SSE
+#endif
+
+#if defined(__AVX2__)
+#define DAE_AVX2
+#endif
+
+#if defined(DAE_SSE) || defined(DAE_AVX2)
+#include <immintrin.h>
+#endif
+
+//DAE_SIMD_MATH: Vector4 and Matrix arithmetic runs on SSE registers, in the same order as the scalar code so results match bit for bit
+//Define DAE_SCALAR_MATH to build the plain scalar math instead, to compare against or to debug
+#if defined(DAE_SSE) && !defined(DAE_SCALAR_MATH)
+#define DAE_SIMD_MATH
+#endif
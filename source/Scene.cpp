@@ -1,3 +1,5 @@
+#include <iostream>
+
 #include "Scene.h"
 #include "Utils.h"
 #include "Material.h"
@@ -12,6 +14,7 @@ namespace dae {
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
+		m_TriangleMeshInstances.reserve(32);
 		m_Lights.reserve(32);
 
 		// temp
@@ -36,19 +39,7 @@ namespace dae {
 		HitRecord currentHitStats{};
 		closestHit.t = ray.max;
 
-		for (const Sphere& sphere : m_SphereGeometries)
-		{
-			GeometryUtils::HitTest_Sphere(sphere, ray, currentHitStats);
-			if (currentHitStats.didHit && currentHitStats.t < closestHit.t)
-				closestHit = currentHitStats;
-		}
-
-		for (const Plane& plane : m_PlaneGeometries)
-		{
-			GeometryUtils::HitTest_Plane(plane, ray, currentHitStats);
-			if (currentHitStats.didHit && currentHitStats.t < closestHit.t)
-				closestHit = currentHitStats;
-		}
+		GeometryUtils::HitTest_PlaneBlocks(m_PlaneBlocks, m_PlaneGeometries, ray, closestHit.t, closestHit);
 
 		//for (const Triangle& triangle : m_Triangles)
 		//{
@@ -57,44 +48,358 @@ namespace dae {
 		//		closestHit = currentHitStats;
 		//}
 
-		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		Ray closestRay{ ray };
+		closestRay.max = closestHit.t;
+
+		const std::vector<uint32_t>& primitiveIndices{ m_TopLevelBVH.GetPrimitiveIndices() };
+		const size_t sphereCount{ m_SphereGeometries.size() };
+		const size_t meshEnd{ sphereCount + m_TriangleMeshGeometries.size() };
+		GeometryUtils::TraverseBVHLeaves(m_TopLevelBVH, closestRay, [&](uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay)
+			{
+				bool didHit{ false };
+
+				//All spheres of the leaf at once, tested over the full ray like a single sphere
+				const LeafSphereBlocks& sphereBlocks{ m_LeafSphereBlocks[firstPrimitive] };
+				for (uint32_t blockIndex{ sphereBlocks.firstBlock }; blockIndex < sphereBlocks.firstBlock + sphereBlocks.blockCount; ++blockIndex)
+				{
+					if (GeometryUtils::HitTest_SphereBlock(m_SphereBlocks[blockIndex], m_SphereGeometries, ray, currentRay.max, closestHit))
+					{
+						currentRay.max = closestHit.t;
+						didHit = true;
+					}
+				}
+
+				for (uint32_t i{}; i < primitiveCount; ++i)
+				{
+					const uint32_t primitiveIndex{ primitiveIndices[firstPrimitive + i] };
+					if (primitiveIndex < sphereCount)
+						continue;
+
+					if (primitiveIndex < meshEnd)
+					{
+						GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[primitiveIndex - sphereCount], currentRay, currentHitStats);
+					}
+					else
+					{
+						const TriangleMeshInstance& instance{ m_TriangleMeshInstances[primitiveIndex - meshEnd] };
+						GeometryUtils::HitTest_TriangleMeshInstance(instance, m_TriangleMeshGeometries[instance.meshIndex], currentRay, currentHitStats);
+					}
+
+					if (!currentHitStats.didHit || currentHitStats.t >= currentRay.max)
+						continue;
+
+					closestHit = currentHitStats;
+					currentRay.max = currentHitStats.t;
+					didHit = true;
+				}
+				return didHit;
+			});
+	}
+
+	void Scene::GetClosestHits(RayPacket& packet, HitRecord* pClosestHits) const
+	{
+		const uint32_t fullMask{ packet.GetFullMask() };
+
+		//Rays that spread in different directions per axis can not share a frustum, those are traced one by one
+		if (!packet.UpdateFrustum(fullMask))
+		{
+			for (uint32_t lane{}; lane < packet.size; ++lane)
+			{
+				GetClosestHit(packet.GetRay(lane), pClosestHits[lane]);
+			}
+			return;
+		}
+
+		//Spheres are tested against the full ray like in GetClosestHit, so the initial max values are kept aside
+		float initialMax[RayPacket::s_MaxSize]{};
+		for (uint32_t lane{}; lane < packet.size; ++lane)
 		{
-			GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray, currentHitStats);
-			if (currentHitStats.didHit && currentHitStats.t < closestHit.t)
-				closestHit = currentHitStats;
+			initialMax[lane] = packet.max[lane];
+			pClosestHits[lane].t = packet.max[lane];
+
+			GeometryUtils::HitTest_PlaneBlocks(m_PlaneBlocks, m_PlaneGeometries, packet.GetRay(lane), pClosestHits[lane].t, pClosestHits[lane]);
+			packet.max[lane] = pClosestHits[lane].t;
 		}
+
+		const std::vector<uint32_t>& primitiveIndices{ m_TopLevelBVH.GetPrimitiveIndices() };
+		const size_t sphereCount{ m_SphereGeometries.size() };
+		const size_t meshEnd{ sphereCount + m_TriangleMeshGeometries.size() };
+		GeometryUtils::TraverseBVHPacket(m_TopLevelBVH, packet, fullMask, [&](uint32_t firstPrimitive, uint32_t primitiveCount, RayPacket& currentPacket, uint32_t leafMask)
+			{
+				const LeafSphereBlocks& sphereBlocks{ m_LeafSphereBlocks[firstPrimitive] };
+				for (uint32_t blockIndex{ sphereBlocks.firstBlock }; blockIndex < sphereBlocks.firstBlock + sphereBlocks.blockCount; ++blockIndex)
+				{
+					for (uint32_t mask{ leafMask }; mask != 0; mask &= mask - 1)
+					{
+						const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+						Ray ray{ currentPacket.GetRay(lane) };
+						ray.max = initialMax[lane];
+						if (GeometryUtils::HitTest_SphereBlock(m_SphereBlocks[blockIndex], m_SphereGeometries, ray, currentPacket.max[lane], pClosestHits[lane]))
+							currentPacket.max[lane] = pClosestHits[lane].t;
+					}
+				}
+
+				for (uint32_t i{}; i < primitiveCount; ++i)
+				{
+					const uint32_t primitiveIndex{ primitiveIndices[firstPrimitive + i] };
+					if (primitiveIndex < sphereCount)
+						continue;
+
+					if (primitiveIndex < meshEnd)
+					{
+						const TriangleMesh& mesh{ m_TriangleMeshGeometries[primitiveIndex - sphereCount] };
+						GeometryUtils::HitTest_TriangleMeshPacket(mesh, mesh.inverseTransform, mesh.materialIndex, currentPacket, leafMask, pClosestHits);
+					}
+					else
+					{
+						const TriangleMeshInstance& instance{ m_TriangleMeshInstances[primitiveIndex - meshEnd] };
+						GeometryUtils::HitTest_TriangleMeshPacket(m_TriangleMeshGeometries[instance.meshIndex], instance.inverseTransform, instance.materialIndex, currentPacket, leafMask, pClosestHits);
+					}
+				}
+			});
 	}
 
 	bool Scene::DoesHit(const Ray& ray) const
 	{
 		//todo W3 - DONE
-		HitRecord hitStats{};
+		OcclusionCache::Occluder occluder{};
+		return FindOccluder(ray, occluder);
+	}
 
-		for (const Sphere& sphere : m_SphereGeometries)
+	bool Scene::DoesHit(const Ray& ray, OcclusionCache& cache, uint32_t lightIndex) const
+	{
+		if (lightIndex >= cache.occluders.size())
+			cache.occluders.resize(lightIndex + 1);
+
+		OcclusionCache::Occluder& occluder{ cache.occluders[lightIndex] };
+		++cache.rayCount;
+
+		if (occluder.primitiveIndex != UINT32_MAX)
 		{
-			if (GeometryUtils::HitTest_Sphere(sphere, ray, hitStats, true))
+			++cache.lookupCount;
+			if (IsOccludedBy(ray, occluder))
+			{
+				++cache.hitCount;
 				return true;
+			}
 		}
 
-		for (const Plane& plane : m_PlaneGeometries)
+		//A ray that reaches the light empties the cache, lit pixels would otherwise all pay for a failed retest
+		occluder = OcclusionCache::Occluder{};
+		return FindOccluder(ray, occluder);
+	}
+
+	bool Scene::FindOccluder(const Ray& ray, OcclusionCache::Occluder& occluder) const
+	{
+		//Occlusion only: no hit record is filled in and every level stops at the first blocker
+		const uint32_t topLevelCount{ static_cast<uint32_t>(m_TopLevelBounds.size()) };
+		const uint32_t planeIndex{ GeometryUtils::OcclusionTest_PlaneBlocks(m_PlaneBlocks, ray) };
+		if (planeIndex != UINT32_MAX)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray, hitStats, true))
-				return true;
+			occluder.primitiveIndex = topLevelCount + planeIndex;
+			return true;
 		}
 
 		//for (const Triangle& triangle : m_Triangles)
 		//{
-		//	if (GeometryUtils::HitTest_Triangle(triangle, ray, hitStats, true))
+		//	if (GeometryUtils::HitTest_Triangle(triangle, ray))
 		//		return true;
 		//}
 
+		const std::vector<uint32_t>& primitiveIndices{ m_TopLevelBVH.GetPrimitiveIndices() };
+		const size_t sphereCount{ m_SphereGeometries.size() };
+		const size_t meshEnd{ sphereCount + m_TriangleMeshGeometries.size() };
+		return GeometryUtils::TraverseBVHLeavesAnyHit(m_TopLevelBVH, ray, [&](uint32_t firstPrimitive, uint32_t primitiveCount, const Ray&)
+			{
+				//Spheres come first in the top-level numbering, so a sphere index is its primitive index
+				const LeafSphereBlocks& sphereBlocks{ m_LeafSphereBlocks[firstPrimitive] };
+				for (uint32_t blockIndex{ sphereBlocks.firstBlock }; blockIndex < sphereBlocks.firstBlock + sphereBlocks.blockCount; ++blockIndex)
+				{
+					const SphereBlock& block{ m_SphereBlocks[blockIndex] };
+
+					ShapeBlockHits hits;
+					const int hitMask{ IntersectSphereBlock(block, ray.origin, ray.direction, ray.min, ray.max, hits) };
+					if (hitMask != 0)
+					{
+						occluder.primitiveIndex = block.sphereIndex[std::countr_zero(static_cast<unsigned int>(hitMask))];
+						return true;
+					}
+				}
+
+				for (uint32_t i{}; i < primitiveCount; ++i)
+				{
+					const uint32_t primitiveIndex{ primitiveIndices[firstPrimitive + i] };
+					if (primitiveIndex < sphereCount)
+						continue;
+
+					bool isOccluded{};
+					if (primitiveIndex < meshEnd)
+					{
+						const TriangleMesh& mesh{ m_TriangleMeshGeometries[primitiveIndex - sphereCount] };
+						isOccluded = GeometryUtils::OcclusionTest_TriangleMesh(mesh, mesh.inverseTransform, ray, &occluder.triangleIndex);
+					}
+					else
+					{
+						const TriangleMeshInstance& instance{ m_TriangleMeshInstances[primitiveIndex - meshEnd] };
+						isOccluded = GeometryUtils::OcclusionTest_TriangleMesh(m_TriangleMeshGeometries[instance.meshIndex], instance.inverseTransform, ray, &occluder.triangleIndex);
+					}
+
+					if (isOccluded)
+					{
+						occluder.primitiveIndex = primitiveIndex;
+						return true;
+					}
+				}
+				return false;
+			});
+	}
+
+	bool Scene::IsOccludedBy(const Ray& ray, const OcclusionCache::Occluder& occluder) const
+	{
+		//The cache can outlive a change in the scene, an index that no longer exists is simply a miss
+		const uint32_t topLevelCount{ static_cast<uint32_t>(m_TopLevelBounds.size()) };
+		if (occluder.primitiveIndex >= topLevelCount)
+		{
+			const uint32_t planeIndex{ occluder.primitiveIndex - topLevelCount };
+			return planeIndex < m_PlaneGeometries.size() && GeometryUtils::HitTest_Plane(m_PlaneGeometries[planeIndex], ray);
+		}
+
+		const size_t sphereCount{ m_SphereGeometries.size() };
+		const size_t meshEnd{ sphereCount + m_TriangleMeshGeometries.size() };
+		if (occluder.primitiveIndex < sphereCount)
+			return GeometryUtils::HitTest_Sphere(m_SphereGeometries[occluder.primitiveIndex], ray);
+
+		if (occluder.primitiveIndex < meshEnd)
+		{
+			const TriangleMesh& mesh{ m_TriangleMeshGeometries[occluder.primitiveIndex - sphereCount] };
+			return GeometryUtils::OcclusionTest_MeshTriangle(mesh, mesh.inverseTransform, occluder.triangleIndex, ray);
+		}
+
+		const TriangleMeshInstance& instance{ m_TriangleMeshInstances[occluder.primitiveIndex - meshEnd] };
+		return GeometryUtils::OcclusionTest_MeshTriangle(m_TriangleMeshGeometries[instance.meshIndex], instance.inverseTransform, occluder.triangleIndex, ray);
+	}
+
+	void Scene::UpdateAccelerationStructure()
+	{
+		m_TopLevelBounds.clear();
+		m_TopLevelBounds.reserve(m_SphereGeometries.size() + m_TriangleMeshGeometries.size() + m_TriangleMeshInstances.size());
+
+		for (const Sphere& sphere : m_SphereGeometries)
+		{
+			const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+
+			AABB bounds{};
+			bounds.Grow(sphere.origin - extent);
+			bounds.Grow(sphere.origin + extent);
+			m_TopLevelBounds.emplace_back(bounds);
+		}
+
 		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray, hitStats, true))
-				return true;
+			AABB bounds{};
+			bounds.Grow(triangleMesh.transformedMinAABB);
+			bounds.Grow(triangleMesh.transformedMaxAABB);
+			m_TopLevelBounds.emplace_back(bounds);
+		}
+
+		for (const TriangleMeshInstance& instance : m_TriangleMeshInstances)
+		{
+			AABB bounds{};
+			bounds.Grow(instance.transformedMinAABB);
+			bounds.Grow(instance.transformedMaxAABB);
+			m_TopLevelBounds.emplace_back(bounds);
 		}
 
-		return false;
+		m_TopLevelBVH.Update(m_TopLevelBounds);
+		UpdateShapeBlocks();
+	}
+
+	void Scene::UpdateShapeBlocks()
+	{
+		m_PlaneBlocks.clear();
+		for (uint32_t i{}; i < m_PlaneGeometries.size(); ++i)
+		{
+			const uint32_t lane{ i % PlaneBlock::s_Width };
+			if (lane == 0)
+				m_PlaneBlocks.emplace_back().SetEmpty();
+
+			const Plane& plane{ m_PlaneGeometries[i] };
+			PlaneBlock& block{ m_PlaneBlocks.back() };
+			block.originX[lane] = plane.origin.x;
+			block.originY[lane] = plane.origin.y;
+			block.originZ[lane] = plane.origin.z;
+			block.normalX[lane] = plane.normal.x;
+			block.normalY[lane] = plane.normal.y;
+			block.normalZ[lane] = plane.normal.z;
+			block.planeIndex[lane] = i;
+		}
+
+		//The spheres of a leaf keep their order inside the leaf, so ties resolve like they did one sphere at a time
+		m_SphereBlocks.clear();
+		m_LeafSphereBlocks.assign(m_TopLevelBounds.size(), LeafSphereBlocks{});
+
+		const std::vector<uint32_t>& primitiveIndices{ m_TopLevelBVH.GetPrimitiveIndices() };
+		for (const BVHNode& node : m_TopLevelBVH.GetNodes())
+		{
+			if (!node.IsLeaf())
+				continue;
+
+			LeafSphereBlocks& sphereBlocks{ m_LeafSphereBlocks[node.leftFirst] };
+			sphereBlocks.firstBlock = static_cast<uint32_t>(m_SphereBlocks.size());
+
+			uint32_t lane{};
+			for (uint32_t i{}; i < node.primitiveCount; ++i)
+			{
+				const uint32_t primitiveIndex{ primitiveIndices[node.leftFirst + i] };
+				if (primitiveIndex >= m_SphereGeometries.size())
+					continue;
+
+				if (lane == 0)
+				{
+					m_SphereBlocks.emplace_back().SetEmpty();
+					++sphereBlocks.blockCount;
+				}
+
+				const Sphere& sphere{ m_SphereGeometries[primitiveIndex] };
+				SphereBlock& block{ m_SphereBlocks.back() };
+				block.originX[lane] = sphere.origin.x;
+				block.originY[lane] = sphere.origin.y;
+				block.originZ[lane] = sphere.origin.z;
+				block.radius[lane] = sphere.radius;
+				block.sphereIndex[lane] = primitiveIndex;
+
+				lane = (lane + 1) % SphereBlock::s_Width;
+			}
+		}
+	}
+
+	void Scene::SetThreadPool(ThreadPool* pThreadPool)
+	{
+		m_pThreadPool = pThreadPool;
+		m_TopLevelBVH.SetThreadPool(pThreadPool);
+
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.bvh.SetThreadPool(pThreadPool);
+		}
+	}
+
+	void Scene::PrintAccelerationStructureStats() const
+	{
+		for (size_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			const TriangleMesh& mesh{ m_TriangleMeshGeometries[i] };
+
+			std::cout << "Mesh " << i << ": " << mesh.indices.size() / 3 << " triangles, built in " << mesh.bvh.GetBuildTime() << " ms, " << GetBVHLayoutName(mesh.bvhLayout)
+				<< ", " << mesh.GetBVHMemoryUsage() / 1024.f << " KiB";
+
+			const size_t memorySaved{ mesh.GetBVHMemorySaved() };
+			if (memorySaved > 0)
+				std::cout << " (" << memorySaved / 1024.f << " KiB saved by quantization)";
+
+			std::cout << std::endl;
+		}
 	}
 
 #pragma region Scene Helpers
@@ -125,11 +430,25 @@ namespace dae {
 		TriangleMesh m{};
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
+		m.bvh.SetThreadPool(m_pThreadPool);
 
 		m_TriangleMeshGeometries.emplace_back(m);
 		return &m_TriangleMeshGeometries.back();
 	}
 
+	TriangleMeshInstance* Scene::AddTriangleMeshInstance(const TriangleMesh* pMesh, unsigned char materialIndex)
+	{
+		assert(pMesh >= m_TriangleMeshGeometries.data() && pMesh < m_TriangleMeshGeometries.data() + m_TriangleMeshGeometries.size());
+
+		TriangleMeshInstance i{};
+		i.meshIndex = static_cast<uint32_t>(pMesh - m_TriangleMeshGeometries.data());
+		i.materialIndex = materialIndex;
+		i.UpdateTransforms(*pMesh);
+
+		m_TriangleMeshInstances.emplace_back(i);
+		return &m_TriangleMeshInstances.back();
+	}
+
 	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
 	{
 		Light l;
@@ -324,18 +643,21 @@ namespace dae {
 		m_pMeshes[0]->AppendTriangle(baseTriangle, true);
 		m_pMeshes[0]->Translate({ -1.75f, 4.5f, 0.f });
 		m_pMeshes[0]->UpdateAABB();
+		m_pMeshes[0]->UpdateBVH();
 		m_pMeshes[0]->UpdateTransforms();
 
 		m_pMeshes[1] = AddTriangleMesh(TriangleCullMode::FrontFaceCulling, matLambert_White);
 		m_pMeshes[1]->AppendTriangle(baseTriangle, true);
 		m_pMeshes[1]->Translate({ 0.f, 4.5f, 0.f });
 		m_pMeshes[1]->UpdateAABB();
+		m_pMeshes[1]->UpdateBVH();
 		m_pMeshes[1]->UpdateTransforms();
 
 		m_pMeshes[2] = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
 		m_pMeshes[2]->AppendTriangle(baseTriangle, true);
 		m_pMeshes[2]->Translate({ 1.75f, 4.5f, 0.f });
 		m_pMeshes[2]->UpdateAABB();
+		m_pMeshes[2]->UpdateBVH();
 		m_pMeshes[2]->UpdateTransforms();
 
 		//light
@@ -354,6 +676,7 @@ namespace dae {
 			pMesh->RotateY(yawAngle);
 			pMesh->UpdateTransforms();
 		}
+		m_HasChanged = true;
 	}
 
 	void Scene_W4_test::Initialize()
@@ -403,7 +726,11 @@ namespace dae {
 		m_pMesh->Scale({ 0.05f, 0.05f, 0.05f });
 		//m_pMesh->Translate({ 0.f, 1.f, 0.f });
 
+		//The table is built from long thin triangles and never deforms, so the slower spatial split build pays off
+		m_pMesh->bvh.SetBuildStrategy(BVHBuildStrategy::SpatialSplitSAH);
+
 		m_pMesh->UpdateAABB();
+		m_pMesh->UpdateBVH();
 		m_pMesh->UpdateTransforms();
 
 		//light
@@ -419,6 +746,7 @@ namespace dae {
 			return;
 		m_pMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
 		m_pMesh->UpdateTransforms();
+		m_HasChanged = true;
 	}
 
 	void Scene_W4_BunnyScene::Initialize()
@@ -445,6 +773,7 @@ namespace dae {
 			m_pMesh->indices);
 
 		m_pMesh->UpdateAABB();
+		m_pMesh->UpdateBVH();
 		m_pMesh->UpdateTransforms();
 
 		//light
@@ -5,16 +5,38 @@
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "ShapeBlock.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
+	class ThreadPool;
 	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
 
+	//Remembers per light the last primitive that blocked a shadow ray, neighbouring pixels are usually blocked by the same one
+	//Not thread safe, every worker thread keeps its own
+	struct OcclusionCache
+	{
+		struct Occluder
+		{
+			//Top-level primitive index, planes come after the primitives of the top-level BVH, UINT32_MAX when empty
+			uint32_t primitiveIndex{ UINT32_MAX };
+			//Triangle inside the mesh, only used for meshes and instances
+			uint32_t triangleIndex{};
+		};
+
+		std::vector<Occluder> occluders{};
+
+		uint64_t rayCount{};
+		//Rays that found an occluder in the cache, and how many of those were still blocked by it
+		uint64_t lookupCount{};
+		uint64_t hitCount{};
+	};
+
 	//Scene Base Class
 	class Scene
 	{
@@ -30,12 +52,27 @@ namespace dae
 		virtual void Initialize() = 0;
 		virtual void Update(dae::Timer* pTimer)
 		{
-			m_Camera.Update(pTimer);
+			m_HasChanged = m_Camera.Update(pTimer);
 		}
 
+		//Whether the camera moved or anything animated in the last Update
+		bool HasChanged() const { return m_HasChanged; }
+
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		//Closest hit of every ray in a packet, gives the same records as GetClosestHit ray by ray
+		void GetClosestHits(RayPacket& packet, HitRecord* pClosestHits) const;
 		bool DoesHit(const Ray& ray) const;
+		//Tests the occluder cached for this light first and only traverses the scene when it no longer blocks the ray
+		bool DoesHit(const Ray& ray, OcclusionCache& cache, uint32_t lightIndex) const;
+
+		//Refits (or rebuilds when needed) the top-level BVH over all spheres, meshes and instances, call after Initialize and after every Update
+		void UpdateAccelerationStructure();
+		//BVH builds run on this pool, set it before Initialize
+		void SetThreadPool(ThreadPool* pThreadPool);
+
+		//Writes triangle count, BVH build time, layout and memory of every mesh to the console
+		void PrintAccelerationStructureStats() const;
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
@@ -48,17 +85,43 @@ namespace dae
 		std::vector<Plane> m_PlaneGeometries{};
 		std::vector<Sphere> m_SphereGeometries{};
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
+		std::vector<TriangleMeshInstance> m_TriangleMeshInstances{};
 		std::vector<Light> m_Lights{};
 		std::vector<Material*> m_Materials{};
 
 		Camera m_Camera{};
+		//Scenes that animate set it in their Update, after the base class did
+		bool m_HasChanged{ true };
+
+		ThreadPool* m_pThreadPool{};
+
+		//Top-level BVH, primitives are numbered spheres first, then meshes, then mesh instances
+		//Planes are infinite and stay outside of it
+		BVH m_TopLevelBVH{};
+		std::vector<AABB> m_TopLevelBounds{};
+
+		//Planes and the spheres of every top-level leaf packed per component, rebuilt with the top-level BVH
+		struct LeafSphereBlocks
+		{
+			uint32_t firstBlock{};
+			uint32_t blockCount{};
+		};
+		std::vector<PlaneBlock> m_PlaneBlocks{};
+		std::vector<SphereBlock> m_SphereBlocks{};
+		//Indexed by the first primitive of a leaf, like TriangleMesh::leafBlockIndices
+		std::vector<LeafSphereBlocks> m_LeafSphereBlocks{};
 
 		//temp
 		std::vector<Triangle> m_Triangles;
 
+		bool FindOccluder(const Ray& ray, OcclusionCache::Occluder& occluder) const;
+		bool IsOccludedBy(const Ray& ray, const OcclusionCache::Occluder& occluder) const;
+		void UpdateShapeBlocks();
+
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		TriangleMeshInstance* AddTriangleMeshInstance(const TriangleMesh* pMesh, unsigned char materialIndex = 0);
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
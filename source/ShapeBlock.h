@@ -0,0 +1,296 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+#include "Math.h"
+#include "SIMD.h"
+
+namespace dae
+{
+	//Up to 8 spheres stored per component, so a single vector operation tests a ray against all of them
+	//Unused lanes have a NaN radius, every comparison on them fails without a separate lane count
+	struct alignas(32) SphereBlock
+	{
+		static constexpr uint32_t s_Width{ 8 };
+
+		float originX[s_Width];
+		float originY[s_Width];
+		float originZ[s_Width];
+		float radius[s_Width];
+
+		uint32_t sphereIndex[s_Width];
+
+		void SetEmpty()
+		{
+			for (uint32_t lane{}; lane < s_Width; ++lane)
+			{
+				originX[lane] = 0.f;
+				originY[lane] = 0.f;
+				originZ[lane] = 0.f;
+				radius[lane] = std::numeric_limits<float>::quiet_NaN();
+				sphereIndex[lane] = UINT32_MAX;
+			}
+		}
+	};
+
+	//Up to 8 planes stored per component, unused lanes have a zero normal and never hit
+	struct alignas(32) PlaneBlock
+	{
+		static constexpr uint32_t s_Width{ 8 };
+
+		float originX[s_Width];
+		float originY[s_Width];
+		float originZ[s_Width];
+		float normalX[s_Width];
+		float normalY[s_Width];
+		float normalZ[s_Width];
+
+		uint32_t planeIndex[s_Width];
+
+		void SetEmpty()
+		{
+			for (uint32_t lane{}; lane < s_Width; ++lane)
+			{
+				originX[lane] = 0.f;
+				originY[lane] = 0.f;
+				originZ[lane] = 0.f;
+				normalX[lane] = 0.f;
+				normalY[lane] = 0.f;
+				normalZ[lane] = 0.f;
+				planeIndex[lane] = UINT32_MAX;
+			}
+		}
+	};
+
+	//Distance per lane, only valid for the lanes set in the returned hit mask
+	struct alignas(32) ShapeBlockHits
+	{
+		float t[8];
+	};
+
+#pragma region Sphere Block Tests
+	//Same operations in the same order as GeometryUtils::HitTest_Sphere, so every path agrees with it bit for bit
+	//Each returns a hit bit per lane
+#if defined(DAE_AVX2)
+	inline int IntersectSphereBlock_8(const SphereBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const __m256 dirX{ _mm256_set1_ps(direction.x) };
+		const __m256 dirY{ _mm256_set1_ps(direction.y) };
+		const __m256 dirZ{ _mm256_set1_ps(direction.z) };
+		const __m256 two{ _mm256_set1_ps(2.f) };
+		const __m256 minT{ _mm256_set1_ps(tMin) };
+		const __m256 maxT{ _mm256_set1_ps(tMax) };
+
+		const __m256 sX{ _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_load_ps(block.originX)) };
+		const __m256 sY{ _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_load_ps(block.originY)) };
+		const __m256 sZ{ _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_load_ps(block.originZ)) };
+		const __m256 radius{ _mm256_load_ps(block.radius) };
+
+		const __m256 a{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, dirX), _mm256_mul_ps(dirY, dirY)), _mm256_mul_ps(dirZ, dirZ)) };
+		const __m256 b{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two, dirX), sX), _mm256_mul_ps(_mm256_mul_ps(two, dirY), sY)), _mm256_mul_ps(_mm256_mul_ps(two, dirZ), sZ)) };
+		const __m256 c{ _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, sX), _mm256_mul_ps(sY, sY)), _mm256_mul_ps(sZ, sZ)), _mm256_mul_ps(radius, radius)) };
+		const __m256 discriminant{ _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), a), c)) };
+
+		__m256 mask{ _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ) };
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(discriminant, minT, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(discriminant, maxT, _CMP_LE_OQ));
+
+		//Near root first, the far one when the ray starts inside the sphere
+		const __m256 root{ _mm256_sqrt_ps(discriminant) };
+		const __m256 negativeB{ _mm256_xor_ps(b, _mm256_set1_ps(-0.f)) };
+		const __m256 twoA{ _mm256_mul_ps(two, a) };
+		const __m256 tNear{ _mm256_div_ps(_mm256_sub_ps(negativeB, root), twoA) };
+		const __m256 tFar{ _mm256_div_ps(_mm256_add_ps(negativeB, root), twoA) };
+
+		const __m256 isNearInRange{ _mm256_and_ps(_mm256_cmp_ps(tNear, minT, _CMP_GE_OQ), _mm256_cmp_ps(tNear, maxT, _CMP_LE_OQ)) };
+		const __m256 isFarInRange{ _mm256_and_ps(_mm256_cmp_ps(tFar, minT, _CMP_GE_OQ), _mm256_cmp_ps(tFar, maxT, _CMP_LE_OQ)) };
+		mask = _mm256_and_ps(mask, _mm256_or_ps(isNearInRange, isFarInRange));
+
+		_mm256_store_ps(hits.t, _mm256_blendv_ps(tFar, tNear, isNearInRange));
+		return _mm256_movemask_ps(mask);
+	}
+#endif
+
+#if defined(DAE_SSE)
+	//Tests lanes [firstLane, firstLane + 4)
+	inline int IntersectSphereBlock_4(const SphereBlock& block, uint32_t firstLane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const __m128 dirX{ _mm_set1_ps(direction.x) };
+		const __m128 dirY{ _mm_set1_ps(direction.y) };
+		const __m128 dirZ{ _mm_set1_ps(direction.z) };
+		const __m128 two{ _mm_set1_ps(2.f) };
+		const __m128 minT{ _mm_set1_ps(tMin) };
+		const __m128 maxT{ _mm_set1_ps(tMax) };
+
+		const __m128 sX{ _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(block.originX + firstLane)) };
+		const __m128 sY{ _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(block.originY + firstLane)) };
+		const __m128 sZ{ _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(block.originZ + firstLane)) };
+		const __m128 radius{ _mm_load_ps(block.radius + firstLane) };
+
+		const __m128 a{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, dirX), _mm_mul_ps(dirY, dirY)), _mm_mul_ps(dirZ, dirZ)) };
+		const __m128 b{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(two, dirX), sX), _mm_mul_ps(_mm_mul_ps(two, dirY), sY)), _mm_mul_ps(_mm_mul_ps(two, dirZ), sZ)) };
+		const __m128 c{ _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, sX), _mm_mul_ps(sY, sY)), _mm_mul_ps(sZ, sZ)), _mm_mul_ps(radius, radius)) };
+		const __m128 discriminant{ _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), a), c)) };
+
+		__m128 mask{ _mm_cmpgt_ps(discriminant, _mm_setzero_ps()) };
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(discriminant, minT));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(discriminant, maxT));
+
+		//Near root first, the far one when the ray starts inside the sphere
+		const __m128 root{ _mm_sqrt_ps(discriminant) };
+		const __m128 negativeB{ _mm_xor_ps(b, _mm_set1_ps(-0.f)) };
+		const __m128 twoA{ _mm_mul_ps(two, a) };
+		const __m128 tNear{ _mm_div_ps(_mm_sub_ps(negativeB, root), twoA) };
+		const __m128 tFar{ _mm_div_ps(_mm_add_ps(negativeB, root), twoA) };
+
+		const __m128 isNearInRange{ _mm_and_ps(_mm_cmpge_ps(tNear, minT), _mm_cmple_ps(tNear, maxT)) };
+		const __m128 isFarInRange{ _mm_and_ps(_mm_cmpge_ps(tFar, minT), _mm_cmple_ps(tFar, maxT)) };
+		mask = _mm_and_ps(mask, _mm_or_ps(isNearInRange, isFarInRange));
+
+		//SSE2 has no blend, select with and/andnot
+		_mm_store_ps(hits.t + firstLane, _mm_or_ps(_mm_and_ps(isNearInRange, tNear), _mm_andnot_ps(isNearInRange, tFar)));
+		return _mm_movemask_ps(mask) << firstLane;
+	}
+#endif
+
+	inline int IntersectSphereBlock_1(const SphereBlock& block, uint32_t lane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const float sX{ origin.x - block.originX[lane] };
+		const float sY{ origin.y - block.originY[lane] };
+		const float sZ{ origin.z - block.originZ[lane] };
+
+		const float a{ (direction.x * direction.x + direction.y * direction.y) + direction.z * direction.z };
+		const float b{ ((2.f * direction.x) * sX + (2.f * direction.y) * sY) + (2.f * direction.z) * sZ };
+		const float c{ ((sX * sX + sY * sY) + sZ * sZ) - block.radius[lane] * block.radius[lane] };
+		const float discriminant{ b * b - (4.f * a) * c };
+
+		if (!(discriminant > 0.f && discriminant >= tMin && discriminant <= tMax))
+			return 0;
+
+		const float root{ sqrtf(discriminant) };
+		const float tNear{ (-b - root) / (2.f * a) };
+		if (tNear >= tMin && tNear <= tMax)
+		{
+			hits.t[lane] = tNear;
+			return 1 << lane;
+		}
+
+		const float tFar{ (-b + root) / (2.f * a) };
+		if (tFar >= tMin && tFar <= tMax)
+		{
+			hits.t[lane] = tFar;
+			return 1 << lane;
+		}
+
+		return 0;
+	}
+
+	inline int IntersectSphereBlock_Scalar(const SphereBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		int hitMask{};
+		for (uint32_t lane{}; lane < SphereBlock::s_Width; ++lane)
+		{
+			hitMask |= IntersectSphereBlock_1(block, lane, origin, direction, tMin, tMax, hits);
+		}
+		return hitMask;
+	}
+
+	//Picks the widest path the build supports
+	inline int IntersectSphereBlock(const SphereBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+#if defined(DAE_AVX2)
+		return IntersectSphereBlock_8(block, origin, direction, tMin, tMax, hits);
+#elif defined(DAE_SSE)
+		return IntersectSphereBlock_4(block, 0, origin, direction, tMin, tMax, hits)
+			| IntersectSphereBlock_4(block, 4, origin, direction, tMin, tMax, hits);
+#else
+		return IntersectSphereBlock_Scalar(block, origin, direction, tMin, tMax, hits);
+#endif
+	}
+#pragma endregion
+
+#pragma region Plane Block Tests
+	//Same operations in the same order as GeometryUtils::HitTest_Plane
+#if defined(DAE_AVX2)
+	inline int IntersectPlaneBlock_8(const PlaneBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const __m256 normalX{ _mm256_load_ps(block.normalX) };
+		const __m256 normalY{ _mm256_load_ps(block.normalY) };
+		const __m256 normalZ{ _mm256_load_ps(block.normalZ) };
+
+		const __m256 toPlaneX{ _mm256_sub_ps(_mm256_load_ps(block.originX), _mm256_set1_ps(origin.x)) };
+		const __m256 toPlaneY{ _mm256_sub_ps(_mm256_load_ps(block.originY), _mm256_set1_ps(origin.y)) };
+		const __m256 toPlaneZ{ _mm256_sub_ps(_mm256_load_ps(block.originZ), _mm256_set1_ps(origin.z)) };
+
+		const __m256 numerator{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toPlaneX, normalX), _mm256_mul_ps(toPlaneY, normalY)), _mm256_mul_ps(toPlaneZ, normalZ)) };
+		const __m256 denominator{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(direction.x), normalX), _mm256_mul_ps(_mm256_set1_ps(direction.y), normalY)), _mm256_mul_ps(_mm256_set1_ps(direction.z), normalZ)) };
+		const __m256 t{ _mm256_div_ps(numerator, denominator) };
+
+		const __m256 mask{ _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ)) };
+
+		_mm256_store_ps(hits.t, t);
+		return _mm256_movemask_ps(mask);
+	}
+#endif
+
+#if defined(DAE_SSE)
+	//Tests lanes [firstLane, firstLane + 4)
+	inline int IntersectPlaneBlock_4(const PlaneBlock& block, uint32_t firstLane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const __m128 normalX{ _mm_load_ps(block.normalX + firstLane) };
+		const __m128 normalY{ _mm_load_ps(block.normalY + firstLane) };
+		const __m128 normalZ{ _mm_load_ps(block.normalZ + firstLane) };
+
+		const __m128 toPlaneX{ _mm_sub_ps(_mm_load_ps(block.originX + firstLane), _mm_set1_ps(origin.x)) };
+		const __m128 toPlaneY{ _mm_sub_ps(_mm_load_ps(block.originY + firstLane), _mm_set1_ps(origin.y)) };
+		const __m128 toPlaneZ{ _mm_sub_ps(_mm_load_ps(block.originZ + firstLane), _mm_set1_ps(origin.z)) };
+
+		const __m128 numerator{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(toPlaneX, normalX), _mm_mul_ps(toPlaneY, normalY)), _mm_mul_ps(toPlaneZ, normalZ)) };
+		const __m128 denominator{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(direction.x), normalX), _mm_mul_ps(_mm_set1_ps(direction.y), normalY)), _mm_mul_ps(_mm_set1_ps(direction.z), normalZ)) };
+		const __m128 t{ _mm_div_ps(numerator, denominator) };
+
+		const __m128 mask{ _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tMin)), _mm_cmple_ps(t, _mm_set1_ps(tMax))) };
+
+		_mm_store_ps(hits.t + firstLane, t);
+		return _mm_movemask_ps(mask) << firstLane;
+	}
+#endif
+
+	inline int IntersectPlaneBlock_1(const PlaneBlock& block, uint32_t lane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		const float toPlaneX{ block.originX[lane] - origin.x };
+		const float toPlaneY{ block.originY[lane] - origin.y };
+		const float toPlaneZ{ block.originZ[lane] - origin.z };
+
+		const float numerator{ (toPlaneX * block.normalX[lane] + toPlaneY * block.normalY[lane]) + toPlaneZ * block.normalZ[lane] };
+		const float denominator{ (direction.x * block.normalX[lane] + direction.y * block.normalY[lane]) + direction.z * block.normalZ[lane] };
+		const float t{ numerator / denominator };
+
+		hits.t[lane] = t;
+		return (t >= tMin && t <= tMax) ? (1 << lane) : 0;
+	}
+
+	inline int IntersectPlaneBlock_Scalar(const PlaneBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+		int hitMask{};
+		for (uint32_t lane{}; lane < PlaneBlock::s_Width; ++lane)
+		{
+			hitMask |= IntersectPlaneBlock_1(block, lane, origin, direction, tMin, tMax, hits);
+		}
+		return hitMask;
+	}
+
+	//Picks the widest path the build supports
+	inline int IntersectPlaneBlock(const PlaneBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, ShapeBlockHits& hits)
+	{
+#if defined(DAE_AVX2)
+		return IntersectPlaneBlock_8(block, origin, direction, tMin, tMax, hits);
+#elif defined(DAE_SSE)
+		return IntersectPlaneBlock_4(block, 0, origin, direction, tMin, tMax, hits)
+			| IntersectPlaneBlock_4(block, 4, origin, direction, tMin, tMax, hits);
+#else
+		return IntersectPlaneBlock_Scalar(block, origin, direction, tMin, tMax, hits);
+#endif
+	}
+#pragma endregion
+}
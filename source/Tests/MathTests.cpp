@@ -0,0 +1,454 @@
+//Checks the math types against plain scalar formulas on random inputs.
+//Built twice: MathTests uses the SSE backend, MathTestsScalar defines DAE_SCALAR_MATH.
+//The SIMD paths keep the scalar operation order, so those results have to match exactly.
+//The fast BRDF tier is checked against the error bounds its comments state.
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Material.h"
+#include "Math.h"
+
+using namespace dae;
+
+namespace
+{
+	constexpr int ITERATION_COUNT{ 10000 };
+
+	int g_FailureCount{};
+
+	void Check(bool condition, const char* pName, int iteration)
+	{
+		if (condition)
+			return;
+
+		//Only report the first few failures of a run, one broken operator fails every iteration
+		if (g_FailureCount < 20)
+			printf("FAILED: %s (iteration %d)\n", pName, iteration);
+		++g_FailureCount;
+	}
+
+	bool IsExact(const Vector3& a, const Vector3& b)
+	{
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	bool IsExact(const ColorRGB& a, const ColorRGB& b)
+	{
+		return a.r == b.r && a.g == b.g && a.b == b.b;
+	}
+
+	double RelativeError(double value, double reference)
+	{
+		return std::abs(value - reference) / std::abs(reference);
+	}
+
+	double RelativeError(const ColorRGB& value, const ColorRGB& reference)
+	{
+		return std::max(RelativeError(value.r, reference.r), std::max(RelativeError(value.g, reference.g), RelativeError(value.b, reference.b)));
+	}
+
+	class Random
+	{
+	public:
+		explicit Random(uint32_t seed) : m_Engine{ seed } {}
+
+		float Float(float min, float max)
+		{
+			return std::uniform_real_distribution<float>{ min, max }(m_Engine);
+		}
+
+		Vector3 Vector(float min = -10.f, float max = 10.f)
+		{
+			return { Float(min, max), Float(min, max), Float(min, max) };
+		}
+
+		ColorRGB Color(float min = 0.f, float max = 2.f)
+		{
+			return { Float(min, max), Float(min, max), Float(min, max) };
+		}
+
+		//Uniform over the sphere, points too close to the center are rejected before normalizing
+		Vector3 Direction()
+		{
+			Vector3 direction{};
+			do
+			{
+				direction = Vector(-1.f, 1.f);
+			} while (direction.SqrMagnitude() < 0.01f || direction.SqrMagnitude() > 1.f);
+			return direction.Normalized();
+		}
+
+		//A well conditioned affine transform, the way meshes and the camera build theirs
+		Matrix Transform()
+		{
+			const Matrix scale{ Matrix::CreateScale(Vector(0.25f, 4.f)) };
+			const Matrix rotation{ Matrix::CreateRotation(Vector(-PI, PI)) };
+			const Matrix translation{ Matrix::CreateTranslation(Vector()) };
+			return scale * rotation * translation;
+		}
+
+		//A general 4x4 matrix, kept away from singular by a dominant diagonal
+		Matrix General()
+		{
+			Matrix matrix{};
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					matrix[r][c] = Float(-1.f, 1.f) + (r == c ? 4.f : 0.f);
+				}
+			}
+			return matrix;
+		}
+
+	private:
+		std::mt19937 m_Engine;
+	};
+
+	//Gauss-Jordan elimination in double precision as an independent reference for Matrix::Inverse
+	bool InverseReference(const Matrix& m, double out[4][4])
+	{
+		double a[4][8]{};
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			for (int c{ 0 }; c < 4; ++c)
+			{
+				a[r][c] = m[r][c];
+			}
+			a[r][4 + r] = 1.0;
+		}
+
+		for (int c{ 0 }; c < 4; ++c)
+		{
+			int pivot{ c };
+			for (int r{ c + 1 }; r < 4; ++r)
+			{
+				if (std::abs(a[r][c]) > std::abs(a[pivot][c]))
+					pivot = r;
+			}
+			if (a[pivot][c] == 0.0)
+				return false;
+
+			for (int k{ 0 }; k < 8; ++k)
+			{
+				std::swap(a[c][k], a[pivot][k]);
+			}
+
+			const double invPivot{ 1.0 / a[c][c] };
+			for (int k{ 0 }; k < 8; ++k)
+			{
+				a[c][k] *= invPivot;
+			}
+
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				if (r == c)
+					continue;
+
+				const double factor{ a[r][c] };
+				for (int k{ 0 }; k < 8; ++k)
+				{
+					a[r][k] -= factor * a[c][k];
+				}
+			}
+		}
+
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			for (int c{ 0 }; c < 4; ++c)
+			{
+				out[r][c] = a[r][4 + c];
+			}
+		}
+		return true;
+	}
+
+	void TestVector3(Random& random)
+	{
+		for (int i{ 0 }; i < ITERATION_COUNT; ++i)
+		{
+			const Vector3 a{ random.Vector() };
+			const Vector3 b{ random.Vector() };
+
+			const float dot{ a.x * b.x + a.y * b.y + a.z * b.z };
+			Check(Vector3::Dot(a, b) == dot, "Vector3::Dot", i);
+
+			const Vector3 cross{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+			Check(IsExact(Vector3::Cross(a, b), cross), "Vector3::Cross", i);
+			Check(std::abs(Vector3::Dot(Vector3::Cross(a, b), a)) <= 1e-4f * a.SqrMagnitude() * b.Magnitude(), "Vector3::Cross is perpendicular", i);
+
+			const float magnitude{ sqrtf(a.x * a.x + a.y * a.y + a.z * a.z) };
+			const Vector3 normalized{ a.x / magnitude, a.y / magnitude, a.z / magnitude };
+			Check(IsExact(a.Normalized(), normalized), "Vector3::Normalized", i);
+			Check(std::abs(a.Normalized().Magnitude() - 1.f) <= 1e-6f, "Vector3::Normalized has unit length", i);
+
+			Vector3 normalizedInPlace{ a };
+			Check(normalizedInPlace.Normalize() == magnitude && IsExact(normalizedInPlace, normalized), "Vector3::Normalize", i);
+		}
+	}
+
+	void TestTransform(Random& random)
+	{
+		for (int i{ 0 }; i < ITERATION_COUNT; ++i)
+		{
+			const Matrix m{ i % 2 == 0 ? random.Transform() : random.General() };
+			const Vector3 v{ random.Vector() };
+
+			const Vector3 vector{
+				m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+				m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+				m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z
+			};
+			Check(IsExact(m.TransformVector(v), vector), "Matrix::TransformVector", i);
+
+			const Vector3 point{
+				m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z + m[3][0],
+				m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z + m[3][1],
+				m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z + m[3][2]
+			};
+			Check(IsExact(m.TransformPoint(v), point), "Matrix::TransformPoint", i);
+		}
+
+		//The constant evaluated path always runs the scalar code, the runtime path has to agree with it
+		constexpr Matrix m{ { 1.5f, -2.f, 0.25f, 0.f }, { 3.f, 0.5f, -1.f, 0.f }, { -0.75f, 2.5f, 4.f, 0.f }, { 7.f, -3.f, 0.125f, 1.f } };
+		constexpr Vector3 v{ 0.3f, -1.7f, 2.9f };
+		constexpr Vector3 constantVector{ m.TransformVector(v) };
+		constexpr Vector3 constantPoint{ m.TransformPoint(v) };
+		const Matrix runtimeMatrix{ m };
+		Check(IsExact(runtimeMatrix.TransformVector(v), constantVector), "Matrix::TransformVector matches constant evaluation", 0);
+		Check(IsExact(runtimeMatrix.TransformPoint(v), constantPoint), "Matrix::TransformPoint matches constant evaluation", 0);
+	}
+
+	void TestInverse(Random& random)
+	{
+		constexpr Matrix scaleTranslation{ Matrix::CreateScale(2.f, 4.f, 0.5f) * Matrix::CreateTranslation(1.f, 2.f, 3.f) };
+		constexpr Matrix inverseScaleTranslation{ Matrix::Inverse(scaleTranslation) };
+		static_assert(inverseScaleTranslation[0][0] == 0.5f && inverseScaleTranslation[1][1] == 0.25f && inverseScaleTranslation[2][2] == 2.f);
+		static_assert(inverseScaleTranslation[3][0] == -0.5f && inverseScaleTranslation[3][1] == -0.5f && inverseScaleTranslation[3][2] == -6.f);
+
+		for (int i{ 0 }; i < ITERATION_COUNT; ++i)
+		{
+			const Matrix m{ i % 2 == 0 ? random.Transform() : random.General() };
+			const Matrix inverse{ Matrix::Inverse(m) };
+
+			double reference[4][4]{};
+			const bool isInvertible{ InverseReference(m, reference) };
+			Check(isInvertible, "Matrix::Inverse reference is invertible", i);
+			if (!isInvertible)
+				continue;
+
+			double maxReference{};
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					maxReference = std::max(maxReference, std::abs(reference[r][c]));
+				}
+			}
+
+			bool matchesReference{ true };
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					matchesReference &= std::abs(inverse[r][c] - reference[r][c]) <= 1e-5 * maxReference;
+				}
+			}
+			Check(matchesReference, "Matrix::Inverse matches the double precision reference", i);
+
+			const Matrix identity{ m * inverse };
+			bool isIdentity{ true };
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					isIdentity &= std::abs(identity[r][c] - (r == c ? 1.f : 0.f)) <= 1e-4f;
+				}
+			}
+			Check(isIdentity, "Matrix * Matrix::Inverse is the identity", i);
+
+			Matrix invertedInPlace{ m };
+			invertedInPlace.Inverse();
+			bool matchesStatic{ true };
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					matchesStatic &= invertedInPlace[r][c] == inverse[r][c];
+				}
+			}
+			Check(matchesStatic, "Matrix::Inverse in place matches Matrix::Inverse(m)", i);
+		}
+	}
+
+	void TestColorRGB(Random& random)
+	{
+		for (int i{ 0 }; i < ITERATION_COUNT; ++i)
+		{
+			const ColorRGB a{ random.Color() };
+			const ColorRGB b{ random.Color(0.1f, 2.f) };
+			const float s{ random.Float(0.1f, 4.f) };
+
+			const ColorRGB sum{ a.r + b.r, a.g + b.g, a.b + b.b };
+			const ColorRGB difference{ a.r - b.r, a.g - b.g, a.b - b.b };
+			const ColorRGB product{ a.r * b.r, a.g * b.g, a.b * b.b };
+			const ColorRGB quotient{ a.r / b.r, a.g / b.g, a.b / b.b };
+			const ColorRGB scaled{ a.r * s, a.g * s, a.b * s };
+			const ColorRGB divided{ a.r / s, a.g / s, a.b / s };
+
+			Check(IsExact(a + b, sum), "ColorRGB + ColorRGB", i);
+			Check(IsExact(a - b, difference), "ColorRGB - ColorRGB", i);
+			Check(IsExact(a * b, product), "ColorRGB * ColorRGB", i);
+			Check(IsExact(a * s, scaled), "ColorRGB * float", i);
+			Check(IsExact(s * a, scaled), "float * ColorRGB", i);
+
+			ColorRGB c{ a };
+			Check(IsExact(c += b, sum) && IsExact(c, sum), "ColorRGB += ColorRGB", i);
+			c = a;
+			Check(IsExact(c -= b, difference) && IsExact(c, difference), "ColorRGB -= ColorRGB", i);
+			c = a;
+			Check(IsExact(c *= b, product) && IsExact(c, product), "ColorRGB *= ColorRGB", i);
+			c = a;
+			Check(IsExact(c /= b, quotient) && IsExact(c, quotient), "ColorRGB /= ColorRGB", i);
+			c = a;
+			Check(IsExact(c *= s, scaled) && IsExact(c, scaled), "ColorRGB *= float", i);
+			c = a;
+			Check(IsExact(c /= s, divided) && IsExact(c, divided), "ColorRGB /= float", i);
+
+			//The non-const operators accumulate into the left operand
+			c = a;
+			Check(IsExact(c + b, sum) && IsExact(c, sum), "ColorRGB + ColorRGB (non-const)", i);
+			c = a;
+			Check(IsExact(c / s, divided) && IsExact(c, divided), "ColorRGB / float (non-const)", i);
+
+			//A chain of operations keeps every channel finite, even after dividing
+			c = a;
+			c /= b;
+			c /= s;
+			c += a * s - b;
+			const ColorRGB chain{
+				a.r / b.r / s + (a.r * s - b.r),
+				a.g / b.g / s + (a.g * s - b.g),
+				a.b / b.b / s + (a.b * s - b.b)
+			};
+			Check(IsExact(c, chain), "ColorRGB operator chain", i);
+
+			c = a * 4.f;
+			c.MaxToOne();
+			const float maxValue{ std::max(a.r * 4.f, std::max(a.g * 4.f, a.b * 4.f)) };
+			const ColorRGB maxToOne{ maxValue > 1.f ? ColorRGB{ a.r * 4.f / maxValue, a.g * 4.f / maxValue, a.b * 4.f / maxValue } : a * 4.f };
+			Check(IsExact(c, maxToOne), "ColorRGB::MaxToOne", i);
+
+			const float factor{ random.Float(0.f, 1.f) };
+			const ColorRGB lerp{ Lerpf(a.r, b.r, factor), Lerpf(a.g, b.g, factor), Lerpf(a.b, b.b, factor) };
+			Check(IsExact(ColorRGB::Lerp(a, b, factor), lerp), "ColorRGB::Lerp", i);
+		}
+	}
+
+	void TestBRDF(Random& random)
+	{
+		for (int i{ 0 }; i < ITERATION_COUNT; ++i)
+		{
+			const Vector3 n{ random.Direction() };
+			Vector3 v{ random.Direction() };
+			if (Vector3::Dot(n, v) <= 0.f)
+				v = -v;
+
+			//Every fourth light sits next to the mirror direction, where the highlight of smooth materials is the hardest part
+			Vector3 l{ random.Direction() };
+			if (i % 4 == 0)
+				l = (Vector3::Reflect(-v, n) + random.Vector(-1e-3f, 1e-3f)).Normalized();
+			if (Vector3::Dot(n, l) <= 0.f)
+				l = -l;
+
+			const Vector3 h{ (v + l).Normalized() };
+			const float nDotV{ Vector3::Dot(n, v) };
+			const float nDotL{ Vector3::Dot(n, l) };
+
+			const ColorRGB f0{ random.Color(0.f, 1.f) };
+			Check(RelativeError(BRDF::FresnelFunction_SchlickFast(Vector3::Dot(h, v), f0), BRDF::FresnelFunction_Schlick(h, v, f0)) <= 4e-7,
+				"BRDF::FresnelFunction_SchlickFast within 4e-7 of FresnelFunction_Schlick", i);
+
+			//GGX D * Smith G / (4 * n.v * n.l) from the same inputs in double precision, 1 - (n.h)^2 taken as |n x h|^2 like the fast version
+			const float roughness{ random.Float(0.1f, 1.f) };
+			const float alpha2{ Square(Square(roughness)) };
+			const float kDirect{ Square(Square(roughness) + 1.f) / 8.f };
+			const double nDotH{ double(n.x) * h.x + double(n.y) * h.y + double(n.z) * h.z };
+			const double crossX{ double(n.y) * h.z - double(n.z) * h.y };
+			const double crossY{ double(n.z) * h.x - double(n.x) * h.z };
+			const double crossZ{ double(n.x) * h.y - double(n.y) * h.x };
+			const double distribution{ crossX * crossX + crossY * crossY + crossZ * crossZ + nDotH * nDotH * alpha2 };
+			const double geometryV{ nDotV / (nDotV * (1.0 - kDirect) + kDirect) };
+			const double geometryL{ nDotL / (nDotL * (1.0 - kDirect) + kDirect) };
+			const double specularDG{ alpha2 / (3.14159265358979323846 * distribution * distribution) * geometryV * geometryL / (4.0 * nDotV * nDotL) };
+			Check(RelativeError(BRDF::SpecularDG_Fast(n, h, nDotV, nDotL, alpha2, kDirect), specularDG) <= 2e-4,
+				"BRDF::SpecularDG_Fast within 2e-4 of the double precision terms", i);
+
+			Material_CookTorrence material{ random.Color(0.f, 1.f), i % 2 == 0 ? 0.f : 1.f, roughness };
+			HitRecord hitRecord{};
+			hitRecord.normal = n;
+			const double shadeError{ RelativeError(material.ShadeFast(hitRecord, l, v), material.Shade(hitRecord, l, v)) };
+			Check(shadeError <= 1e-2, "Material_CookTorrence::ShadeFast within 1e-2 of Shade for roughness >= 0.1", i);
+			if (roughness >= 0.3f)
+				Check(shadeError <= 2e-4, "Material_CookTorrence::ShadeFast within 2e-4 of Shade for roughness >= 0.3", i);
+		}
+	}
+
+	//The Halton sequence the progressive renderer jitters its samples with
+	void TestRadicalInverse()
+	{
+		Check(RadicalInverse(0, 2) == 0.f && RadicalInverse(1, 2) == 0.5f && RadicalInverse(2, 2) == 0.25f && RadicalInverse(3, 2) == 0.75f && RadicalInverse(6, 2) == 0.375f,
+			"RadicalInverse mirrors the binary digits", 0);
+		Check(RadicalInverse(1, 3) == 1.f / 3.f && std::abs(RadicalInverse(5, 3) - 7.f / 9.f) <= 1e-6f, "RadicalInverse mirrors the ternary digits", 0);
+
+		//The first base^k indices put one sample in every interval of 1 / base^k, with no two in the same one
+		for (uint32_t base : { 2u, 3u })
+		{
+			for (uint32_t count{ base }; count <= 256; count *= base)
+			{
+				std::vector<bool> isIntervalUsed(count);
+				for (uint32_t index{}; index < count; ++index)
+				{
+					const float value{ RadicalInverse(index, base) };
+					const float scaled{ value * float(count) };
+					const uint32_t interval{ uint32_t(std::round(scaled)) };
+					Check(value >= 0.f && value < 1.f, "RadicalInverse is in [0, 1)", int(index));
+					Check(std::abs(scaled - float(interval)) <= 1e-4f && interval < count && !isIntervalUsed[interval], "RadicalInverse fills every interval once", int(index));
+					if (interval < count)
+						isIntervalUsed[interval] = true;
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+#if defined(DAE_SIMD_MATH)
+	printf("Math backend: SIMD\n");
+#else
+	printf("Math backend: scalar\n");
+#endif
+
+	Random random{ 5489u };
+	TestVector3(random);
+	TestTransform(random);
+	TestInverse(random);
+	TestColorRGB(random);
+	TestBRDF(random);
+	TestRadicalInverse();
+
+	if (g_FailureCount > 0)
+	{
+		printf("%d checks failed\n", g_FailureCount);
+		return 1;
+	}
+
+	printf("All math checks passed\n");
+	return 0;
+}
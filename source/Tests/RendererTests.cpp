@@ -0,0 +1,488 @@
+//Checks the stages of a frame that decide how it is rendered, on made up inputs.
+//The renderer draws into a hidden window, the images themselves are not compared against references.
+#include "SDL.h"
+#undef main
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include "Material.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+using namespace dae;
+
+namespace
+{
+	//A multiple of the screen tile size in both directions, so every screen tile has all its rows
+	constexpr int WINDOW_WIDTH{ 256 };
+	constexpr int WINDOW_HEIGHT{ 128 };
+
+	int g_FailureCount{};
+
+	void Check(bool condition, const char* pName)
+	{
+		if (condition)
+			return;
+
+		if (g_FailureCount < 20)
+			printf("FAILED: %s\n", pName);
+		++g_FailureCount;
+	}
+
+	//A sphere on a plane under one light, the top of the screen looks past both
+	class TestScene final : public Scene
+	{
+	public:
+		void Initialize() override
+		{
+			m_Camera.origin = { 0.f, 1.f, -5.f };
+			m_Camera.fovAngle = 45.f;
+			m_Camera.CalculateCameraToWorld();
+
+			const unsigned char materialIndex{ AddMaterial(new Material_Lambert({ 0.8f, 0.6f, 0.4f }, 1.f)) };
+			AddSphere({ 0.f, 1.f, 0.f }, 1.f, materialIndex);
+			AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, materialIndex);
+			AddPointLight({ 0.f, 5.f, -5.f }, 50.f, { 1.f, 1.f, 1.f });
+		}
+
+		//Stands in for Update, which reads the keyboard and mouse
+		void SetHasChanged(bool hasChanged) { m_HasChanged = hasChanged; }
+	};
+}
+
+namespace dae
+{
+	class RendererTests final
+	{
+	public:
+		static void TestTileChunks(Renderer& renderer);
+		static void TestTileImbalance(Renderer& renderer);
+		static void TestProgressiveAccumulation(Renderer& renderer);
+		static void TestDynamicResolution(Renderer& renderer);
+		static void TestReprojection(Renderer& renderer);
+
+	private:
+		//Every row of render tiles of every screen tile is in exactly one chunk
+		static bool CoversEveryTileRowOnce(const Renderer& renderer);
+		//Every chunk index once, from the cheapest chunk to the most expensive
+		static bool IsChunkOrderSorted(const Renderer& renderer);
+	};
+
+	bool RendererTests::CoversEveryTileRowOnce(const Renderer& renderer)
+	{
+		const uint32_t screenTileCount{ renderer.GetScreenTileCount() };
+		const uint32_t rowsPerScreenTile{ renderer.GetRoundedScreenTileSize() / renderer.GetTileSize() };
+
+		std::vector<uint32_t> rowCounts(size_t(screenTileCount) * rowsPerScreenTile);
+		for (const Renderer::TileChunk& chunk : renderer.m_TileChunks)
+		{
+			if (chunk.screenTileCount == 0 || chunk.rowCount == 0 || chunk.firstRow + chunk.rowCount > rowsPerScreenTile)
+				return false;
+			if (chunk.firstScreenTile + chunk.screenTileCount > screenTileCount)
+				return false;
+
+			for (uint32_t screenTile{ chunk.firstScreenTile }; screenTile < chunk.firstScreenTile + chunk.screenTileCount; ++screenTile)
+			{
+				for (uint32_t row{ chunk.firstRow }; row < chunk.firstRow + chunk.rowCount; ++row)
+					++rowCounts[screenTile * rowsPerScreenTile + row];
+			}
+		}
+
+		return std::all_of(rowCounts.begin(), rowCounts.end(), [](uint32_t count) { return count == 1; });
+	}
+
+	bool RendererTests::IsChunkOrderSorted(const Renderer& renderer)
+	{
+		std::vector<uint32_t> order{ renderer.m_TileChunkOrder };
+		std::sort(order.begin(), order.end());
+		for (uint32_t i{}; i < order.size(); ++i)
+		{
+			if (order[i] != i)
+				return false;
+		}
+
+		return order.size() == renderer.m_TileChunks.size() && std::is_sorted(renderer.m_TileChunkOrder.begin(), renderer.m_TileChunkOrder.end(), [&](uint32_t a, uint32_t b)
+			{
+				return renderer.m_TileChunks[a].predictedCost < renderer.m_TileChunks[b].predictedCost;
+			});
+	}
+
+	void RendererTests::TestTileChunks(Renderer& renderer)
+	{
+		renderer.SetScreenTileSize(32);
+		const uint32_t screenTileCount{ renderer.GetScreenTileCount() };
+		const uint32_t rowsPerScreenTile{ renderer.GetRoundedScreenTileSize() / renderer.GetTileSize() };
+		const uint32_t threadCount{ renderer.GetThreadPool()->GetThreadCount() + 1 };
+
+		//Before any frame is measured every tile costs the same
+		renderer.UpdateTileChunks();
+		Check(renderer.m_TileCosts.size() == screenTileCount && std::all_of(renderer.m_TileCosts.begin(), renderer.m_TileCosts.end(), [](float cost) { return cost == 1.f; }),
+			"UpdateTileChunks starts every tile at the same cost");
+		Check(CoversEveryTileRowOnce(renderer), "UpdateTileChunks covers every tile row once with equal costs");
+		Check(IsChunkOrderSorted(renderer), "UpdateTileChunks orders the chunks by predicted cost with equal costs");
+
+		//One tile costs far more than all the others together: its rows are split over several chunks and the cheap tiles on either side are merged
+		const uint32_t expensiveTile{ screenTileCount / 2 };
+		renderer.m_TileCosts.assign(screenTileCount, 0.01f);
+		renderer.m_TileCosts[expensiveTile] = 1000.f;
+		renderer.UpdateTileChunks();
+
+		const float totalCost{ std::accumulate(renderer.m_TileCosts.begin(), renderer.m_TileCosts.end(), 0.f) };
+		const float targetCost{ totalCost / float(threadCount * Renderer::s_TileChunksPerThread) };
+		const uint32_t expectedPartCount{ std::min(rowsPerScreenTile, uint32_t(std::ceil(1000.f / targetCost))) };
+
+		const std::vector<Renderer::TileChunk>& chunks{ renderer.m_TileChunks };
+		Check(CoversEveryTileRowOnce(renderer), "UpdateTileChunks covers every tile row once after a split");
+		Check(IsChunkOrderSorted(renderer), "UpdateTileChunks orders the chunks by predicted cost after a split");
+		Check(chunks.size() == expectedPartCount + 2, "UpdateTileChunks merges the cheap tiles before and after the expensive one into one chunk each");
+		if (chunks.size() == expectedPartCount + 2)
+		{
+			Check(chunks.front().firstScreenTile == 0 && chunks.front().screenTileCount == expensiveTile && chunks.front().rowCount == rowsPerScreenTile,
+				"A merged chunk covers whole tiles up to the expensive one");
+			Check(chunks.back().firstScreenTile == expensiveTile + 1 && chunks.back().screenTileCount == screenTileCount - expensiveTile - 1,
+				"A merged chunk covers whole tiles after the expensive one");
+
+			float splitCost{};
+			for (uint32_t part{ 1 }; part <= expectedPartCount; ++part)
+			{
+				const Renderer::TileChunk& chunk{ chunks[part] };
+				splitCost += chunk.predictedCost;
+				Check(chunk.firstScreenTile == expensiveTile && chunk.screenTileCount == 1, "The expensive tile is split into chunks of its own");
+				Check(std::abs(chunk.predictedCost - 1000.f * float(chunk.rowCount) / float(rowsPerScreenTile)) <= 1e-3f, "A split part is predicted to cost its share of rows");
+			}
+			Check(std::abs(splitCost - 1000.f) <= 1e-2f, "The parts of a split tile add up to its cost");
+		}
+
+		//Measured parts of a split tile are added back up, the merged tiles keep the costs their chunk measured per tile
+		for (Renderer::TileChunk& chunk : renderer.m_TileChunks)
+			chunk.measuredCost = 2.f;
+		renderer.m_ThreadRenderTimes.assign(1, 2.f * float(chunks.size()));
+		renderer.m_RenderThreadCount = 1;
+		renderer.UpdateTileCosts();
+		Check(renderer.m_TileCosts[expensiveTile] == 2.f * float(expectedPartCount), "UpdateTileCosts adds up the parts of a split tile");
+		Check(renderer.m_TileCosts[0] == 0.01f && renderer.m_TileCosts[screenTileCount - 1] == 0.01f, "UpdateTileCosts leaves the per tile costs of merged chunks alone");
+
+		//Cheap tiles only: merged until a chunk is worth a task, nothing is split
+		renderer.m_TileCosts.assign(screenTileCount, 1.f);
+		renderer.m_TileCosts[expensiveTile] = 0.5f;
+		renderer.UpdateTileChunks();
+		const float cheapTargetCost{ std::accumulate(renderer.m_TileCosts.begin(), renderer.m_TileCosts.end(), 0.f) / float(threadCount * Renderer::s_TileChunksPerThread) };
+		Check(CoversEveryTileRowOnce(renderer), "UpdateTileChunks covers every tile row once with cheap tiles");
+		for (size_t i{}; i + 1 < renderer.m_TileChunks.size(); ++i)
+		{
+			const Renderer::TileChunk& chunk{ renderer.m_TileChunks[i] };
+			if (chunk.rowCount == rowsPerScreenTile)
+				Check(chunk.predictedCost >= cheapTargetCost, "Every merged chunk but the last is worth a task");
+		}
+
+		//Without cost prediction every screen tile is a chunk
+		renderer.ToggleCostPredictiveTiles();
+		renderer.UpdateTileChunks();
+		Check(renderer.m_TileChunks.size() == screenTileCount && CoversEveryTileRowOnce(renderer), "Without cost prediction every screen tile is its own chunk");
+		renderer.ToggleCostPredictiveTiles();
+	}
+
+	void RendererTests::TestTileImbalance(Renderer& renderer)
+	{
+		renderer.UpdateTileChunks();
+
+		//The serial scheduler only ever uses one thread
+		renderer.SetTileScheduler(Renderer::TileScheduler::Serial);
+		renderer.m_ThreadRenderTimes.assign(1, 6.f);
+		renderer.m_RenderThreadCount = 1;
+		renderer.UpdateTileCosts();
+		Check(renderer.GetTileImbalance() == 1.f, "A serial frame is balanced");
+
+		//Work stealing can use every worker and the calling thread, the ones that rendered nothing lower the average
+		const uint32_t threadCount{ std::max(renderer.GetThreadPool()->GetThreadCount() + 1, 2u) };
+		renderer.SetTileScheduler(Renderer::TileScheduler::WorkStealing);
+		renderer.m_ThreadRenderTimes = { 3.f, 1.f };
+		renderer.m_RenderThreadCount = 2;
+		renderer.UpdateTileCosts();
+		const float averageTime{ 4.f / float(threadCount) };
+		Check(std::abs(renderer.GetTileImbalance() - 3.f / averageTime) <= 1e-5f * threadCount, "The imbalance is the slowest thread's time over the average thread's");
+		Check(renderer.m_TileImbalanceFrameCount == 1 && renderer.m_TileImbalanceSum == renderer.GetTileImbalance(), "SetTileScheduler starts the average over");
+
+		renderer.m_ThreadRenderTimes.assign(threadCount, 2.f);
+		renderer.m_RenderThreadCount = threadCount;
+		renderer.UpdateTileCosts();
+		Check(renderer.GetTileImbalance() == 1.f, "Threads that all took as long are balanced");
+
+		//Real frames, every scheduler measures something between perfectly balanced and one thread doing all the work
+		TestScene scene{};
+		scene.SetThreadPool(renderer.GetThreadPool());
+		scene.Initialize();
+		scene.UpdateAccelerationStructure();
+
+		for (Renderer::TileScheduler scheduler : { Renderer::TileScheduler::Serial, Renderer::TileScheduler::WorkStealing, Renderer::TileScheduler::ParallelFor })
+		{
+			renderer.SetTileScheduler(scheduler);
+			renderer.Render(&scene);
+			const float imbalance{ renderer.GetTileImbalance() };
+			Check(imbalance >= 1.f - 1e-5f && imbalance <= float(std::max(renderer.m_RenderThreadCount.load(), std::max(threadCount, std::thread::hardware_concurrency()))) + 1e-3f,
+				"A rendered frame measures an imbalance between 1 and its thread count");
+			Check(renderer.m_TileImbalanceFrameCount == 1, "Every scheduler measures the imbalance of its frames");
+		}
+	}
+
+	void RendererTests::TestProgressiveAccumulation(Renderer& renderer)
+	{
+		TestScene scene{};
+		scene.SetThreadPool(renderer.GetThreadPool());
+		scene.Initialize();
+		scene.UpdateAccelerationStructure();
+		renderer.ToggleProgressive();
+
+		//The first sample of a still image goes through the pixel centers
+		scene.SetHasChanged(true);
+		renderer.Render(&scene);
+		Check(renderer.GetAccumulatedSampleCount() == 1, "A changed scene starts the accumulation over");
+		Check(renderer.m_SampleOffsetX == 0.5f && renderer.m_SampleOffsetY == 0.5f, "The first sample goes through the pixel centers");
+		const std::vector<ColorRGB> firstSamples{ renderer.m_AccumulationBuffer };
+
+		//Every next frame of a still camera adds the next Halton point, shifted by half a pixel
+		scene.SetHasChanged(false);
+		constexpr uint32_t stillFrameCount{ 12 };
+		for (uint32_t sampleIndex{ 1 }; sampleIndex <= stillFrameCount; ++sampleIndex)
+		{
+			renderer.Render(&scene);
+			Check(renderer.GetAccumulatedSampleCount() == sampleIndex + 1, "A still frame adds a sample");
+			Check(renderer.m_SampleOffsetX == std::fmod(0.5f + RadicalInverse(sampleIndex, 2), 1.f) && renderer.m_SampleOffsetY == std::fmod(0.5f + RadicalInverse(sampleIndex, 3), 1.f),
+				"A still frame samples the next Halton point");
+			Check(renderer.m_SampleOffsetX >= 0.f && renderer.m_SampleOffsetX < 1.f && renderer.m_SampleOffsetY >= 0.f && renderer.m_SampleOffsetY < 1.f,
+				"A sample stays inside its pixel");
+		}
+
+		//Moving throws every sample away, the sums start from this frame's colors alone
+		scene.SetHasChanged(true);
+		renderer.Render(&scene);
+		Check(renderer.GetAccumulatedSampleCount() == 1 && renderer.m_SampleOffsetX == 0.5f && renderer.m_SampleOffsetY == 0.5f, "Moving starts the accumulation over");
+		Check(std::equal(firstSamples.begin(), firstSamples.end(), renderer.m_AccumulationBuffer.begin(), renderer.m_AccumulationBuffer.end(),
+			[](const ColorRGB& a, const ColorRGB& b) { return a.r == b.r && a.g == b.g && a.b == b.b; }), "Moving throws the accumulated samples away");
+
+		//Another scene does too, even when it did not change
+		TestScene otherScene{};
+		otherScene.SetThreadPool(renderer.GetThreadPool());
+		otherScene.Initialize();
+		otherScene.UpdateAccelerationStructure();
+		otherScene.SetHasChanged(false);
+		scene.SetHasChanged(false);
+		renderer.Render(&scene);
+		renderer.Render(&otherScene);
+		Check(renderer.GetAccumulatedSampleCount() == 1, "Another scene starts the accumulation over");
+
+		//A converged image is kept as it is
+		otherScene.SetHasChanged(false);
+		renderer.m_AccumulatedSampleCount = Renderer::s_MaxAccumulatedSamples;
+		renderer.Render(&otherScene);
+		Check(renderer.GetAccumulatedSampleCount() == Renderer::s_MaxAccumulatedSamples, "A converged image takes no more samples");
+
+		//Settings that change the image start over too
+		renderer.ToggleShadows();
+		Check(renderer.GetAccumulatedSampleCount() == 0, "Toggling shadows starts the accumulation over");
+		renderer.ToggleShadows();
+	}
+
+	void RendererTests::TestDynamicResolution(Renderer& renderer)
+	{
+		constexpr float targetFrameTime{ 20.f };
+		renderer.SetTargetFrameTime(targetFrameTime);
+
+		//Turned off the frame times are ignored
+		renderer.UpdateResolutionScale(1.f);
+		Check(renderer.GetResolutionScale() == 1.f, "Without dynamic resolution the frame renders at window resolution");
+
+		//Frames just inside the band above the target never lower the resolution
+		renderer.ToggleDynamicResolution();
+		const float slowFrameSeconds{ targetFrameTime * Renderer::s_ResolutionDownThreshold * 0.999f / 1000.f };
+		for (int frame{}; frame < 100; ++frame)
+			renderer.UpdateResolutionScale(slowFrameSeconds);
+		Check(renderer.m_ResolutionLevel == Renderer::s_ResolutionLevelCount, "Frames under the down threshold keep the resolution");
+
+		//One slow frame drops it, then it holds for the settle frames even when the frames get fast enough to go back up
+		renderer.UpdateResolutionScale(2.f * targetFrameTime / 1000.f);
+		const uint32_t droppedLevel{ renderer.m_ResolutionLevel };
+		Check(droppedLevel < Renderer::s_ResolutionLevelCount && droppedLevel >= Renderer::s_MinResolutionLevel, "A frame over the down threshold lowers the resolution");
+
+		const float fastFrameSeconds{ 1.f / 1000.f };
+		for (uint32_t frame{}; frame < Renderer::s_ResolutionSettleFrames; ++frame)
+			renderer.UpdateResolutionScale(fastFrameSeconds);
+		Check(renderer.m_ResolutionLevel == droppedLevel, "The resolution holds for the settle frames after a change");
+		renderer.UpdateResolutionScale(fastFrameSeconds);
+		Check(renderer.m_ResolutionLevel == droppedLevel + 1, "After the settle frames fast frames raise the resolution one step");
+
+		//A still renders at window resolution, its frame time says nothing about the frames in motion
+		const uint32_t movingLevel{ renderer.m_ResolutionLevel };
+		renderer.m_IsRenderingStill = true;
+		for (int frame{}; frame < 20; ++frame)
+			renderer.UpdateResolutionScale(1.f);
+		Check(renderer.m_ResolutionLevel == movingLevel, "Frame times of stills leave the resolution alone");
+		renderer.m_IsRenderingStill = false;
+
+		//Frames that cost the square of the level: whatever the cost of a full resolution frame, the level settles and stays there
+		for (float fullFrameTime{ 2.f }; fullFrameTime <= 200.f; fullFrameTime *= 1.1f)
+		{
+			renderer.m_ResolutionLevel = Renderer::s_ResolutionLevelCount;
+			renderer.m_ResolutionSettleCount = 0;
+			renderer.m_SmoothedFrameTime = 0.f;
+
+			const auto GetFrameSeconds = [&]
+				{
+					const float scale{ renderer.GetResolutionScale() };
+					return fullFrameTime * scale * scale / 1000.f;
+				};
+
+			for (int frame{}; frame < 200; ++frame)
+				renderer.UpdateResolutionScale(GetFrameSeconds());
+
+			const uint32_t settledLevel{ renderer.m_ResolutionLevel };
+			uint32_t changeCount{};
+			for (int frame{}; frame < 200; ++frame)
+			{
+				renderer.UpdateResolutionScale(GetFrameSeconds());
+				changeCount += renderer.m_ResolutionLevel != settledLevel;
+			}
+			Check(changeCount == 0, "The resolution does not oscillate around the thresholds");
+
+			const float settledFrameTime{ GetFrameSeconds() * 1000.f };
+			Check(settledFrameTime <= targetFrameTime * Renderer::s_ResolutionDownThreshold || settledLevel == Renderer::s_MinResolutionLevel,
+				"The settled resolution is within the frame budget unless it is the lowest");
+			const float nextScale{ float(settledLevel + 1) / float(Renderer::s_ResolutionLevelCount) };
+			Check(settledLevel == Renderer::s_ResolutionLevelCount || fullFrameTime * nextScale * nextScale >= targetFrameTime * Renderer::s_ResolutionUpThreshold,
+				"The settled resolution is the highest that stays under the up threshold");
+		}
+
+		renderer.ToggleDynamicResolution();
+		renderer.UpdateResolutionScale(1.f);
+		Check(renderer.GetResolutionScale() == 1.f, "Turning dynamic resolution off goes back to window resolution");
+	}
+
+	void RendererTests::TestReprojection(Renderer& renderer)
+	{
+		const uint32_t width{ uint32_t(renderer.m_Width) };
+		const uint32_t height{ uint32_t(renderer.m_Height) };
+		const float aspectRatio{ float(renderer.m_WindowWidth) / float(renderer.m_WindowHeight) };
+		const size_t pixelCount{ size_t(width) * height };
+
+		//The identity camera and one that is moved and turned
+		Camera identityCamera{};
+		identityCamera.CalculateCameraToWorld();
+		Camera turnedCamera{ { 1.f, 2.f, -3.f }, 60.f };
+		turnedCamera.forward = Vector3{ 0.3f, -0.2f, 1.f }.Normalized();
+		turnedCamera.CalculateCameraToWorld();
+
+		for (const Camera* pCamera : { &identityCamera, &turnedCamera })
+		{
+			const Camera& camera{ *pCamera };
+			const float fov{ tanf(PI / 180.f * camera.fovAngle / 2.f) };
+
+			//The camera did not move since the previous frame, set up the way ReconstructCheckerboard leaves it
+			renderer.m_PreviousFov = fov;
+			renderer.m_PreviousCameraOrigin = camera.origin;
+			renderer.m_PreviousWorldToCamera = Matrix::Inverse(camera.cameraToWorld);
+
+			//Points at any depth along a pixel's ray, and the ray direction of a miss, land on that pixel's center
+			bool isEveryPixelProjectedToItself{ true };
+			for (uint32_t py{}; py < height; ++py)
+			{
+				for (uint32_t px{}; px < width; ++px)
+				{
+					const Vector3 rayDirection{ renderer.GetPrimaryRayDirection(px, py, fov, aspectRatio, camera) };
+					for (float depth : { 0.5f, 3.f, 40.f, FLT_MAX })
+					{
+						const bool isMiss{ depth == FLT_MAX };
+						float rasterX{};
+						float rasterY{};
+						const bool isOnScreen{ renderer.ProjectToPreviousFrame(isMiss ? rayDirection : camera.origin + depth * rayDirection, isMiss, aspectRatio, rasterX, rasterY) };
+						isEveryPixelProjectedToItself &= isOnScreen && std::abs(rasterX - (float(px) + 0.5f)) <= 1e-2f && std::abs(rasterY - (float(py) + 0.5f)) <= 1e-2f;
+					}
+				}
+			}
+			Check(isEveryPixelProjectedToItself, "With an unchanged camera every pixel projects to its own center in the previous frame");
+
+			const Vector3 behind{ camera.origin - camera.forward };
+			float rasterX{};
+			float rasterY{};
+			Check(!renderer.ProjectToPreviousFrame(behind, false, aspectRatio, rasterX, rasterY), "A point behind the previous camera is not on its screen");
+
+			//Every pixel has its own history color, the traced pixels around it span black to white, so the result tells history and interpolation apart
+			renderer.m_PreviousColors.resize(pixelCount);
+			renderer.m_CheckerboardColors.resize(pixelCount);
+			for (uint32_t py{}; py < height; ++py)
+			{
+				for (uint32_t px{}; px < width; ++px)
+				{
+					const float value{ 0.1f + 0.8f * float((px * 7 + py * 13) % 17) / 16.f };
+					renderer.m_PreviousColors[px + py * width] = { value, 1.f - value, 0.5f * value };
+					const float traced{ float(px % 2) };
+					renderer.m_CheckerboardColors[px + py * width] = { traced, traced, traced };
+				}
+			}
+
+			for (float depth : { 3.f, FLT_MAX })
+			{
+				renderer.m_PreviousDepths.assign(pixelCount, depth);
+				renderer.m_CheckerboardDepths.assign(pixelCount, depth);
+				const std::vector<ColorRGB> tracedColors{ renderer.m_CheckerboardColors };
+
+				bool isEveryPixelRebuiltFromItself{ true };
+				for (uint32_t py{ 1 }; py + 1 < height; ++py)
+				{
+					for (uint32_t px{ 1 }; px + 1 < width; ++px)
+					{
+						const uint32_t pixelIndex{ px + py * width };
+						renderer.ReconstructPixel(px, py, camera, fov, aspectRatio, true);
+
+						const ColorRGB& rebuilt{ renderer.m_CheckerboardColors[pixelIndex] };
+						const ColorRGB& previous{ renderer.m_PreviousColors[pixelIndex] };
+						isEveryPixelRebuiltFromItself &= std::abs(rebuilt.r - previous.r) <= 1e-3f && std::abs(rebuilt.g - previous.g) <= 1e-3f && std::abs(rebuilt.b - previous.b) <= 1e-3f;
+						isEveryPixelRebuiltFromItself &= renderer.m_CheckerboardDepths[pixelIndex] == depth;
+
+						//The next pixel has to see the traced colors around it, not this rebuilt one
+						renderer.m_CheckerboardColors[pixelIndex] = tracedColors[pixelIndex];
+					}
+				}
+				Check(isEveryPixelRebuiltFromItself, depth == FLT_MAX ? "With an unchanged camera a missed pixel is rebuilt from its own history" : "With an unchanged camera a hit pixel is rebuilt from its own history");
+			}
+		}
+	}
+}
+
+int main(int argc, char* args[])
+{
+	(void)argc;
+	(void)args;
+
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* pWindow{ SDL_CreateWindow("RendererTests", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_HIDDEN) };
+	if (!pWindow)
+	{
+		printf("Could not create a window: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	//A new renderer for every test, none of them sees the state another one left behind
+	for (void (*pTest)(Renderer&) : { &RendererTests::TestTileChunks, &RendererTests::TestTileImbalance, &RendererTests::TestProgressiveAccumulation, &RendererTests::TestDynamicResolution, &RendererTests::TestReprojection })
+	{
+		Renderer renderer{ pWindow };
+		pTest(renderer);
+	}
+
+	SDL_DestroyWindow(pWindow);
+	SDL_Quit();
+
+	if (g_FailureCount > 0)
+	{
+		printf("%d checks failed\n", g_FailureCount);
+		return 1;
+	}
+
+	printf("All renderer checks passed\n");
+	return 0;
+}
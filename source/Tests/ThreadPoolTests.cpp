@@ -0,0 +1,173 @@
+//Checks the thread pool and the chunk helpers built on it.
+//Every test runs with pools of a few sizes, a pool of one worker is where a Wait that does not run tasks itself would deadlock.
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "ThreadPool.h"
+
+using namespace dae;
+
+namespace
+{
+	constexpr uint32_t THREAD_COUNTS[]{ 1, 2, 4 };
+
+	int g_FailureCount{};
+
+	void Check(bool condition, const char* pName, uint32_t threadCount)
+	{
+		if (condition)
+			return;
+
+		if (g_FailureCount < 20)
+			printf("FAILED: %s (%u threads)\n", pName, threadCount);
+		++g_FailureCount;
+	}
+
+	//Tasks that wait for tasks that wait for tasks, more of them than there are workers, so every worker ends up blocked in Wait
+	void TestNestedWaits(ThreadPool& pool, uint32_t threadCount)
+	{
+		constexpr uint32_t outerCount{ 32 };
+		constexpr uint32_t innerCount{ 8 };
+
+		std::atomic<uint32_t> leafCount{};
+		std::atomic<uint32_t> innerDoneCount{};
+		std::atomic<uint32_t> outerDoneCount{};
+
+		TaskGroup outerTasks{};
+		for (uint32_t i{}; i < outerCount; ++i)
+		{
+			pool.Run(outerTasks, [&]
+				{
+					TaskGroup innerTasks{};
+					for (uint32_t j{}; j < innerCount; ++j)
+					{
+						pool.Run(innerTasks, [&]
+							{
+								TaskGroup leafTasks{};
+								pool.Run(leafTasks, [&] { ++leafCount; });
+								pool.Wait(leafTasks);
+								++innerDoneCount;
+							});
+					}
+
+					pool.Wait(innerTasks);
+					Check(innerTasks.IsDone(), "Nested Wait returns once its group is done", threadCount);
+					++outerDoneCount;
+				});
+		}
+
+		pool.Wait(outerTasks);
+		Check(outerTasks.IsDone(), "Wait returns once its group is done", threadCount);
+		Check(outerDoneCount == outerCount, "Every outer task ran once", threadCount);
+		Check(innerDoneCount == outerCount * innerCount, "Every inner task ran once", threadCount);
+		Check(leafCount == outerCount * innerCount, "Every leaf task ran once", threadCount);
+	}
+
+	//Tasks of one group queued by tasks of another, Wait on the second group must not return early
+	void TestTasksQueuingOtherGroups(ThreadPool& pool, uint32_t threadCount)
+	{
+		constexpr uint32_t taskCount{ 64 };
+
+		std::atomic<uint32_t> spawnedCount{};
+		TaskGroup spawnedTasks{};
+		TaskGroup spawningTasks{};
+		for (uint32_t i{}; i < taskCount; ++i)
+		{
+			pool.Run(spawningTasks, [&]
+				{
+					pool.Run(spawnedTasks, [&] { ++spawnedCount; });
+				});
+		}
+
+		pool.Wait(spawningTasks);
+		pool.Wait(spawnedTasks);
+		Check(spawnedCount == taskCount, "Tasks queued into another group all ran before its Wait returned", threadCount);
+	}
+
+	void TestForEachChunk(ThreadPool* pPool, uint32_t threadCount)
+	{
+		constexpr uint32_t counts[]{ 0, 1, 63, 64, 65, 1000, 4097 };
+		constexpr uint32_t chunkSizes[]{ 1, 64, 1000 };
+
+		for (uint32_t count : counts)
+		{
+			for (uint32_t chunkSize : chunkSizes)
+			{
+				std::vector<std::atomic<uint32_t>> visitCounts(count);
+				std::atomic<bool> isChunkConsistent{ true };
+				std::atomic<uint32_t> chunkCount{};
+
+				ForEachChunk(pPool, count, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+					{
+						if (begin != chunkIndex * chunkSize || end <= begin || end - begin > chunkSize)
+							isChunkConsistent = false;
+
+						for (uint32_t i{ begin }; i < end; ++i)
+							++visitCounts[i];
+						++chunkCount;
+					});
+
+				bool isEveryIndexVisitedOnce{ true };
+				for (const std::atomic<uint32_t>& visitCount : visitCounts)
+					isEveryIndexVisitedOnce &= visitCount == 1;
+
+				Check(isEveryIndexVisitedOnce, "ForEachChunk visits every index exactly once", threadCount);
+				Check(isChunkConsistent, "ForEachChunk chunks start at chunkIndex * chunkSize and are at most chunkSize long", threadCount);
+				Check(chunkCount == (count + chunkSize - 1) / chunkSize, "ForEachChunk calls the function once per chunk", threadCount);
+			}
+		}
+	}
+
+	void TestReduceChunks(ThreadPool* pPool, uint32_t threadCount)
+	{
+		constexpr uint32_t counts[]{ 0, 1, 63, 64, 65, 1000, 4097 };
+		constexpr uint32_t chunkSize{ 64 };
+
+		for (uint32_t count : counts)
+		{
+			//Merged in chunk order, so the indices come out sorted when every chunk appends its own
+			const std::vector<uint32_t> indices{ ReduceChunks<std::vector<uint32_t>>(pPool, count, chunkSize,
+				[](uint32_t begin, uint32_t end, std::vector<uint32_t>& chunkIndices)
+				{
+					for (uint32_t i{ begin }; i < end; ++i)
+						chunkIndices.push_back(i);
+				},
+				[](std::vector<uint32_t>& result, const std::vector<uint32_t>& chunkIndices)
+				{
+					result.insert(result.end(), chunkIndices.begin(), chunkIndices.end());
+				}) };
+
+			bool isEveryIndexInOrder{ indices.size() == count };
+			for (uint32_t i{}; isEveryIndexInOrder && i < count; ++i)
+				isEveryIndexInOrder = indices[i] == i;
+
+			Check(isEveryIndexInOrder, "ReduceChunks accumulates every index exactly once and merges in chunk order", threadCount);
+		}
+	}
+}
+
+int main()
+{
+	TestForEachChunk(nullptr, 0);
+	TestReduceChunks(nullptr, 0);
+
+	for (uint32_t threadCount : THREAD_COUNTS)
+	{
+		ThreadPool pool{ threadCount };
+		TestNestedWaits(pool, threadCount);
+		TestTasksQueuingOtherGroups(pool, threadCount);
+		TestForEachChunk(&pool, threadCount);
+		TestReduceChunks(&pool, threadCount);
+	}
+
+	if (g_FailureCount > 0)
+	{
+		printf("%d checks failed\n", g_FailureCount);
+		return 1;
+	}
+
+	printf("All thread pool checks passed\n");
+	return 0;
+}
@@ -0,0 +1,185 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace dae
+{
+	namespace
+	{
+		//Set on the worker threads only, a worker never outlives its pool
+		thread_local const ThreadPool* pWorkerPool{};
+		thread_local uint32_t workerIndex{ UINT32_MAX };
+	}
+
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		//hardware_concurrency may report 0 when it cannot tell
+		threadCount = std::max(threadCount, 1u);
+
+		m_Queues.reserve(threadCount);
+		for (uint32_t i{}; i < threadCount; ++i)
+		{
+			m_Queues.emplace_back(std::make_unique<WorkerQueue>());
+		}
+
+		m_Threads.reserve(threadCount);
+		for (uint32_t i{}; i < threadCount; ++i)
+		{
+			m_Threads.emplace_back([this, i] { WorkerLoop(i); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard lock{ m_SleepMutex };
+			m_IsStopping = true;
+		}
+		m_TaskAvailable.notify_all();
+
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	void ThreadPool::Run(TaskGroup& group, std::function<void()> task)
+	{
+		group.m_PendingCount.fetch_add(1, std::memory_order_relaxed);
+
+		uint32_t queueIndex{ GetWorkerIndex() };
+		if (queueIndex == UINT32_MAX)
+			queueIndex = m_NextQueueIndex.fetch_add(1, std::memory_order_relaxed) % static_cast<uint32_t>(m_Queues.size());
+
+		{
+			WorkerQueue& queue{ *m_Queues[queueIndex] };
+			std::lock_guard lock{ queue.mutex };
+			queue.tasks.push_back({ std::move(task), &group });
+		}
+		m_QueuedCount.fetch_add(1, std::memory_order_release);
+
+		//Taking the lock orders the count against a worker that is about to sleep, so the wake up cannot get lost
+		{
+			std::lock_guard lock{ m_SleepMutex };
+		}
+		m_TaskAvailable.notify_one();
+	}
+
+	void ThreadPool::Wait(TaskGroup& group)
+	{
+		const uint32_t index{ GetWorkerIndex() };
+		uint32_t spinCount{};
+		while (!group.IsDone())
+		{
+			if (TryRunTask(index))
+			{
+				spinCount = 0;
+				continue;
+			}
+
+			//The remaining tasks run on other threads
+			if (spinCount < s_WaitSpinCount)
+			{
+				++spinCount;
+				std::this_thread::yield();
+				continue;
+			}
+
+			//A queued task wakes this thread too, otherwise every worker could end up blocked here with work left in the deques
+			std::unique_lock lock{ m_SleepMutex };
+			m_TaskAvailable.wait(lock, [this, &group] { return group.IsDone() || m_QueuedCount.load(std::memory_order_acquire) > 0; });
+			spinCount = 0;
+		}
+	}
+
+	uint32_t ThreadPool::GetWorkerIndex() const
+	{
+		return (pWorkerPool == this) ? workerIndex : UINT32_MAX;
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t index)
+	{
+		pWorkerPool = this;
+		workerIndex = index;
+
+		while (true)
+		{
+			if (TryRunTask(index))
+				continue;
+
+			std::unique_lock lock{ m_SleepMutex };
+			m_TaskAvailable.wait(lock, [this] { return m_IsStopping || m_QueuedCount.load(std::memory_order_acquire) > 0; });
+
+			if (m_IsStopping && m_QueuedCount.load(std::memory_order_acquire) == 0)
+				return;
+		}
+	}
+
+	bool ThreadPool::TryRunTask(uint32_t index)
+	{
+		Task task{};
+		if (!TryPopTask(index, task))
+			return false;
+
+		RunTask(task);
+		return true;
+	}
+
+	bool ThreadPool::TryPopTask(uint32_t index, Task& task)
+	{
+		if (m_QueuedCount.load(std::memory_order_acquire) == 0)
+			return false;
+
+		const uint32_t queueCount{ static_cast<uint32_t>(m_Queues.size()) };
+
+		//Newest task of the own deque first, its data is most likely still in this core's cache
+		if (index != UINT32_MAX)
+		{
+			WorkerQueue& queue{ *m_Queues[index] };
+			std::lock_guard lock{ queue.mutex };
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				m_QueuedCount.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+
+		//Then the oldest task of another deque, starting at the next worker so thieves spread over the victims
+		const uint32_t firstVictim{ (index == UINT32_MAX) ? 0 : index + 1 };
+		for (uint32_t i{}; i < queueCount; ++i)
+		{
+			const uint32_t victim{ (firstVictim + i) % queueCount };
+			if (victim == index)
+				continue;
+
+			WorkerQueue& queue{ *m_Queues[victim] };
+			std::lock_guard lock{ queue.mutex };
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				m_QueuedCount.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void ThreadPool::RunTask(Task& task)
+	{
+		task.function();
+
+		//The waiter may destroy the group as soon as the count reaches zero, so only the pool is touched afterwards
+		if (task.pGroup->m_PendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		//Same lock as in Run, a Wait that is about to block cannot miss the last task finishing
+		{
+			std::lock_guard lock{ m_SleepMutex };
+		}
+		m_TaskAvailable.notify_all();
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	//Counts the unfinished tasks of one batch, ThreadPool::Wait returns once it reaches zero
+	class TaskGroup final
+	{
+	public:
+		TaskGroup() = default;
+		~TaskGroup() = default;
+
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup(TaskGroup&&) noexcept = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+		TaskGroup& operator=(TaskGroup&&) noexcept = delete;
+
+		bool IsDone() const { return m_PendingCount.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class ThreadPool;
+		std::atomic<uint32_t> m_PendingCount{};
+	};
+
+	//Worker threads are created once and live as long as the pool
+	//Every worker has its own deque: it runs the newest task of its own deque first and steals the oldest task of another worker when its own is empty
+	class ThreadPool final
+	{
+	public:
+		explicit ThreadPool(uint32_t threadCount = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		//Queues a task, tasks may queue more tasks in the same or another group
+		//A worker queues on its own deque, other threads spread their tasks over the workers in turn
+		void Run(TaskGroup& group, std::function<void()> task);
+
+		//Runs queued tasks on the calling thread until every task of the group finished, so it is safe to call from inside a task
+		//Once there is nothing left to run it spins briefly, then sleeps until the group finishes or another task is queued
+		void Wait(TaskGroup& group);
+
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_Threads.size()); }
+
+		//Index of the calling thread's deque, UINT32_MAX when it is not a worker of this pool
+		uint32_t GetWorkerIndex() const;
+
+	private:
+		struct Task
+		{
+			std::function<void()> function{};
+			TaskGroup* pGroup{};
+		};
+
+		struct WorkerQueue
+		{
+			std::mutex mutex{};
+			std::deque<Task> tasks{};
+		};
+
+		std::vector<std::thread> m_Threads{};
+		std::vector<std::unique_ptr<WorkerQueue>> m_Queues{};
+
+		//Tasks in all deques together, workers sleep while it is zero
+		std::atomic<uint32_t> m_QueuedCount{};
+		std::atomic<uint32_t> m_NextQueueIndex{};
+
+		//Idle workers and blocked Wait calls sleep on the same condition variable
+		std::mutex m_SleepMutex{};
+		std::condition_variable m_TaskAvailable{};
+		bool m_IsStopping{ false };
+
+		//Yields in Wait before it blocks, the last tasks of a group usually finish within a few time slices
+		static constexpr uint32_t s_WaitSpinCount{ 64 };
+
+		void WorkerLoop(uint32_t workerIndex);
+		bool TryRunTask(uint32_t workerIndex);
+		bool TryPopTask(uint32_t workerIndex, Task& task);
+		void RunTask(Task& task);
+	};
+
+	//Calls function(begin, end, chunkIndex) for every chunk of [0, count), spread over the thread pool when there is one
+	template<typename Function>
+	void ForEachChunk(ThreadPool* pThreadPool, uint32_t count, uint32_t chunkSize, Function&& function)
+	{
+		const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+
+		if (!pThreadPool || chunkCount <= 1)
+		{
+			for (uint32_t chunkIndex{}; chunkIndex < chunkCount; ++chunkIndex)
+				function(chunkIndex * chunkSize, std::min(count, (chunkIndex + 1) * chunkSize), chunkIndex);
+			return;
+		}
+
+		TaskGroup chunkTasks{};
+		for (uint32_t chunkIndex{}; chunkIndex < chunkCount; ++chunkIndex)
+		{
+			pThreadPool->Run(chunkTasks, [&function, chunkIndex, count, chunkSize]
+				{
+					function(chunkIndex * chunkSize, std::min(count, (chunkIndex + 1) * chunkSize), chunkIndex);
+				});
+		}
+		pThreadPool->Wait(chunkTasks);
+	}
+
+	//Every chunk accumulates into its own Result, which are merged in chunk order afterwards
+	template<typename Result, typename Accumulate, typename Merge>
+	Result ReduceChunks(ThreadPool* pThreadPool, uint32_t count, uint32_t chunkSize, Accumulate&& accumulate, Merge&& merge)
+	{
+		Result result{};
+
+		const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+		if (chunkCount <= 1)
+		{
+			accumulate(0u, count, result);
+			return result;
+		}
+
+		std::vector<Result> chunkResults(chunkCount);
+		ForEachChunk(pThreadPool, count, chunkSize, [&](uint32_t begin, uint32_t end, uint32_t chunkIndex)
+			{
+				accumulate(begin, end, chunkResults[chunkIndex]);
+			});
+
+		for (const Result& chunkResult : chunkResults)
+			merge(result, chunkResult);
+
+		return result;
+	}
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+#include "Math.h"
+#include "SIMD.h"
+#include "ThreadPool.h"
+
+namespace dae
+{
+#pragma region Transformed Bounds
+	//Grows bounds by points transformed with a matrix, without storing the transformed points
+	//Every path does the multiply-adds of Matrix::TransformPoint in the same order, so the bounds match transforming the points one by one
+	inline void GrowTransformedBounds_Scalar(const Matrix& transform, const Vector3* pPoints, uint32_t count, AABB& bounds)
+	{
+		for (uint32_t i{}; i < count; ++i)
+		{
+			bounds.Grow(transform.TransformPoint(pPoints[i]));
+		}
+	}
+
+#if defined(DAE_SSE)
+	//Splits 4 packed xyz points into one register per component
+	inline void LoadPoints_4(const Vector3* pPoints, __m128& x, __m128& y, __m128& z)
+	{
+		const float* pFloats{ &pPoints->x };
+		const __m128 x0y0z0x1{ _mm_loadu_ps(pFloats) };
+		const __m128 y1z1x2y2{ _mm_loadu_ps(pFloats + 4) };
+		const __m128 z2x3y3z3{ _mm_loadu_ps(pFloats + 8) };
+
+		const __m128 x2y2x3y3{ _mm_shuffle_ps(y1z1x2y2, z2x3y3z3, _MM_SHUFFLE(2, 1, 3, 2)) };
+		const __m128 y0z0y1z1{ _mm_shuffle_ps(x0y0z0x1, y1z1x2y2, _MM_SHUFFLE(1, 0, 2, 1)) };
+		x = _mm_shuffle_ps(x0y0z0x1, x2y2x3y3, _MM_SHUFFLE(2, 0, 3, 0));
+		y = _mm_shuffle_ps(y0z0y1z1, x2y2x3y3, _MM_SHUFFLE(3, 1, 2, 0));
+		z = _mm_shuffle_ps(y0z0y1z1, z2x3y3z3, _MM_SHUFFLE(3, 0, 3, 1));
+	}
+
+	inline void GrowTransformedBounds_4(const Matrix& transform, const Vector3* pPoints, uint32_t count, AABB& bounds)
+	{
+		const Vector4 row0{ transform[0] };
+		const Vector4 row1{ transform[1] };
+		const Vector4 row2{ transform[2] };
+		const Vector4 row3{ transform[3] };
+
+		__m128 minX{ _mm_set1_ps(bounds.minAABB.x) };
+		__m128 minY{ _mm_set1_ps(bounds.minAABB.y) };
+		__m128 minZ{ _mm_set1_ps(bounds.minAABB.z) };
+		__m128 maxX{ _mm_set1_ps(bounds.maxAABB.x) };
+		__m128 maxY{ _mm_set1_ps(bounds.maxAABB.y) };
+		__m128 maxZ{ _mm_set1_ps(bounds.maxAABB.z) };
+
+		uint32_t i{};
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x, y, z;
+			LoadPoints_4(pPoints + i, x, y, z);
+
+			const __m128 tX{ _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row0.x), x), _mm_mul_ps(_mm_set1_ps(row1.x), y)), _mm_mul_ps(_mm_set1_ps(row2.x), z)), _mm_set1_ps(row3.x)) };
+			const __m128 tY{ _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row0.y), x), _mm_mul_ps(_mm_set1_ps(row1.y), y)), _mm_mul_ps(_mm_set1_ps(row2.y), z)), _mm_set1_ps(row3.y)) };
+			const __m128 tZ{ _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row0.z), x), _mm_mul_ps(_mm_set1_ps(row1.z), y)), _mm_mul_ps(_mm_set1_ps(row2.z), z)), _mm_set1_ps(row3.z)) };
+
+			minX = _mm_min_ps(minX, tX);
+			minY = _mm_min_ps(minY, tY);
+			minZ = _mm_min_ps(minZ, tZ);
+			maxX = _mm_max_ps(maxX, tX);
+			maxY = _mm_max_ps(maxY, tY);
+			maxZ = _mm_max_ps(maxZ, tZ);
+		}
+
+		alignas(16) float lanes[6][4];
+		_mm_store_ps(lanes[0], minX);
+		_mm_store_ps(lanes[1], minY);
+		_mm_store_ps(lanes[2], minZ);
+		_mm_store_ps(lanes[3], maxX);
+		_mm_store_ps(lanes[4], maxY);
+		_mm_store_ps(lanes[5], maxZ);
+		for (uint32_t lane{}; lane < 4; ++lane)
+		{
+			AABB laneBounds{};
+			laneBounds.minAABB = Vector3{ lanes[0][lane], lanes[1][lane], lanes[2][lane] };
+			laneBounds.maxAABB = Vector3{ lanes[3][lane], lanes[4][lane], lanes[5][lane] };
+			bounds.Grow(laneBounds);
+		}
+
+		GrowTransformedBounds_Scalar(transform, pPoints + i, count - i, bounds);
+	}
+#endif
+
+#if defined(DAE_AVX2)
+	inline void GrowTransformedBounds_8(const Matrix& transform, const Vector3* pPoints, uint32_t count, AABB& bounds)
+	{
+		const Vector4 row0{ transform[0] };
+		const Vector4 row1{ transform[1] };
+		const Vector4 row2{ transform[2] };
+		const Vector4 row3{ transform[3] };
+
+		__m256 minX{ _mm256_set1_ps(bounds.minAABB.x) };
+		__m256 minY{ _mm256_set1_ps(bounds.minAABB.y) };
+		__m256 minZ{ _mm256_set1_ps(bounds.minAABB.z) };
+		__m256 maxX{ _mm256_set1_ps(bounds.maxAABB.x) };
+		__m256 maxY{ _mm256_set1_ps(bounds.maxAABB.y) };
+		__m256 maxZ{ _mm256_set1_ps(bounds.maxAABB.z) };
+
+		uint32_t i{};
+		for (; i + 8 <= count; i += 8)
+		{
+			//Points 0-3 go in the lower half and 4-7 in the upper half, then both halves split like LoadPoints_4
+			const float* pFloats{ &pPoints[i].x };
+			const __m256 x0y0z0x1{ _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pFloats)), _mm_loadu_ps(pFloats + 12), 1) };
+			const __m256 y1z1x2y2{ _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pFloats + 4)), _mm_loadu_ps(pFloats + 16), 1) };
+			const __m256 z2x3y3z3{ _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pFloats + 8)), _mm_loadu_ps(pFloats + 20), 1) };
+
+			const __m256 x2y2x3y3{ _mm256_shuffle_ps(y1z1x2y2, z2x3y3z3, _MM_SHUFFLE(2, 1, 3, 2)) };
+			const __m256 y0z0y1z1{ _mm256_shuffle_ps(x0y0z0x1, y1z1x2y2, _MM_SHUFFLE(1, 0, 2, 1)) };
+			const __m256 x{ _mm256_shuffle_ps(x0y0z0x1, x2y2x3y3, _MM_SHUFFLE(2, 0, 3, 0)) };
+			const __m256 y{ _mm256_shuffle_ps(y0z0y1z1, x2y2x3y3, _MM_SHUFFLE(3, 1, 2, 0)) };
+			const __m256 z{ _mm256_shuffle_ps(y0z0y1z1, z2x3y3z3, _MM_SHUFFLE(3, 0, 3, 1)) };
+
+			const __m256 tX{ _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(row0.x), x), _mm256_mul_ps(_mm256_set1_ps(row1.x), y)), _mm256_mul_ps(_mm256_set1_ps(row2.x), z)), _mm256_set1_ps(row3.x)) };
+			const __m256 tY{ _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(row0.y), x), _mm256_mul_ps(_mm256_set1_ps(row1.y), y)), _mm256_mul_ps(_mm256_set1_ps(row2.y), z)), _mm256_set1_ps(row3.y)) };
+			const __m256 tZ{ _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(row0.z), x), _mm256_mul_ps(_mm256_set1_ps(row1.z), y)), _mm256_mul_ps(_mm256_set1_ps(row2.z), z)), _mm256_set1_ps(row3.z)) };
+
+			minX = _mm256_min_ps(minX, tX);
+			minY = _mm256_min_ps(minY, tY);
+			minZ = _mm256_min_ps(minZ, tZ);
+			maxX = _mm256_max_ps(maxX, tX);
+			maxY = _mm256_max_ps(maxY, tY);
+			maxZ = _mm256_max_ps(maxZ, tZ);
+		}
+
+		alignas(32) float lanes[6][8];
+		_mm256_store_ps(lanes[0], minX);
+		_mm256_store_ps(lanes[1], minY);
+		_mm256_store_ps(lanes[2], minZ);
+		_mm256_store_ps(lanes[3], maxX);
+		_mm256_store_ps(lanes[4], maxY);
+		_mm256_store_ps(lanes[5], maxZ);
+		for (uint32_t lane{}; lane < 8; ++lane)
+		{
+			AABB laneBounds{};
+			laneBounds.minAABB = Vector3{ lanes[0][lane], lanes[1][lane], lanes[2][lane] };
+			laneBounds.maxAABB = Vector3{ lanes[3][lane], lanes[4][lane], lanes[5][lane] };
+			bounds.Grow(laneBounds);
+		}
+
+		GrowTransformedBounds_Scalar(transform, pPoints + i, count - i, bounds);
+	}
+#endif
+
+	inline void GrowTransformedBounds(const Matrix& transform, const Vector3* pPoints, uint32_t count, AABB& bounds)
+	{
+#if defined(DAE_AVX2)
+		GrowTransformedBounds_8(transform, pPoints, count, bounds);
+#elif defined(DAE_SSE)
+		GrowTransformedBounds_4(transform, pPoints, count, bounds);
+#else
+		GrowTransformedBounds_Scalar(transform, pPoints, count, bounds);
+#endif
+	}
+
+	//Points per task when a thread pool is given, smaller point sets are done on the calling thread
+	constexpr uint32_t TRANSFORMED_BOUNDS_CHUNK_SIZE{ 16384 };
+
+	//Bounds of every point after the transform, in chunks on the thread pool when there is one and the points span more than one chunk
+	inline AABB CalculateTransformedBounds(const Matrix& transform, const std::vector<Vector3>& points, ThreadPool* pThreadPool = nullptr)
+	{
+		return ReduceChunks<AABB>(pThreadPool, static_cast<uint32_t>(points.size()), TRANSFORMED_BOUNDS_CHUNK_SIZE,
+			[&](uint32_t begin, uint32_t end, AABB& bounds)
+			{
+				GrowTransformedBounds(transform, points.data() + begin, end - begin, bounds);
+			},
+			[](AABB& bounds, const AABB& chunkBounds)
+			{
+				bounds.Grow(chunkBounds);
+			});
+	}
+#pragma endregion
+}
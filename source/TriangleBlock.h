@@ -0,0 +1,218 @@
+#pragma once
+#include <cstdint>
+
+#include "Math.h"
+#include "SIMD.h"
+
+namespace dae
+{
+	//Up to 8 triangles of one BVH leaf stored per component, so a single vector operation tests a ray against all of them
+	//Unused lanes have a zero normal, the grazing ray test rejects them without a separate lane count
+	struct alignas(32) TriangleBlock
+	{
+		static constexpr uint32_t s_Width{ 8 };
+
+		float v0X[s_Width];
+		float v0Y[s_Width];
+		float v0Z[s_Width];
+		float edge1X[s_Width];
+		float edge1Y[s_Width];
+		float edge1Z[s_Width];
+		float edge2X[s_Width];
+		float edge2Y[s_Width];
+		float edge2Z[s_Width];
+		float normalX[s_Width];
+		float normalY[s_Width];
+		float normalZ[s_Width];
+
+		uint32_t triangleIndex[s_Width];
+	};
+
+	inline uint32_t GetTriangleBlockCount(uint32_t triangleCount)
+	{
+		return (triangleCount + TriangleBlock::s_Width - 1) / TriangleBlock::s_Width;
+	}
+
+	//Distance and barycentrics (of v1 and v2) per lane, only valid for the lanes set in the returned hit mask
+	struct alignas(32) TriangleBlockHits
+	{
+		float t[TriangleBlock::s_Width];
+		float u[TriangleBlock::s_Width];
+		float v[TriangleBlock::s_Width];
+	};
+
+#pragma region Triangle Block Tests
+	//Moller-Trumbore per lane, every path does the same operations in the same order so they agree bit for bit
+	//cullSign: a lane is culled when dot(normal, direction) * cullSign > 0, 0 disables culling
+	//Each returns a hit bit per lane
+#if defined(DAE_AVX2)
+	inline int IntersectTriangleBlock_8(const TriangleBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, float cullSign, TriangleBlockHits& hits)
+	{
+		const __m256 dirX{ _mm256_set1_ps(direction.x) };
+		const __m256 dirY{ _mm256_set1_ps(direction.y) };
+		const __m256 dirZ{ _mm256_set1_ps(direction.z) };
+
+		const __m256 normalX{ _mm256_load_ps(block.normalX) };
+		const __m256 normalY{ _mm256_load_ps(block.normalY) };
+		const __m256 normalZ{ _mm256_load_ps(block.normalZ) };
+		const __m256 dotNV{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX, dirX), _mm256_mul_ps(normalY, dirY)), _mm256_mul_ps(normalZ, dirZ)) };
+
+		//Grazing rays and culled faces
+		__m256 mask{ _mm256_or_ps(_mm256_cmp_ps(dotNV, _mm256_set1_ps(-0.01f), _CMP_LE_OQ), _mm256_cmp_ps(dotNV, _mm256_set1_ps(0.01f), _CMP_GE_OQ)) };
+		mask = _mm256_andnot_ps(_mm256_cmp_ps(_mm256_mul_ps(dotNV, _mm256_set1_ps(cullSign)), _mm256_setzero_ps(), _CMP_GT_OQ), mask);
+
+		const __m256 edge1X{ _mm256_load_ps(block.edge1X) };
+		const __m256 edge1Y{ _mm256_load_ps(block.edge1Y) };
+		const __m256 edge1Z{ _mm256_load_ps(block.edge1Z) };
+		const __m256 edge2X{ _mm256_load_ps(block.edge2X) };
+		const __m256 edge2Y{ _mm256_load_ps(block.edge2Y) };
+		const __m256 edge2Z{ _mm256_load_ps(block.edge2Z) };
+
+		const __m256 pX{ _mm256_sub_ps(_mm256_mul_ps(dirY, edge2Z), _mm256_mul_ps(dirZ, edge2Y)) };
+		const __m256 pY{ _mm256_sub_ps(_mm256_mul_ps(dirZ, edge2X), _mm256_mul_ps(dirX, edge2Z)) };
+		const __m256 pZ{ _mm256_sub_ps(_mm256_mul_ps(dirX, edge2Y), _mm256_mul_ps(dirY, edge2X)) };
+		const __m256 determinant{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, pX), _mm256_mul_ps(edge1Y, pY)), _mm256_mul_ps(edge1Z, pZ)) };
+		const __m256 invDeterminant{ _mm256_div_ps(_mm256_set1_ps(1.f), determinant) };
+
+		const __m256 sX{ _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_load_ps(block.v0X)) };
+		const __m256 sY{ _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_load_ps(block.v0Y)) };
+		const __m256 sZ{ _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_load_ps(block.v0Z)) };
+		const __m256 u{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, pX), _mm256_mul_ps(sY, pY)), _mm256_mul_ps(sZ, pZ)), invDeterminant) };
+
+		const __m256 qX{ _mm256_sub_ps(_mm256_mul_ps(sY, edge1Z), _mm256_mul_ps(sZ, edge1Y)) };
+		const __m256 qY{ _mm256_sub_ps(_mm256_mul_ps(sZ, edge1X), _mm256_mul_ps(sX, edge1Z)) };
+		const __m256 qZ{ _mm256_sub_ps(_mm256_mul_ps(sX, edge1Y), _mm256_mul_ps(sY, edge1X)) };
+		const __m256 v{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, qX), _mm256_mul_ps(dirY, qY)), _mm256_mul_ps(dirZ, qZ)), invDeterminant) };
+		const __m256 t{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2X, qX), _mm256_mul_ps(edge2Y, qY)), _mm256_mul_ps(edge2Z, qZ)), invDeterminant) };
+
+		const __m256 zero{ _mm256_setzero_ps() };
+		const __m256 one{ _mm256_set1_ps(1.f) };
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ));
+
+		_mm256_store_ps(hits.t, t);
+		_mm256_store_ps(hits.u, u);
+		_mm256_store_ps(hits.v, v);
+		return _mm256_movemask_ps(mask);
+	}
+#endif
+
+#if defined(DAE_SSE)
+	//Tests lanes [firstLane, firstLane + 4)
+	inline int IntersectTriangleBlock_4(const TriangleBlock& block, uint32_t firstLane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, float cullSign, TriangleBlockHits& hits)
+	{
+		const __m128 dirX{ _mm_set1_ps(direction.x) };
+		const __m128 dirY{ _mm_set1_ps(direction.y) };
+		const __m128 dirZ{ _mm_set1_ps(direction.z) };
+
+		const __m128 normalX{ _mm_load_ps(block.normalX + firstLane) };
+		const __m128 normalY{ _mm_load_ps(block.normalY + firstLane) };
+		const __m128 normalZ{ _mm_load_ps(block.normalZ + firstLane) };
+		const __m128 dotNV{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, dirX), _mm_mul_ps(normalY, dirY)), _mm_mul_ps(normalZ, dirZ)) };
+
+		//Grazing rays and culled faces
+		__m128 mask{ _mm_or_ps(_mm_cmple_ps(dotNV, _mm_set1_ps(-0.01f)), _mm_cmpge_ps(dotNV, _mm_set1_ps(0.01f))) };
+		mask = _mm_andnot_ps(_mm_cmpgt_ps(_mm_mul_ps(dotNV, _mm_set1_ps(cullSign)), _mm_setzero_ps()), mask);
+
+		const __m128 edge1X{ _mm_load_ps(block.edge1X + firstLane) };
+		const __m128 edge1Y{ _mm_load_ps(block.edge1Y + firstLane) };
+		const __m128 edge1Z{ _mm_load_ps(block.edge1Z + firstLane) };
+		const __m128 edge2X{ _mm_load_ps(block.edge2X + firstLane) };
+		const __m128 edge2Y{ _mm_load_ps(block.edge2Y + firstLane) };
+		const __m128 edge2Z{ _mm_load_ps(block.edge2Z + firstLane) };
+
+		const __m128 pX{ _mm_sub_ps(_mm_mul_ps(dirY, edge2Z), _mm_mul_ps(dirZ, edge2Y)) };
+		const __m128 pY{ _mm_sub_ps(_mm_mul_ps(dirZ, edge2X), _mm_mul_ps(dirX, edge2Z)) };
+		const __m128 pZ{ _mm_sub_ps(_mm_mul_ps(dirX, edge2Y), _mm_mul_ps(dirY, edge2X)) };
+		const __m128 determinant{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ)) };
+		const __m128 invDeterminant{ _mm_div_ps(_mm_set1_ps(1.f), determinant) };
+
+		const __m128 sX{ _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(block.v0X + firstLane)) };
+		const __m128 sY{ _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(block.v0Y + firstLane)) };
+		const __m128 sZ{ _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(block.v0Z + firstLane)) };
+		const __m128 u{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)), invDeterminant) };
+
+		const __m128 qX{ _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y)) };
+		const __m128 qY{ _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z)) };
+		const __m128 qZ{ _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X)) };
+		const __m128 v{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qX), _mm_mul_ps(dirY, qY)), _mm_mul_ps(dirZ, qZ)), invDeterminant) };
+		const __m128 t{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), invDeterminant) };
+
+		const __m128 zero{ _mm_setzero_ps() };
+		const __m128 one{ _mm_set1_ps(1.f) };
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(t, _mm_set1_ps(tMin)));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(tMax)));
+
+		_mm_store_ps(hits.t + firstLane, t);
+		_mm_store_ps(hits.u + firstLane, u);
+		_mm_store_ps(hits.v + firstLane, v);
+		return _mm_movemask_ps(mask) << firstLane;
+	}
+#endif
+
+	//Tests a single lane, the reference the vector paths have to match
+	inline int IntersectTriangleBlock_1(const TriangleBlock& block, uint32_t lane, const Vector3& origin, const Vector3& direction, float tMin, float tMax, float cullSign, TriangleBlockHits& hits)
+	{
+		const float dotNV{ (block.normalX[lane] * direction.x + block.normalY[lane] * direction.y) + block.normalZ[lane] * direction.z };
+
+		//Grazing rays and culled faces
+		if (!(dotNV <= -0.01f || dotNV >= 0.01f) || dotNV * cullSign > 0.f)
+			return 0;
+
+		const float pX{ direction.y * block.edge2Z[lane] - direction.z * block.edge2Y[lane] };
+		const float pY{ direction.z * block.edge2X[lane] - direction.x * block.edge2Z[lane] };
+		const float pZ{ direction.x * block.edge2Y[lane] - direction.y * block.edge2X[lane] };
+		const float determinant{ (block.edge1X[lane] * pX + block.edge1Y[lane] * pY) + block.edge1Z[lane] * pZ };
+		const float invDeterminant{ 1.f / determinant };
+
+		const float sX{ origin.x - block.v0X[lane] };
+		const float sY{ origin.y - block.v0Y[lane] };
+		const float sZ{ origin.z - block.v0Z[lane] };
+		const float u{ ((sX * pX + sY * pY) + sZ * pZ) * invDeterminant };
+
+		const float qX{ sY * block.edge1Z[lane] - sZ * block.edge1Y[lane] };
+		const float qY{ sZ * block.edge1X[lane] - sX * block.edge1Z[lane] };
+		const float qZ{ sX * block.edge1Y[lane] - sY * block.edge1X[lane] };
+		const float v{ ((direction.x * qX + direction.y * qY) + direction.z * qZ) * invDeterminant };
+		const float t{ ((block.edge2X[lane] * qX + block.edge2Y[lane] * qY) + block.edge2Z[lane] * qZ) * invDeterminant };
+
+		hits.t[lane] = t;
+		hits.u[lane] = u;
+		hits.v[lane] = v;
+
+		const bool isHit{ u >= 0.f && u <= 1.f && v >= 0.f && u + v <= 1.f && t >= tMin && t <= tMax };
+		return isHit ? (1 << lane) : 0;
+	}
+
+	inline int IntersectTriangleBlock_Scalar(const TriangleBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, float cullSign, TriangleBlockHits& hits)
+	{
+		int hitMask{};
+		for (uint32_t lane{}; lane < TriangleBlock::s_Width; ++lane)
+		{
+			hitMask |= IntersectTriangleBlock_1(block, lane, origin, direction, tMin, tMax, cullSign, hits);
+		}
+		return hitMask;
+	}
+
+	//Picks the widest path the build supports
+	inline int IntersectTriangleBlock(const TriangleBlock& block, const Vector3& origin, const Vector3& direction, float tMin, float tMax, float cullSign, TriangleBlockHits& hits)
+	{
+#if defined(DAE_AVX2)
+		return IntersectTriangleBlock_8(block, origin, direction, tMin, tMax, cullSign, hits);
+#elif defined(DAE_SSE)
+		return IntersectTriangleBlock_4(block, 0, origin, direction, tMin, tMax, cullSign, hits)
+			| IntersectTriangleBlock_4(block, 4, origin, direction, tMin, tMax, cullSign, hits);
+#else
+		return IntersectTriangleBlock_Scalar(block, origin, direction, tMin, tMax, cullSign, hits);
+#endif
+	}
+#pragma endregion
+}
@@ -1,8 +1,10 @@
 #pragma once
+#include <bit>
 #include <cassert>
 #include <fstream>
 #include "Math.h"
 #include "DataTypes.h"
+#include "ShapeBlock.h"
 
 namespace dae
 {
@@ -10,6 +12,16 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
+		//Fills in the record of a hit at distance t, shared by the single sphere and the sphere block tests
+		inline void SetHitRecord_Sphere(const Sphere& sphere, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+		}
+
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
 			//todo W1 - DONE
@@ -24,18 +36,22 @@ namespace dae
 
 			if (discriminant > 0.f && IsInRange(discriminant, ray.min, ray.max))
 			{
-				hitRecord.t = (-b - sqrtf(discriminant)) / (2.f * a);
-				if (!IsInRange(hitRecord.t, ray.min, ray.max))
+				float t{ (-b - sqrtf(discriminant)) / (2.f * a) };
+				if (!IsInRange(t, ray.min, ray.max))
 				{
-					hitRecord.t = (-b + sqrtf(discriminant)) / (2.f * a);
-					if (!IsInRange(hitRecord.t, ray.min, ray.max))
+					t = (-b + sqrtf(discriminant)) / (2.f * a);
+					if (!IsInRange(t, ray.min, ray.max))
+					{
+						hitRecord.didHit = false;
 						return false;
+					}
 				}
 
-				hitRecord.origin = ray.origin + hitRecord.t * ray.direction;
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = sphere.materialIndex;
-				hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+				//Occlusion queries only need to know that something is in the way
+				if (ignoreHitRecord)
+					return true;
+
+				SetHitRecord_Sphere(sphere, ray, t, hitRecord);
 			}
 			else
 			{
@@ -50,9 +66,52 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_Sphere(sphere, ray, temp, true);
 		}
+
+		//Lane of the closest hit in hitMask that is nearer than maxDistance, -1 when there is none
+		//Lanes are visited in order, so on equal distances the first one wins like it did one primitive at a time
+		inline int FindClosestLane(int hitMask, const ShapeBlockHits& hits, float maxDistance)
+		{
+			int closestLane{ -1 };
+			while (hitMask != 0)
+			{
+				const int lane{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+				hitMask &= hitMask - 1;
+
+				if (hits.t[lane] < maxDistance)
+				{
+					maxDistance = hits.t[lane];
+					closestLane = lane;
+				}
+			}
+			return closestLane;
+		}
+
+		//Tests a ray against 8 spheres at once, the record is only built for the closest one
+		//The spheres are tested over [ray.min, ray.max] like HitTest_Sphere, a hit only counts when it is nearer than maxDistance
+		inline bool HitTest_SphereBlock(const SphereBlock& block, const std::vector<Sphere>& spheres, const Ray& ray, float maxDistance, HitRecord& hitRecord)
+		{
+			ShapeBlockHits hits;
+			const int hitMask{ IntersectSphereBlock(block, ray.origin, ray.direction, ray.min, ray.max, hits) };
+
+			const int lane{ FindClosestLane(hitMask, hits, maxDistance) };
+			if (lane < 0)
+				return false;
+
+			SetHitRecord_Sphere(spheres[block.sphereIndex[lane]], ray, hits.t[lane], hitRecord);
+			return true;
+		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
+		inline void SetHitRecord_Plane(const Plane& plane, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.normal = plane.normal;
+		}
+
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
 			//todo W1 - DONE
@@ -62,11 +121,10 @@ namespace dae
 
 			if (IsInRange(distance, ray.min, ray.max))
 			{
-				hitRecord.t = distance;
-				hitRecord.origin = ray.origin + distance * ray.direction;
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = plane.materialIndex;
-				hitRecord.normal = plane.normal;
+				if (ignoreHitRecord)
+					return true;
+
+				SetHitRecord_Plane(plane, ray, distance, hitRecord);
 			}
 			else
 				hitRecord.didHit = false;
@@ -80,6 +138,43 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_Plane(plane, ray, temp, true);
 		}
+
+		//Closest plane of all blocks that is nearer than maxDistance, the record is only built for that one
+		inline bool HitTest_PlaneBlocks(const std::vector<PlaneBlock>& blocks, const std::vector<Plane>& planes, const Ray& ray, float maxDistance, HitRecord& hitRecord)
+		{
+			uint32_t closestPlaneIndex{ UINT32_MAX };
+			for (const PlaneBlock& block : blocks)
+			{
+				ShapeBlockHits hits;
+				const int hitMask{ IntersectPlaneBlock(block, ray.origin, ray.direction, ray.min, ray.max, hits) };
+
+				const int lane{ FindClosestLane(hitMask, hits, maxDistance) };
+				if (lane < 0)
+					continue;
+
+				closestPlaneIndex = block.planeIndex[lane];
+				maxDistance = hits.t[lane];
+			}
+
+			if (closestPlaneIndex == UINT32_MAX)
+				return false;
+
+			SetHitRecord_Plane(planes[closestPlaneIndex], ray, maxDistance, hitRecord);
+			return true;
+		}
+
+		//Index of the first plane of all blocks that blocks the ray, UINT32_MAX when none does
+		inline uint32_t OcclusionTest_PlaneBlocks(const std::vector<PlaneBlock>& blocks, const Ray& ray)
+		{
+			for (const PlaneBlock& block : blocks)
+			{
+				ShapeBlockHits hits;
+				const int hitMask{ IntersectPlaneBlock(block, ray.origin, ray.direction, ray.min, ray.max, hits) };
+				if (hitMask != 0)
+					return block.planeIndex[std::countr_zero(static_cast<unsigned int>(hitMask))];
+			}
+			return UINT32_MAX;
+		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TEST HELPER FUNCTIONS
@@ -116,6 +211,20 @@ namespace dae
 			return false;
 		}
 
+		//Branch free form of UseCulling: a face is culled when dot(normal, direction) * cullSign > 0
+		inline float GetCullSign(TriangleCullMode cullMode, bool isShadowRay)
+		{
+			switch (cullMode)
+			{
+			case TriangleCullMode::BackFaceCulling:
+				return isShadowRay ? -1.f : 1.f;
+			case TriangleCullMode::FrontFaceCulling:
+				return isShadowRay ? 1.f : -1.f;
+			default:
+				return 0.f;
+			}
+		}
+
 		inline bool IsPointAtCorrectSide(Vector3 point, Vector3 v0, Vector3 v1, Vector3 normal)
 		{
 			Vector3 edge{ v1 - v0 };
@@ -178,70 +287,851 @@ namespace dae
 			return HitTest_Triangle(triangle, ray, temp, true);
 		}
 
+		/**
+		 * \brief Moller-Trumbore test on precomputed mesh data, makes the same hit decisions as one lane of IntersectTriangleBlock
+		 * \param triangle v0, edges and normal of the triangle
+		 * \param cullSign from GetCullSign, flipped for shadow rays like in HitTest_Triangle
+		 * \param ray ray in the space of the triangle
+		 * \param t distance along the ray, only valid on a hit
+		 * \param u barycentric weight of v1, only valid on a hit
+		 * \param v barycentric weight of v2, only valid on a hit
+		 * \return true when the ray hits the triangle within [ray.min, ray.max]
+		 */
+		inline bool HitTest_PrecomputedTriangle(const PrecomputedTriangle& triangle, float cullSign, const Ray& ray, float& t, float& u, float& v)
+		{
+			//Grazing rays and culled faces
+			const float dotNV{ Vector3::Dot(triangle.normal, ray.direction) };
+			if (!(dotNV <= -0.01f || dotNV >= 0.01f) || dotNV * cullSign > 0.f)
+				return false;
+
+			const Vector3 p{ Vector3::Cross(ray.direction, triangle.edge2) };
+			const float invDeterminant{ 1.f / Vector3::Dot(triangle.edge1, p) };
+
+			const Vector3 v0ToOrigin{ ray.origin - triangle.v0 };
+			u = Vector3::Dot(v0ToOrigin, p) * invDeterminant;
+			if (u < 0.f || u > 1.f)
+				return false;
+
+			const Vector3 q{ Vector3::Cross(v0ToOrigin, triangle.edge1) };
+			v = Vector3::Dot(ray.direction, q) * invDeterminant;
+			if (v < 0.f || u + v > 1.f)
+				return false;
+
+			t = Vector3::Dot(triangle.edge2, q) * invDeterminant;
+			return t >= ray.min && t <= ray.max;
+		}
+
+		inline bool HitTest_PrecomputedTriangle(const PrecomputedTriangle& triangle, float cullSign, const Ray& ray)
+		{
+			float t{};
+			float u{};
+			float v{};
+			return HitTest_PrecomputedTriangle(triangle, cullSign, ray, t, u, v);
+		}
+
 #pragma endregion
-#pragma region TriangeMesh HitTest
-		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+#pragma region BVH Traversal
+		//Returns the distance at which the ray enters the box, or FLT_MAX when it misses the box within [ray.min, tMax]
+		inline float SlabTest_AABB(const AABB& bounds, const Ray& ray, const Vector3& invDirection, float tMax)
 		{
-			float tx1{ (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x };
-			float tx2{ (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x };
+			const float tx1{ (bounds.minAABB.x - ray.origin.x) * invDirection.x };
+			const float tx2{ (bounds.maxAABB.x - ray.origin.x) * invDirection.x };
 
 			float tmin{ std::min(tx1, tx2) };
 			float tmax{ std::max(tx1, tx2) };
 
-			float ty1{ (mesh.transformedMinAABB.y - ray.origin.y) / ray.direction.y };
-			float ty2{ (mesh.transformedMaxAABB.y - ray.origin.y) / ray.direction.y };
+			const float ty1{ (bounds.minAABB.y - ray.origin.y) * invDirection.y };
+			const float ty2{ (bounds.maxAABB.y - ray.origin.y) * invDirection.y };
 
 			tmin = std::max(tmin, std::min(ty1, ty2));
 			tmax = std::min(tmax, std::max(ty1, ty2));
 
-			float tz1{ (mesh.transformedMinAABB.z - ray.origin.z) / ray.direction.z };
-			float tz2{ (mesh.transformedMaxAABB.z - ray.origin.z) / ray.direction.z };
+			const float tz1{ (bounds.minAABB.z - ray.origin.z) * invDirection.z };
+			const float tz2{ (bounds.maxAABB.z - ray.origin.z) * invDirection.z };
 
-			return tmax > 0 && tmax >= tmin;
+			tmin = std::max(tmin, std::min(tz1, tz2));
+			tmax = std::min(tmax, std::max(tz1, tz2));
+
+			if (tmax >= tmin && tmax >= ray.min && tmin <= tMax)
+				return tmin;
+
+			return FLT_MAX;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		/**
+		 * \brief Walks a BVH front-to-back, skipping every node that starts beyond the closest hit so far
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, its max is the initial search distance
+		 * \param intersectLeaf bool(uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay), gets a range of the primitive index list and lowers currentRay.max when it finds a closer hit
+		 * \return true when any leaf reported a hit
+		 */
+		template<typename IntersectLeaf>
+		inline bool TraverseBVHLeaves(const BVH& bvh, const Ray& ray, IntersectLeaf&& intersectLeaf)
 		{
-			if (!SlabTest_TriangleMesh(mesh, ray))
+			if (!bvh.IsBuilt())
 				return false;
 
-			//todo W5
-			const int triangleVertAmount{ 3 };
-			float shortestDistance{ ray.max + 1.f };
-			HitRecord currentRecord{};
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			Ray currentRay{ ray };
 			bool didHit{ false };
-			int triangleCount{0};
 
-			for (size_t i{}; (i + triangleVertAmount) <= mesh.indices.size(); i += triangleVertAmount)
+			struct StackEntry
 			{
-				uint32_t i0 = mesh.indices[i];
-				uint32_t i1 = mesh.indices[i + 1];
-				uint32_t i2 = mesh.indices[i + 2];
+				uint32_t nodeIndex;
+				float distance;
+			};
+			StackEntry stack[BVH::s_MaxTraversalStackSize];
+			int stackSize{};
+
+			if (SlabTest_AABB(nodes[0].bounds, currentRay, invDirection, currentRay.max) != FLT_MAX)
+				stack[stackSize++] = { 0, ray.min };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry{ stack[--stackSize] };
+				if (entry.distance > currentRay.max)
+					continue;
+
+				const BVHNode& node{ nodes[entry.nodeIndex] };
+				if (node.IsLeaf())
+				{
+					if (intersectLeaf(node.leftFirst, node.primitiveCount, currentRay))
+						didHit = true;
+					continue;
+				}
+
+				//Push the far child first so the near child is visited first
+				uint32_t nearIndex{ node.leftFirst };
+				uint32_t farIndex{ node.leftFirst + 1 };
+				float nearDistance{ SlabTest_AABB(nodes[nearIndex].bounds, currentRay, invDirection, currentRay.max) };
+				float farDistance{ SlabTest_AABB(nodes[farIndex].bounds, currentRay, invDirection, currentRay.max) };
+
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+				}
+
+				assert(stackSize + 2 <= BVH::s_MaxTraversalStackSize);
+				if (farDistance != FLT_MAX)
+					stack[stackSize++] = { farIndex, farDistance };
+				if (nearDistance != FLT_MAX)
+					stack[stackSize++] = { nearIndex, nearDistance };
+			}
+
+			return didHit;
+		}
+
+		//Hands the primitives of every leaf to intersectPrimitive one by one, bool(uint32_t primitiveIndex, Ray& currentRay)
+		template<typename IntersectPrimitive>
+		inline bool TraverseBVH(const BVH& bvh, const Ray& ray, IntersectPrimitive&& intersectPrimitive)
+		{
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+			return TraverseBVHLeaves(bvh, ray, [&](uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay)
+				{
+					bool didHit{ false };
+					for (uint32_t i{}; i < primitiveCount; ++i)
+					{
+						if (intersectPrimitive(primitiveIndices[firstPrimitive + i], currentRay))
+							didHit = true;
+					}
+					return didHit;
+				});
+		}
+
+		/**
+		 * \brief Same contract as TraverseBVHLeaves, but tests all children of a BVH4 / BVH8 node at once
+		 * \param bvh wide hierarchy to traverse, a WideBVH or a QuantizedWideBVH
+		 * \param ray ray to trace, its max is the initial search distance
+		 * \param intersectLeaf bool(uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay), lowers currentRay.max when it finds a closer hit
+		 * \return true when any leaf reported a hit
+		 */
+		template<typename WideHierarchy, typename IntersectLeaf>
+		inline bool TraverseWideBVHLeaves(const WideHierarchy& bvh, const Ray& ray, IntersectLeaf&& intersectLeaf)
+		{
+			using Node = typename WideHierarchy::Node;
+			constexpr int Width{ WideHierarchy::s_Width };
+
+			if (!bvh.IsBuilt())
+				return false;
+
+			const std::vector<Node>& nodes{ bvh.GetNodes() };
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			Ray currentRay{ ray };
+			bool didHit{ false };
+
+			struct StackEntry
+			{
+				uint32_t child;
+				uint32_t primitiveCount;
+				float distance;
+			};
+			StackEntry stack[WideHierarchy::s_MaxTraversalStackSize];
+			int stackSize{};
+
+			stack[stackSize++] = { 0, 0, ray.min };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry{ stack[--stackSize] };
+				if (entry.distance > currentRay.max)
+					continue;
+
+				if (entry.primitiveCount > 0)
+				{
+					if (intersectLeaf(entry.child, entry.primitiveCount, currentRay))
+						didHit = true;
+					continue;
+				}
+
+				const Node& node{ nodes[entry.child] };
+
+				alignas(32) float distances[Width];
+				int hitMask{ WideHierarchy::IntersectChildren(node, currentRay.origin, invDirection, currentRay.min, currentRay.max, distances) };
+
+				//Gather the hit children sorted near to far
+				int hitChildren[Width];
+				int hitCount{};
+				while (hitMask != 0)
+				{
+					const int childIndex{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+					hitMask &= hitMask - 1;
+
+					int insertIndex{ hitCount++ };
+					while (insertIndex > 0 && distances[hitChildren[insertIndex - 1]] > distances[childIndex])
+					{
+						hitChildren[insertIndex] = hitChildren[insertIndex - 1];
+						--insertIndex;
+					}
+					hitChildren[insertIndex] = childIndex;
+				}
+
+				//Push far to near so the nearest child is popped first
+				assert(stackSize + hitCount <= WideHierarchy::s_MaxTraversalStackSize);
+				for (int i{ hitCount - 1 }; i >= 0; --i)
+				{
+					const int childIndex{ hitChildren[i] };
+					stack[stackSize++] = { node.child[childIndex], node.primitiveCount[childIndex], distances[childIndex] };
+				}
+			}
+
+			return didHit;
+		}
+
+		//Hands the primitives of every leaf to intersectPrimitive one by one, bool(uint32_t primitiveIndex, Ray& currentRay)
+		template<typename WideHierarchy, typename IntersectPrimitive>
+		inline bool TraverseWideBVH(const WideHierarchy& bvh, const Ray& ray, IntersectPrimitive&& intersectPrimitive)
+		{
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+			return TraverseWideBVHLeaves(bvh, ray, [&](uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay)
+				{
+					bool didHit{ false };
+					for (uint32_t i{}; i < primitiveCount; ++i)
+					{
+						if (intersectPrimitive(primitiveIndices[firstPrimitive + i], currentRay))
+							didHit = true;
+					}
+					return didHit;
+				});
+		}
+
+		/**
+		 * \brief Occlusion-only walk of a BVH, returns as soon as any leaf reports a blocker
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, its max never changes so the stack does not need to remember entry distances
+		 * \param occludesLeaf bool(uint32_t firstPrimitive, uint32_t primitiveCount, const Ray& ray), writes nothing
+		 * \return true when any primitive blocks the ray
+		 */
+		template<typename OccludesLeaf>
+		inline bool TraverseBVHLeavesAnyHit(const BVH& bvh, const Ray& ray, OccludesLeaf&& occludesLeaf)
+		{
+			if (!bvh.IsBuilt())
+				return false;
+
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			uint32_t stack[BVH::s_MaxTraversalStackSize];
+			int stackSize{};
+
+			if (SlabTest_AABB(nodes[0].bounds, ray, invDirection, ray.max) != FLT_MAX)
+				stack[stackSize++] = 0;
+
+			while (stackSize > 0)
+			{
+				const BVHNode& node{ nodes[stack[--stackSize]] };
+				if (node.IsLeaf())
+				{
+					if (occludesLeaf(node.leftFirst, node.primitiveCount, ray))
+						return true;
+					continue;
+				}
+
+				//Any occluder will do, so the child with the larger surface is visited first as it is the most likely to block the ray
+				uint32_t firstIndex{ node.leftFirst };
+				uint32_t secondIndex{ node.leftFirst + 1 };
+				if (nodes[secondIndex].bounds.Area() > nodes[firstIndex].bounds.Area())
+					std::swap(firstIndex, secondIndex);
+
+				assert(stackSize + 2 <= BVH::s_MaxTraversalStackSize);
+				if (SlabTest_AABB(nodes[secondIndex].bounds, ray, invDirection, ray.max) != FLT_MAX)
+					stack[stackSize++] = secondIndex;
+				if (SlabTest_AABB(nodes[firstIndex].bounds, ray, invDirection, ray.max) != FLT_MAX)
+					stack[stackSize++] = firstIndex;
+			}
+
+			return false;
+		}
+
+		//Hands the primitives of every leaf to occludesPrimitive one by one, bool(uint32_t primitiveIndex, const Ray& ray)
+		template<typename OccludesPrimitive>
+		inline bool TraverseBVHAnyHit(const BVH& bvh, const Ray& ray, OccludesPrimitive&& occludesPrimitive)
+		{
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+			return TraverseBVHLeavesAnyHit(bvh, ray, [&](uint32_t firstPrimitive, uint32_t primitiveCount, const Ray& currentRay)
+				{
+					for (uint32_t i{}; i < primitiveCount; ++i)
+					{
+						if (occludesPrimitive(primitiveIndices[firstPrimitive + i], currentRay))
+							return true;
+					}
+					return false;
+				});
+		}
+
+		/**
+		 * \brief Same contract as TraverseBVHLeavesAnyHit for BVH4 / BVH8 nodes
+		 * \param bvh wide hierarchy to traverse, a WideBVH or a QuantizedWideBVH
+		 * \param ray ray to trace
+		 * \param occludesLeaf bool(uint32_t firstPrimitive, uint32_t primitiveCount, const Ray& ray), writes nothing
+		 * \return true when any primitive blocks the ray
+		 */
+		template<typename WideHierarchy, typename OccludesLeaf>
+		inline bool TraverseWideBVHLeavesAnyHit(const WideHierarchy& bvh, const Ray& ray, OccludesLeaf&& occludesLeaf)
+		{
+			using Node = typename WideHierarchy::Node;
+			constexpr int Width{ WideHierarchy::s_Width };
+
+			if (!bvh.IsBuilt())
+				return false;
+
+			const std::vector<Node>& nodes{ bvh.GetNodes() };
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			struct StackEntry
+			{
+				uint32_t child;
+				uint32_t primitiveCount;
+			};
+			StackEntry stack[WideHierarchy::s_MaxTraversalStackSize];
+			int stackSize{};
+
+			stack[stackSize++] = { 0, 0 };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry{ stack[--stackSize] };
+				if (entry.primitiveCount > 0)
+				{
+					if (occludesLeaf(entry.child, entry.primitiveCount, ray))
+						return true;
+					continue;
+				}
+
+				const Node& node{ nodes[entry.child] };
+
+				alignas(32) float distances[Width];
+				int hitMask{ WideHierarchy::IntersectChildren(node, ray.origin, invDirection, ray.min, ray.max, distances) };
+
+				//Leaves first, they can end the query right away, then the inner children in whatever order the mask gives
+				assert(stackSize + Width <= WideHierarchy::s_MaxTraversalStackSize);
+				int leafMask{};
+				while (hitMask != 0)
+				{
+					const int childIndex{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+					hitMask &= hitMask - 1;
+
+					if (node.primitiveCount[childIndex] > 0)
+						leafMask |= 1 << childIndex;
+					else
+						stack[stackSize++] = { node.child[childIndex], 0 };
+				}
+				while (leafMask != 0)
+				{
+					const int childIndex{ std::countr_zero(static_cast<unsigned int>(leafMask)) };
+					leafMask &= leafMask - 1;
 
-				Triangle triangle{ mesh.transformedPositions[i0], mesh.transformedPositions[i1], mesh.transformedPositions[i2], mesh.transformedNormals[triangleCount]};
-				triangle.cullMode = mesh.cullMode;
-				triangle.materialIndex = mesh.materialIndex;
+					stack[stackSize++] = { node.child[childIndex], node.primitiveCount[childIndex] };
+				}
+			}
+
+			return false;
+		}
 
-				if (HitTest_Triangle(triangle, ray, currentRecord, ignoreHitRecord))
+		//Hands the primitives of every leaf to occludesPrimitive one by one, bool(uint32_t primitiveIndex, const Ray& ray)
+		template<typename WideHierarchy, typename OccludesPrimitive>
+		inline bool TraverseWideBVHAnyHit(const WideHierarchy& bvh, const Ray& ray, OccludesPrimitive&& occludesPrimitive)
+		{
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+			return TraverseWideBVHLeavesAnyHit(bvh, ray, [&](uint32_t firstPrimitive, uint32_t primitiveCount, const Ray& currentRay)
 				{
-					if (currentRecord.t < shortestDistance)
+					for (uint32_t i{}; i < primitiveCount; ++i)
 					{
-						hitRecord = currentRecord;
-						shortestDistance = currentRecord.t;
+						if (occludesPrimitive(primitiveIndices[firstPrimitive + i], currentRay))
+							return true;
 					}
-					didHit = true;
+					return false;
+				});
+		}
+
+		//Interval arithmetic test of a box against the frustum of a packet, see RayPacket::UpdateFrustum
+		//Returns a lower bound of where the rays enter the box, or FLT_MAX when no ray of the packet can hit it
+		inline float FrustumTest_AABB(const AABB& bounds, const RayPacket& packet)
+		{
+			float tNear{ -FLT_MAX };
+			float tFar{ FLT_MAX };
+
+			for (int axis{}; axis < 3; ++axis)
+			{
+				const float minInv{ packet.minInvDirection[axis] };
+				const float maxInv{ packet.maxInvDirection[axis] };
+
+				//Every ray enters through the same side of the slab, the frustum is coherent
+				const bool isPositive{ minInv >= 0.f };
+				const float nearPlane{ (isPositive ? bounds.minAABB[axis] : bounds.maxAABB[axis]) - packet.origin[axis] };
+				const float farPlane{ (isPositive ? bounds.maxAABB[axis] : bounds.minAABB[axis]) - packet.origin[axis] };
+
+				tNear = std::max(tNear, std::min(nearPlane * minInv, nearPlane * maxInv));
+				tFar = std::min(tFar, std::max(farPlane * minInv, farPlane * maxInv));
+			}
+
+			if (tFar >= tNear && tFar >= 0.f)
+				return tNear;
+
+			return FLT_MAX;
+		}
+
+		//Slab test of every ray of a packet against one box, same condition as SlabTest_AABB with each ray's own [min, max]
+		inline uint32_t SlabTest_Packet(const AABB& bounds, const RayPacket& packet)
+		{
+			uint32_t hitMask{};
+
+#if defined(DAE_AVX2)
+			const __m256 minX{ _mm256_set1_ps(bounds.minAABB.x - packet.origin.x) };
+			const __m256 minY{ _mm256_set1_ps(bounds.minAABB.y - packet.origin.y) };
+			const __m256 minZ{ _mm256_set1_ps(bounds.minAABB.z - packet.origin.z) };
+			const __m256 maxX{ _mm256_set1_ps(bounds.maxAABB.x - packet.origin.x) };
+			const __m256 maxY{ _mm256_set1_ps(bounds.maxAABB.y - packet.origin.y) };
+			const __m256 maxZ{ _mm256_set1_ps(bounds.maxAABB.z - packet.origin.z) };
+
+			for (uint32_t first{}; first < packet.size; first += 8)
+			{
+				const __m256 invX{ _mm256_load_ps(packet.invDirectionX + first) };
+				const __m256 invY{ _mm256_load_ps(packet.invDirectionY + first) };
+				const __m256 invZ{ _mm256_load_ps(packet.invDirectionZ + first) };
+
+				const __m256 tx1{ _mm256_mul_ps(minX, invX) };
+				const __m256 tx2{ _mm256_mul_ps(maxX, invX) };
+				const __m256 ty1{ _mm256_mul_ps(minY, invY) };
+				const __m256 ty2{ _mm256_mul_ps(maxY, invY) };
+				const __m256 tz1{ _mm256_mul_ps(minZ, invZ) };
+				const __m256 tz2{ _mm256_mul_ps(maxZ, invZ) };
+
+				const __m256 tmin{ _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2)) };
+				const __m256 tmax{ _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2)) };
+
+				__m256 mask{ _mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ) };
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(tmax, _mm256_load_ps(packet.min + first), _CMP_GE_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(tmin, _mm256_load_ps(packet.max + first), _CMP_LE_OQ));
+
+				hitMask |= static_cast<uint32_t>(_mm256_movemask_ps(mask)) << first;
+			}
+#elif defined(DAE_SSE)
+			const __m128 minX{ _mm_set1_ps(bounds.minAABB.x - packet.origin.x) };
+			const __m128 minY{ _mm_set1_ps(bounds.minAABB.y - packet.origin.y) };
+			const __m128 minZ{ _mm_set1_ps(bounds.minAABB.z - packet.origin.z) };
+			const __m128 maxX{ _mm_set1_ps(bounds.maxAABB.x - packet.origin.x) };
+			const __m128 maxY{ _mm_set1_ps(bounds.maxAABB.y - packet.origin.y) };
+			const __m128 maxZ{ _mm_set1_ps(bounds.maxAABB.z - packet.origin.z) };
+
+			for (uint32_t first{}; first < packet.size; first += 4)
+			{
+				const __m128 invX{ _mm_load_ps(packet.invDirectionX + first) };
+				const __m128 invY{ _mm_load_ps(packet.invDirectionY + first) };
+				const __m128 invZ{ _mm_load_ps(packet.invDirectionZ + first) };
+
+				const __m128 tx1{ _mm_mul_ps(minX, invX) };
+				const __m128 tx2{ _mm_mul_ps(maxX, invX) };
+				const __m128 ty1{ _mm_mul_ps(minY, invY) };
+				const __m128 ty2{ _mm_mul_ps(maxY, invY) };
+				const __m128 tz1{ _mm_mul_ps(minZ, invZ) };
+				const __m128 tz2{ _mm_mul_ps(maxZ, invZ) };
+
+				const __m128 tmin{ _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2)) };
+				const __m128 tmax{ _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2)) };
+
+				__m128 mask{ _mm_cmpge_ps(tmax, tmin) };
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(tmax, _mm_load_ps(packet.min + first)));
+				mask = _mm_and_ps(mask, _mm_cmple_ps(tmin, _mm_load_ps(packet.max + first)));
+
+				hitMask |= static_cast<uint32_t>(_mm_movemask_ps(mask)) << first;
+			}
+#else
+			for (uint32_t lane{}; lane < packet.size; ++lane)
+			{
+				const Ray ray{ packet.GetRay(lane) };
+				const Vector3 invDirection{ packet.invDirectionX[lane], packet.invDirectionY[lane], packet.invDirectionZ[lane] };
+				if (SlabTest_AABB(bounds, ray, invDirection, ray.max) != FLT_MAX)
+					hitMask |= 1u << lane;
+			}
+#endif
+
+			return hitMask & packet.GetFullMask();
+		}
+
+		/**
+		 * \brief Walks a BVH with a whole packet, nodes are culled for the packet by its frustum and per ray by a vector slab test
+		 * \param bvh hierarchy to traverse
+		 * \param packet rays in the space of the hierarchy with an up to date frustum, the max of each ray is its closest hit so far
+		 * \param activeMask rays to trace
+		 * \param intersectLeaf void(uint32_t firstPrimitive, uint32_t primitiveCount, RayPacket& packet, uint32_t leafMask), lowers the max of every ray in leafMask that finds a closer hit
+		 */
+		template<typename IntersectLeaf>
+		inline void TraverseBVHPacket(const BVH& bvh, RayPacket& packet, uint32_t activeMask, IntersectLeaf&& intersectLeaf)
+		{
+			if (!bvh.IsBuilt() || activeMask == 0)
+				return;
+
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+
+			struct StackEntry
+			{
+				uint32_t nodeIndex;
+				uint32_t activeMask;
+			};
+			StackEntry stack[BVH::s_MaxTraversalStackSize];
+			int stackSize{};
+
+			if (FrustumTest_AABB(nodes[0].bounds, packet) != FLT_MAX)
+				stack[stackSize++] = { 0, activeMask };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry{ stack[--stackSize] };
+				const BVHNode& node{ nodes[entry.nodeIndex] };
+
+				//Rays drop out of the mask as they miss boxes or find closer hits, a subtree only sees the rays that reached it
+				const uint32_t nodeMask{ entry.activeMask & SlabTest_Packet(node.bounds, packet) };
+				if (nodeMask == 0)
+					continue;
+
+				if (node.IsLeaf())
+				{
+					intersectLeaf(node.leftFirst, node.primitiveCount, packet, nodeMask);
+					continue;
 				}
-				++triangleCount;
+
+				//The child the frustum enters first is visited first
+				uint32_t nearIndex{ node.leftFirst };
+				uint32_t farIndex{ node.leftFirst + 1 };
+				float nearDistance{ FrustumTest_AABB(nodes[nearIndex].bounds, packet) };
+				float farDistance{ FrustumTest_AABB(nodes[farIndex].bounds, packet) };
+
+				if (farDistance < nearDistance)
+				{
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+				}
+
+				assert(stackSize + 2 <= BVH::s_MaxTraversalStackSize);
+				if (farDistance != FLT_MAX)
+					stack[stackSize++] = { farIndex, nodeMask };
+				if (nearDistance != FLT_MAX)
+					stack[stackSize++] = { nearIndex, nodeMask };
+			}
+		}
+#pragma endregion
+#pragma region TriangeMesh HitTest
+		//Transforms a world space ray into the space of inverseTransform
+		//The direction gets normalized again, distances along the object ray are the world distances times distanceScale
+		inline Ray TransformRay(const Matrix& inverseTransform, const Ray& ray, float& distanceScale)
+		{
+			Ray objectRay{};
+			objectRay.origin = inverseTransform.TransformPoint(ray.origin);
+			objectRay.direction = inverseTransform.TransformVector(ray.direction);
+
+			distanceScale = objectRay.direction.Normalize();
+			objectRay.min = ray.min * distanceScale;
+			objectRay.max = std::min(ray.max * distanceScale, FLT_MAX);
+
+			return objectRay;
+		}
+
+		//Normals transform with the inverse transpose, which keeps them perpendicular under non-uniform scaling
+		inline Vector3 TransformNormal(const Matrix& inverseTransform, const Vector3& normal)
+		{
+			return Vector3{
+				Vector3::Dot(normal, inverseTransform[0]),
+				Vector3::Dot(normal, inverseTransform[1]),
+				Vector3::Dot(normal, inverseTransform[2])
+			}.Normalized();
+		}
+
+		//Shadow ray test against a single triangle of a mesh or instance, used to retest a cached occluder
+		inline bool OcclusionTest_MeshTriangle(const TriangleMesh& mesh, const Matrix& inverseTransform, uint32_t triangleIndex, const Ray& ray)
+		{
+			if (triangleIndex >= mesh.precomputedTriangles.size())
+				return false;
+
+			float distanceScale{};
+			const Ray objectRay{ TransformRay(inverseTransform, ray, distanceScale) };
+			return HitTest_PrecomputedTriangle(mesh.precomputedTriangles[triangleIndex], GetCullSign(mesh.cullMode, true), objectRay);
+		}
+
+		//Shadow ray test shared by meshes and their instances, stops at the first triangle in the way
+		//pOccluderIndex receives the index of that triangle when given
+		inline bool OcclusionTest_TriangleMesh(const TriangleMesh& mesh, const Matrix& inverseTransform, const Ray& ray, uint32_t* pOccluderIndex = nullptr)
+		{
+			float distanceScale{};
+			const Ray objectRay{ TransformRay(inverseTransform, ray, distanceScale) };
+			const float cullSign{ GetCullSign(mesh.cullMode, true) };
+
+			const auto occludesLeaf{ [&](uint32_t firstPrimitive, uint32_t primitiveCount, const Ray& currentRay)
+				{
+					const uint32_t firstBlock{ mesh.leafBlockIndices[firstPrimitive] };
+					const uint32_t blockEnd{ firstBlock + GetTriangleBlockCount(primitiveCount) };
+					for (uint32_t blockIndex{ firstBlock }; blockIndex < blockEnd; ++blockIndex)
+					{
+						const TriangleBlock& block{ mesh.triangleBlocks[blockIndex] };
+
+						TriangleBlockHits hits;
+						const int hitMask{ IntersectTriangleBlock(block, currentRay.origin, currentRay.direction, currentRay.min, currentRay.max, cullSign, hits) };
+						if (hitMask == 0)
+							continue;
+
+						if (pOccluderIndex)
+							*pOccluderIndex = block.triangleIndex[std::countr_zero(static_cast<unsigned int>(hitMask))];
+						return true;
+					}
+					return false;
+				} };
+
+			switch (mesh.bvhLayout)
+			{
+			case BVHLayout::Wide4:
+				return TraverseWideBVHLeavesAnyHit(mesh.bvh4, objectRay, occludesLeaf);
+			case BVHLayout::Wide8:
+				return TraverseWideBVHLeavesAnyHit(mesh.bvh8, objectRay, occludesLeaf);
+			case BVHLayout::Wide4Quantized:
+				return TraverseWideBVHLeavesAnyHit(mesh.bvh4Quantized, objectRay, occludesLeaf);
+			case BVHLayout::Wide8Quantized:
+				return TraverseWideBVHLeavesAnyHit(mesh.bvh8Quantized, objectRay, occludesLeaf);
+			default:
+				return TraverseBVHLeavesAnyHit(mesh.bvh, objectRay, occludesLeaf);
+			}
+		}
+
+		//Shared by meshes and their instances, the geometry and BVH always come from the mesh
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Matrix& inverseTransform, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
+		{
+			//todo W5
+			if (ignoreHitRecord)
+				return OcclusionTest_TriangleMesh(mesh, inverseTransform, ray);
+
+			float distanceScale{};
+			const Ray objectRay{ TransformRay(inverseTransform, ray, distanceScale) };
+
+			assert(mesh.precomputedTriangles.size() * 3 == mesh.indices.size() && "Call UpdateBVH after changing the geometry");
+
+			const float cullSign{ GetCullSign(mesh.cullMode, false) };
+			uint32_t closestTriangleIndex{ UINT32_MAX };
+			float closestDistance{};
+
+			const auto intersectLeaf{ [&](uint32_t firstPrimitive, uint32_t primitiveCount, Ray& currentRay)
+				{
+					bool didHit{ false };
+
+					const uint32_t firstBlock{ mesh.leafBlockIndices[firstPrimitive] };
+					const uint32_t blockEnd{ firstBlock + GetTriangleBlockCount(primitiveCount) };
+					for (uint32_t blockIndex{ firstBlock }; blockIndex < blockEnd; ++blockIndex)
+					{
+						const TriangleBlock& block{ mesh.triangleBlocks[blockIndex] };
+
+						TriangleBlockHits hits;
+						int hitMask{ IntersectTriangleBlock(block, currentRay.origin, currentRay.direction, currentRay.min, currentRay.max, cullSign, hits) };
+
+						//Lanes in order, so on equal distances the later triangle wins like it did one triangle at a time
+						while (hitMask != 0)
+						{
+							const int lane{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+							hitMask &= hitMask - 1;
+
+							if (hits.t[lane] > currentRay.max)
+								continue;
+
+							closestTriangleIndex = block.triangleIndex[lane];
+							closestDistance = hits.t[lane];
+							currentRay.max = hits.t[lane];
+							didHit = true;
+						}
+					}
+					return didHit;
+				} };
+
+			bool didHit{ false };
+			switch (mesh.bvhLayout)
+			{
+			case BVHLayout::Wide4:
+				didHit = TraverseWideBVHLeaves(mesh.bvh4, objectRay, intersectLeaf);
+				break;
+			case BVHLayout::Wide8:
+				didHit = TraverseWideBVHLeaves(mesh.bvh8, objectRay, intersectLeaf);
+				break;
+			case BVHLayout::Wide4Quantized:
+				didHit = TraverseWideBVHLeaves(mesh.bvh4Quantized, objectRay, intersectLeaf);
+				break;
+			case BVHLayout::Wide8Quantized:
+				didHit = TraverseWideBVHLeaves(mesh.bvh8Quantized, objectRay, intersectLeaf);
+				break;
+			default:
+				didHit = TraverseBVHLeaves(mesh.bvh, objectRay, intersectLeaf);
+				break;
+			}
+
+			//Only the closest hit gets transformed back to world space
+			if (closestTriangleIndex != UINT32_MAX)
+			{
+				hitRecord.t = closestDistance / distanceScale;
+				hitRecord.origin = ray.origin + hitRecord.t * ray.direction;
+				hitRecord.normal = TransformNormal(inverseTransform, mesh.normals[closestTriangleIndex]);
+				hitRecord.materialIndex = materialIndex;
+				hitRecord.didHit = true;
 			}
 
 			return didHit;
 		}
 
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			return HitTest_TriangleMesh(mesh, mesh.inverseTransform, mesh.materialIndex, ray, hitRecord, ignoreHitRecord);
+		}
+
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
 			HitRecord temp{};
 			return HitTest_TriangleMesh(mesh, ray, temp, true);
 		}
+
+		/**
+		 * \brief Packet version of HitTest_TriangleMesh for primary rays, finds the same hits as tracing the rays one by one
+		 * Always traverses the binary mesh.bvh whatever bvhLayout selects, culling nodes for the whole frustum beats tracing the rays one by one through a wide tree
+		 * The packet is copied once per mesh because its rays have to move into object space
+		 * \param packet world space rays, the max of each ray is its closest hit so far and gets lowered when the mesh is closer
+		 * \param activeMask rays to trace
+		 * \param pHitRecords one record per lane, only written for rays that found a closer hit
+		 */
+		inline void HitTest_TriangleMeshPacket(const TriangleMesh& mesh, const Matrix& inverseTransform, unsigned char materialIndex, RayPacket& packet, uint32_t activeMask, HitRecord* pHitRecords)
+		{
+			//Same steps as TransformRay for every ray, so the distances come out exactly as in the single ray path
+			RayPacket objectPacket{};
+			objectPacket.origin = inverseTransform.TransformPoint(packet.origin);
+			objectPacket.size = packet.size;
+
+			float distanceScales[RayPacket::s_MaxSize]{};
+			for (uint32_t mask{ activeMask }; mask != 0; mask &= mask - 1)
+			{
+				const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+				Vector3 direction{ inverseTransform.TransformVector(packet.GetDirection(lane)) };
+				distanceScales[lane] = direction.Normalize();
+				objectPacket.SetRay(lane, direction, packet.min[lane] * distanceScales[lane], std::min(packet.max[lane] * distanceScales[lane], FLT_MAX));
+			}
+
+			//The transform can turn a coherent packet into one that is not, those rays go one by one
+			if (!objectPacket.UpdateFrustum(activeMask))
+			{
+				for (uint32_t mask{ activeMask }; mask != 0; mask &= mask - 1)
+				{
+					const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+					HitRecord hitRecord{};
+					if (HitTest_TriangleMesh(mesh, inverseTransform, materialIndex, packet.GetRay(lane), hitRecord, false) && hitRecord.t < packet.max[lane])
+					{
+						pHitRecords[lane] = hitRecord;
+						packet.max[lane] = hitRecord.t;
+					}
+				}
+				return;
+			}
+
+			const float cullSign{ GetCullSign(mesh.cullMode, false) };
+			uint32_t closestTriangleIndices[RayPacket::s_MaxSize];
+			std::fill(std::begin(closestTriangleIndices), std::end(closestTriangleIndices), UINT32_MAX);
+
+			TraverseBVHPacket(mesh.bvh, objectPacket, activeMask, [&](uint32_t firstPrimitive, uint32_t primitiveCount, RayPacket& currentPacket, uint32_t leafMask)
+				{
+					const uint32_t firstBlock{ mesh.leafBlockIndices[firstPrimitive] };
+					const uint32_t blockEnd{ firstBlock + GetTriangleBlockCount(primitiveCount) };
+					for (uint32_t blockIndex{ firstBlock }; blockIndex < blockEnd; ++blockIndex)
+					{
+						const TriangleBlock& block{ mesh.triangleBlocks[blockIndex] };
+
+						for (uint32_t mask{ leafMask }; mask != 0; mask &= mask - 1)
+						{
+							const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+							TriangleBlockHits hits;
+							int hitMask{ IntersectTriangleBlock(block, currentPacket.origin, currentPacket.GetDirection(lane), currentPacket.min[lane], currentPacket.max[lane], cullSign, hits) };
+							while (hitMask != 0)
+							{
+								const int triangleLane{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+								hitMask &= hitMask - 1;
+
+								if (hits.t[triangleLane] > currentPacket.max[lane])
+									continue;
+
+								closestTriangleIndices[lane] = block.triangleIndex[triangleLane];
+								currentPacket.max[lane] = hits.t[triangleLane];
+							}
+						}
+					}
+				});
+
+			for (uint32_t mask{ activeMask }; mask != 0; mask &= mask - 1)
+			{
+				const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+				if (closestTriangleIndices[lane] == UINT32_MAX)
+					continue;
+
+				//Like Scene::GetClosestHit, a hit at exactly the current distance does not replace it
+				const float t{ objectPacket.max[lane] / distanceScales[lane] };
+				if (t >= packet.max[lane])
+					continue;
+
+				HitRecord& hitRecord{ pHitRecords[lane] };
+				hitRecord.t = t;
+				hitRecord.origin = packet.origin + t * packet.GetDirection(lane);
+				hitRecord.normal = TransformNormal(inverseTransform, mesh.normals[closestTriangleIndices[lane]]);
+				hitRecord.materialIndex = materialIndex;
+				hitRecord.didHit = true;
+
+				packet.max[lane] = t;
+			}
+		}
+
+		inline bool HitTest_TriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			return HitTest_TriangleMesh(mesh, instance.inverseTransform, instance.materialIndex, ray, hitRecord, ignoreHitRecord);
+		}
+
+		inline bool HitTest_TriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray)
+		{
+			HitRecord temp{};
+			return HitTest_TriangleMeshInstance(instance, mesh, ray, temp, true);
+		}
 #pragma endregion
 	}
 
@@ -273,6 +1163,25 @@ namespace dae
 
 			return returnColor;
 		}
+
+		//Same as above for a light at a known distance, which the shadow ray already measured
+		inline ColorRGB GetRadiance(const Light& light, float distanceToLight)
+		{
+			ColorRGB returnColor{};
+
+			switch (light.type)
+			{
+			case LightType::Directional:
+				break;
+
+			case LightType::Point:
+				float irradians{ light.intensity / (distanceToLight * distanceToLight) };
+				returnColor = light.color * irradians;
+				break;
+			}
+
+			return returnColor;
+		}
 	}
 
 	namespace Utils
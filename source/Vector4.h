@@ -1,8 +1,13 @@
 #pragma once
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+
+#include "SIMD.h"
+#include "Vector3.h"
 
 namespace dae
 {
-	struct Vector3;
 	struct Vector4
 	{
 		float x;
@@ -11,22 +16,134 @@ namespace dae
 		float w;
 
 		Vector4() = default;
-		Vector4(float _x, float _y, float _z, float _w);
-		Vector4(const Vector3& v, float _w);
+		constexpr Vector4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+		constexpr Vector4(const Vector3& v, float _w) : x(v.x), y(v.y), z(v.z), w(_w) {}
+
+		float Magnitude() const
+		{
+			return sqrtf(x * x + y * y + z * z + w * w);
+		}
+
+		constexpr float SqrMagnitude() const
+		{
+			return x * x + y * y + z * z + w * w;
+		}
+
+		float Normalize()
+		{
+			const float m = Magnitude();
+			x /= m;
+			y /= m;
+			z /= m;
+			w /= m;
+
+			return m;
+		}
 
-		float Magnitude() const;
-		float SqrMagnitude() const;
-		float Normalize();
-		Vector4 Normalized() const;
+		Vector4 Normalized() const
+		{
+			const float m = Magnitude();
+			return { x / m, y / m, z / m, w / m };
+		}
 
-		static float Dot(const Vector4& v1, const Vector4& v2);
+		//Stays scalar: a horizontal SIMD sum would add the products in a different order
+		static constexpr float Dot(const Vector4& v1, const Vector4& v2)
+		{
+			//todo W1 - DONE
+			return { (v1.x * v2.x) + (v1.y * v2.y) + (v1.z * v2.z) + (v1.w * v2.w) };
+		}
+
+#if defined(DAE_SIMD_MATH)
+		__m128 Load() const { return _mm_loadu_ps(&x); }
+		void Store(__m128 v) { _mm_storeu_ps(&x, v); }
+#endif
 
 		// operator overloading
-		Vector4 operator*(float scale) const;
-		Vector4 operator+(const Vector4& v) const;
-		Vector4 operator-(const Vector4& v) const;
-		Vector4& operator+=(const Vector4& v);
-		float& operator[](int index);
-		float operator[](int index) const;
+		constexpr Vector4 operator*(float scale) const
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				Vector4 result;
+				result.Store(_mm_mul_ps(Load(), _mm_set1_ps(scale)));
+				return result;
+			}
+#endif
+			return { x * scale, y * scale, z * scale, w * scale };
+		}
+
+		constexpr Vector4 operator+(const Vector4& v) const
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				Vector4 result;
+				result.Store(_mm_add_ps(Load(), v.Load()));
+				return result;
+			}
+#endif
+			return { x + v.x, y + v.y, z + v.z, w + v.w };
+		}
+
+		constexpr Vector4 operator-(const Vector4& v) const
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				Vector4 result;
+				result.Store(_mm_sub_ps(Load(), v.Load()));
+				return result;
+			}
+#endif
+			return { x - v.x, y - v.y, z - v.z, w - v.w };
+		}
+
+		constexpr Vector4& operator+=(const Vector4& v)
+		{
+#if defined(DAE_SIMD_MATH)
+			if (!std::is_constant_evaluated())
+			{
+				Store(_mm_add_ps(Load(), v.Load()));
+				return *this;
+			}
+#endif
+			x += v.x;
+			y += v.y;
+			z += v.z;
+			w += v.w;
+			return *this;
+		}
+
+		constexpr float& operator[](int index)
+		{
+			assert(index <= 3 && index >= 0);
+
+			if (index == 0)return x;
+			if (index == 1)return y;
+			if (index == 2)return z;
+			return w;
+		}
+
+		constexpr float operator[](int index) const
+		{
+			assert(index <= 3 && index >= 0);
+
+			if (index == 0)return x;
+			if (index == 1)return y;
+			if (index == 2)return z;
+			return w;
+		}
 	};
+
+	constexpr Vector3::Vector3(const Vector4& v) : x(v.x), y(v.y), z(v.z) {}
+
+	constexpr Vector4 Vector3::ToPoint4() const
+	{
+		return { x, y, z, 1 };
+	}
+
+	constexpr Vector4 Vector3::ToVector4() const
+	{
+		return { x, y, z, 0 };
+	}
 }
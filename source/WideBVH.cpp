@@ -0,0 +1,302 @@
+#include "WideBVH.h"
+
+#include <cassert>
+#include <cmath>
+
+#include "ThreadPool.h"
+
+namespace dae
+{
+	template<int Width>
+	void WideBVH<Width>::Build(const BVH& bvh)
+	{
+		Clear();
+
+		if (!bvh.IsBuilt())
+			return;
+
+		const std::vector<BVHNode>& binaryNodes{ bvh.GetNodes() };
+		m_PrimitiveIndices = bvh.GetPrimitiveIndices();
+		m_Nodes.reserve(binaryNodes.size() / (Width - 1) + 1);
+
+		ThreadPool* const pThreadPool{ bvh.GetThreadPool() };
+
+		std::vector<CollapseTask> tasks{ { 0, 0 } };
+		m_Nodes.emplace_back();
+
+		//The top levels are collapsed one at a time until there are enough subtrees to spread over the thread pool
+		//Without a pool the whole tree is collapsed this way
+		while (!tasks.empty() && (!pThreadPool || tasks.size() < s_ParallelSubtreeCount))
+		{
+			std::vector<CollapseTask> nextTasks{};
+			for (const CollapseTask& task : tasks)
+			{
+				const uint32_t firstChildIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+
+				WideBVHNode<Width> wideNode{};
+				const uint32_t interiorCount{ CollapseNode(binaryNodes, task.binaryIndex, firstChildIndex, wideNode, nextTasks) };
+
+				m_Nodes.resize(firstChildIndex + interiorCount);
+				m_Nodes[task.wideIndex] = wideNode;
+			}
+
+			tasks = std::move(nextTasks);
+		}
+
+		if (tasks.empty())
+			return;
+
+		//Every subtree is counted first, so each one gets its own range of nodes and they can be collapsed side by side
+		//The ranges follow the subtree order, so the layout does not depend on the number of threads
+		const uint32_t subtreeCount{ static_cast<uint32_t>(tasks.size()) };
+		std::vector<uint32_t> subtreeOffsets(subtreeCount);
+
+		ForEachChunk(pThreadPool, subtreeCount, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t subtreeIndex{ begin }; subtreeIndex < end; ++subtreeIndex)
+					subtreeOffsets[subtreeIndex] = CountSubtreeNodes(binaryNodes, tasks[subtreeIndex].binaryIndex);
+			});
+
+		uint32_t nodeCount{ static_cast<uint32_t>(m_Nodes.size()) };
+		for (uint32_t& subtreeOffset : subtreeOffsets)
+		{
+			const uint32_t subtreeNodeCount{ subtreeOffset };
+			subtreeOffset = nodeCount;
+			nodeCount += subtreeNodeCount;
+		}
+		m_Nodes.resize(nodeCount);
+
+		ForEachChunk(pThreadPool, subtreeCount, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t subtreeIndex{ begin }; subtreeIndex < end; ++subtreeIndex)
+				{
+					uint32_t nextNodeIndex{ subtreeOffsets[subtreeIndex] };
+
+					std::vector<CollapseTask> subtreeTasks{ tasks[subtreeIndex] };
+					while (!subtreeTasks.empty())
+					{
+						const CollapseTask task{ subtreeTasks.back() };
+						subtreeTasks.pop_back();
+
+						nextNodeIndex += CollapseNode(binaryNodes, task.binaryIndex, nextNodeIndex, m_Nodes[task.wideIndex], subtreeTasks);
+					}
+
+					assert(nextNodeIndex == ((subtreeIndex + 1 < subtreeCount) ? subtreeOffsets[subtreeIndex + 1] : nodeCount));
+				}
+			});
+	}
+
+	template<int Width>
+	int WideBVH<Width>::SelectChildren(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t* children)
+	{
+		//Start with the two children and keep opening the interior child with the largest surface area until the node is full
+		int childCount{};
+
+		const BVHNode& binaryNode{ binaryNodes[binaryIndex] };
+		if (binaryNode.IsLeaf())
+		{
+			//Only happens when the whole tree is a single leaf
+			children[childCount++] = binaryIndex;
+			return childCount;
+		}
+
+		children[childCount++] = binaryNode.leftFirst;
+		children[childCount++] = binaryNode.leftFirst + 1;
+
+		while (childCount < Width)
+		{
+			int largestChild{ -1 };
+			float largestArea{ -1.f };
+
+			for (int i{}; i < childCount; ++i)
+			{
+				const BVHNode& child{ binaryNodes[children[i]] };
+				if (!child.IsLeaf() && child.bounds.Area() > largestArea)
+				{
+					largestArea = child.bounds.Area();
+					largestChild = i;
+				}
+			}
+
+			if (largestChild < 0)
+				break;
+
+			const uint32_t openedIndex{ children[largestChild] };
+			children[largestChild] = binaryNodes[openedIndex].leftFirst;
+			children[childCount++] = binaryNodes[openedIndex].leftFirst + 1;
+		}
+
+		return childCount;
+	}
+
+	template<int Width>
+	uint32_t WideBVH<Width>::CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t firstChildIndex, WideBVHNode<Width>& wideNode, std::vector<CollapseTask>& tasks)
+	{
+		uint32_t children[Width]{};
+		const int childCount{ SelectChildren(binaryNodes, binaryIndex, children) };
+
+		wideNode = WideBVHNode<Width>{};
+		wideNode.childCount = static_cast<uint32_t>(childCount);
+
+		uint32_t interiorCount{};
+		for (int i{}; i < childCount; ++i)
+		{
+			const BVHNode& child{ binaryNodes[children[i]] };
+
+			wideNode.minX[i] = child.bounds.minAABB.x;
+			wideNode.minY[i] = child.bounds.minAABB.y;
+			wideNode.minZ[i] = child.bounds.minAABB.z;
+			wideNode.maxX[i] = child.bounds.maxAABB.x;
+			wideNode.maxY[i] = child.bounds.maxAABB.y;
+			wideNode.maxZ[i] = child.bounds.maxAABB.z;
+
+			if (child.IsLeaf())
+			{
+				assert(child.primitiveCount <= BVH::s_MaxLeafPrimitiveCount);
+				wideNode.child[i] = child.leftFirst;
+				wideNode.primitiveCount[i] = child.primitiveCount;
+			}
+			else
+			{
+				const uint32_t childWideIndex{ firstChildIndex + interiorCount++ };
+				tasks.push_back({ children[i], childWideIndex });
+
+				wideNode.child[i] = childWideIndex;
+				wideNode.primitiveCount[i] = 0;
+			}
+		}
+
+		return interiorCount;
+	}
+
+	template<int Width>
+	uint32_t WideBVH<Width>::CountSubtreeNodes(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex)
+	{
+		uint32_t nodeCount{};
+
+		std::vector<uint32_t> nodesToCount{ binaryIndex };
+		while (!nodesToCount.empty())
+		{
+			const uint32_t nodeIndex{ nodesToCount.back() };
+			nodesToCount.pop_back();
+
+			uint32_t children[Width]{};
+			const int childCount{ SelectChildren(binaryNodes, nodeIndex, children) };
+
+			for (int i{}; i < childCount; ++i)
+			{
+				if (binaryNodes[children[i]].IsLeaf())
+					continue;
+
+				++nodeCount;
+				nodesToCount.push_back(children[i]);
+			}
+		}
+
+		return nodeCount;
+	}
+
+	template<int Width>
+	void WideBVH<Width>::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+	}
+
+	template<int Width>
+	void QuantizedWideBVH<Width>::Build(const BVH& bvh)
+	{
+		Clear();
+
+		//Quantize the float nodes one by one, the node indices stay the same
+		WideBVH<Width> wideBVH{};
+		wideBVH.Build(bvh);
+
+		if (!wideBVH.IsBuilt())
+			return;
+
+		m_UncompressedMemoryUsage = wideBVH.GetMemoryUsage();
+		m_PrimitiveIndices = wideBVH.GetPrimitiveIndices();
+
+		const std::vector<WideBVHNode<Width>>& wideNodes{ wideBVH.GetNodes() };
+		m_Nodes.resize(wideNodes.size());
+
+		ForEachChunk(bvh.GetThreadPool(), static_cast<uint32_t>(wideNodes.size()), s_QuantizeChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+					m_Nodes[i] = Quantize(wideNodes[i]);
+			});
+	}
+
+	template<int Width>
+	void QuantizedWideBVH<Width>::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_UncompressedMemoryUsage = 0;
+	}
+
+	template<int Width>
+	QuantizedWideBVHNode<Width> QuantizedWideBVH<Width>::Quantize(const WideBVHNode<Width>& node)
+	{
+		QuantizedWideBVHNode<Width> quantizedNode{};
+		quantizedNode.childCount = static_cast<uint8_t>(node.childCount);
+
+		const float* childMins[3]{ node.minX, node.minY, node.minZ };
+		const float* childMaxs[3]{ node.maxX, node.maxY, node.maxZ };
+		uint8_t* quantizedMins[3]{ quantizedNode.qMinX, quantizedNode.qMinY, quantizedNode.qMinZ };
+		uint8_t* quantizedMaxs[3]{ quantizedNode.qMaxX, quantizedNode.qMaxY, quantizedNode.qMaxZ };
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			float gridMin{ FLT_MAX };
+			float gridMax{ -FLT_MAX };
+			for (uint32_t i{}; i < node.childCount; ++i)
+			{
+				gridMin = std::min(gridMin, childMins[axis][i]);
+				gridMax = std::max(gridMax, childMaxs[axis][i]);
+			}
+
+			//Smallest power of two cell for which 255 cells still reach the end of the node
+			const float extent{ gridMax - gridMin };
+			int exponent{ s_MinExponent };
+			if (extent > 0.f)
+				exponent = std::clamp(static_cast<int>(std::ceil(std::log2(extent / 255.f))), s_MinExponent, s_MaxExponent);
+
+			while (exponent < s_MaxExponent && Dequantize(gridMin, 255, DecodeScale(exponent)) < gridMax)
+				++exponent;
+
+			const float scale{ DecodeScale(exponent) };
+			quantizedNode.origin[axis] = gridMin;
+			quantizedNode.exponent[axis] = static_cast<int8_t>(exponent);
+
+			//Round outwards, then fix up the cases where the float division rounded the wrong way
+			for (uint32_t i{}; i < node.childCount; ++i)
+			{
+				int quantizedMin{ std::clamp(static_cast<int>(std::floor((childMins[axis][i] - gridMin) / scale)), 0, 255) };
+				while (quantizedMin > 0 && Dequantize(gridMin, static_cast<uint8_t>(quantizedMin), scale) > childMins[axis][i])
+					--quantizedMin;
+
+				int quantizedMax{ std::clamp(static_cast<int>(std::ceil((childMaxs[axis][i] - gridMin) / scale)), 0, 255) };
+				while (quantizedMax < 255 && Dequantize(gridMin, static_cast<uint8_t>(quantizedMax), scale) < childMaxs[axis][i])
+					++quantizedMax;
+
+				quantizedMins[axis][i] = static_cast<uint8_t>(quantizedMin);
+				quantizedMaxs[axis][i] = static_cast<uint8_t>(quantizedMax);
+			}
+		}
+
+		for (uint32_t i{}; i < node.childCount; ++i)
+		{
+			quantizedNode.child[i] = node.child[i];
+			quantizedNode.primitiveCount[i] = static_cast<uint8_t>(node.primitiveCount[i]);
+		}
+
+		return quantizedNode;
+	}
+
+	template class WideBVH<4>;
+	template class WideBVH<8>;
+	template class QuantizedWideBVH<4>;
+	template class QuantizedWideBVH<8>;
+}
@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "BVH.h"
+#include "SIMD.h"
+
+namespace dae
+{
+	//Node layout a TriangleMesh traverses, the wide layouts are collapsed from the binary BVH
+	enum class BVHLayout
+	{
+		Binary,
+		Wide4,
+		Wide8,
+		Wide4Quantized,
+		Wide8Quantized
+	};
+
+#if defined(DAE_AVX2)
+	constexpr BVHLayout DEFAULT_BVH_LAYOUT{ BVHLayout::Wide8 };
+#else
+	constexpr BVHLayout DEFAULT_BVH_LAYOUT{ BVHLayout::Wide4 };
+#endif
+
+	inline const char* GetBVHLayoutName(BVHLayout layout)
+	{
+		switch (layout)
+		{
+		case BVHLayout::Wide4:
+			return "BVH4";
+		case BVHLayout::Wide8:
+			return "BVH8";
+		case BVHLayout::Wide4Quantized:
+			return "BVH4 quantized";
+		case BVHLayout::Wide8Quantized:
+			return "BVH8 quantized";
+		default:
+			return "BVH2";
+		}
+	}
+
+#pragma region Slab Tests
+	//Each returns a hit bit per box and writes the distances at which the ray enters the boxes
+	//A box is hit when the ray overlaps it somewhere within [tMin, tMax]
+#if defined(DAE_AVX2)
+	inline int SlabTest_8(__m256 minX, __m256 minY, __m256 minZ, __m256 maxX, __m256 maxY, __m256 maxZ, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+	{
+		const __m256 originX{ _mm256_set1_ps(origin.x) };
+		const __m256 originY{ _mm256_set1_ps(origin.y) };
+		const __m256 originZ{ _mm256_set1_ps(origin.z) };
+		const __m256 invX{ _mm256_set1_ps(invDirection.x) };
+		const __m256 invY{ _mm256_set1_ps(invDirection.y) };
+		const __m256 invZ{ _mm256_set1_ps(invDirection.z) };
+
+		const __m256 tx1{ _mm256_mul_ps(_mm256_sub_ps(minX, originX), invX) };
+		const __m256 tx2{ _mm256_mul_ps(_mm256_sub_ps(maxX, originX), invX) };
+		const __m256 ty1{ _mm256_mul_ps(_mm256_sub_ps(minY, originY), invY) };
+		const __m256 ty2{ _mm256_mul_ps(_mm256_sub_ps(maxY, originY), invY) };
+		const __m256 tz1{ _mm256_mul_ps(_mm256_sub_ps(minZ, originZ), invZ) };
+		const __m256 tz2{ _mm256_mul_ps(_mm256_sub_ps(maxZ, originZ), invZ) };
+
+		const __m256 tmin{ _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2)) };
+		const __m256 tmax{ _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2)) };
+
+		__m256 mask{ _mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ) };
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(tmax, _mm256_set1_ps(tMin), _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(tmin, _mm256_set1_ps(tMax), _CMP_LE_OQ));
+
+		_mm256_storeu_ps(distances, tmin);
+		return _mm256_movemask_ps(mask);
+	}
+#endif
+
+#if defined(DAE_SSE)
+	inline int SlabTest_4(__m128 minX, __m128 minY, __m128 minZ, __m128 maxX, __m128 maxY, __m128 maxZ, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+	{
+		const __m128 originX{ _mm_set1_ps(origin.x) };
+		const __m128 originY{ _mm_set1_ps(origin.y) };
+		const __m128 originZ{ _mm_set1_ps(origin.z) };
+		const __m128 invX{ _mm_set1_ps(invDirection.x) };
+		const __m128 invY{ _mm_set1_ps(invDirection.y) };
+		const __m128 invZ{ _mm_set1_ps(invDirection.z) };
+
+		const __m128 tx1{ _mm_mul_ps(_mm_sub_ps(minX, originX), invX) };
+		const __m128 tx2{ _mm_mul_ps(_mm_sub_ps(maxX, originX), invX) };
+		const __m128 ty1{ _mm_mul_ps(_mm_sub_ps(minY, originY), invY) };
+		const __m128 ty2{ _mm_mul_ps(_mm_sub_ps(maxY, originY), invY) };
+		const __m128 tz1{ _mm_mul_ps(_mm_sub_ps(minZ, originZ), invZ) };
+		const __m128 tz2{ _mm_mul_ps(_mm_sub_ps(maxZ, originZ), invZ) };
+
+		const __m128 tmin{ _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2)) };
+		const __m128 tmax{ _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2)) };
+
+		__m128 mask{ _mm_cmpge_ps(tmax, tmin) };
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(tmax, _mm_set1_ps(tMin)));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(tmin, _mm_set1_ps(tMax)));
+
+		_mm_storeu_ps(distances, tmin);
+		return _mm_movemask_ps(mask);
+	}
+#endif
+
+	inline int SlabTest_1(float minX, float minY, float minZ, float maxX, float maxY, float maxZ, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distance)
+	{
+		const float tx1{ (minX - origin.x) * invDirection.x };
+		const float tx2{ (maxX - origin.x) * invDirection.x };
+		const float ty1{ (minY - origin.y) * invDirection.y };
+		const float ty2{ (maxY - origin.y) * invDirection.y };
+		const float tz1{ (minZ - origin.z) * invDirection.z };
+		const float tz2{ (maxZ - origin.z) * invDirection.z };
+
+		const float tmin{ std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2)) };
+		const float tmax{ std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2)) };
+
+		*distance = tmin;
+		return (tmax >= tmin && tmax >= tMin && tmin <= tMax) ? 1 : 0;
+	}
+#pragma endregion
+
+	//Child bounds are stored per axis, so a single vector operation tests the ray against every child box
+	template<int Width>
+	struct alignas(32) WideBVHNode
+	{
+		float minX[Width];
+		float minY[Width];
+		float minZ[Width];
+		float maxX[Width];
+		float maxY[Width];
+		float maxZ[Width];
+
+		//Interior child: index of its node, leaf child: index of its first primitive
+		uint32_t child[Width];
+		//0 for interior children, number of primitives for leaf children
+		uint32_t primitiveCount[Width];
+
+		//Slots at or past childCount are unused and always masked out
+		uint32_t childCount;
+	};
+
+	//BVH4 / BVH8 collapsed from a binary BVH, shares its primitive order
+	template<int Width>
+	class WideBVH final
+	{
+	public:
+		static_assert(Width == 4 || Width == 8, "Only 4 and 8 wide nodes are supported");
+
+		using Node = WideBVHNode<Width>;
+
+		static constexpr int s_Width{ Width };
+		//Collapsing never makes the tree deeper, every level above the current node leaves at most Width - 1 children pending
+		static constexpr int s_MaxTraversalStackSize{ static_cast<int>(BVH::s_MaxDepth) * (Width - 1) + 1 };
+		static_assert(s_MaxTraversalStackSize >= BVH::s_MaxTraversalStackSize, "Wide traversal stack is smaller than the binary one");
+
+		WideBVH() = default;
+		~WideBVH() = default;
+
+		void Build(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+		const std::vector<WideBVHNode<Width>>& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+
+		//Bytes used by the nodes and primitive indices
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(WideBVHNode<Width>) + m_PrimitiveIndices.size() * sizeof(uint32_t); }
+
+		/**
+		 * \brief Slab test of one ray against every child box of a node
+		 * \param node node whose children are tested
+		 * \param origin ray origin
+		 * \param invDirection 1 / ray direction
+		 * \param tMin near limit of the ray
+		 * \param tMax far limit, usually the closest hit so far
+		 * \param distances receives the entry distance of every child
+		 * \return bit i is set when child i is hit
+		 */
+		static int IntersectChildren(const WideBVHNode<Width>& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances);
+
+	private:
+		std::vector<WideBVHNode<Width>> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+
+		//Subtrees the top levels are split into before the rest is collapsed on the thread pool
+		static constexpr size_t s_ParallelSubtreeCount{ 256 };
+
+		struct CollapseTask
+		{
+			uint32_t binaryIndex;
+			uint32_t wideIndex;
+		};
+
+		//Binary nodes that become the children of the wide node made from binaryIndex, returns how many
+		static int SelectChildren(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t* children);
+		//Interior children are numbered from firstChildIndex and queued on tasks, returns how many there are
+		static uint32_t CollapseNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t firstChildIndex, WideBVHNode<Width>& wideNode, std::vector<CollapseTask>& tasks);
+		//Wide nodes below the one made from binaryIndex, not counting that node itself
+		static uint32_t CountSubtreeNodes(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex);
+	};
+
+	template<int Width>
+	inline int WideBVH<Width>::IntersectChildren(const WideBVHNode<Width>& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+	{
+		int hitMask{};
+
+#if defined(DAE_AVX2)
+		if constexpr (Width == 8)
+		{
+			hitMask = SlabTest_8(_mm256_load_ps(node.minX), _mm256_load_ps(node.minY), _mm256_load_ps(node.minZ),
+				_mm256_load_ps(node.maxX), _mm256_load_ps(node.maxY), _mm256_load_ps(node.maxZ),
+				origin, invDirection, tMin, tMax, distances);
+		}
+		else
+#endif
+		{
+#if defined(DAE_SSE)
+			for (int i{}; i < Width; i += 4)
+			{
+				hitMask |= SlabTest_4(_mm_load_ps(node.minX + i), _mm_load_ps(node.minY + i), _mm_load_ps(node.minZ + i),
+					_mm_load_ps(node.maxX + i), _mm_load_ps(node.maxY + i), _mm_load_ps(node.maxZ + i),
+					origin, invDirection, tMin, tMax, distances + i) << i;
+			}
+#else
+			for (int i{}; i < Width; ++i)
+			{
+				hitMask |= SlabTest_1(node.minX[i], node.minY[i], node.minZ[i], node.maxX[i], node.maxY[i], node.maxZ[i],
+					origin, invDirection, tMin, tMax, distances + i) << i;
+			}
+#endif
+		}
+
+		return hitMask & ((1 << node.childCount) - 1);
+	}
+
+	//Child bounds are stored as 8-bit offsets on a grid spanning the node, a child box decodes to origin + q * 2^exponent per axis
+	//The grid cells are powers of two, so decoding is exact and the build only ever rounds the boxes outwards
+	template<int Width>
+	struct QuantizedWideBVHNode
+	{
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t childCount;
+
+		uint8_t qMinX[Width];
+		uint8_t qMinY[Width];
+		uint8_t qMinZ[Width];
+		uint8_t qMaxX[Width];
+		uint8_t qMaxY[Width];
+		uint8_t qMaxZ[Width];
+
+		//Interior child: index of its node, leaf child: index of its first primitive
+		uint32_t child[Width];
+		//0 for interior children, number of primitives for leaf children
+		uint8_t primitiveCount[Width];
+	};
+
+	//Compressed BVH4 / BVH8, a node takes roughly 40% of the memory of a WideBVHNode
+	//Boxes are only ever grown by the quantization, so traversal visits a few extra nodes but every hit stays exact
+	template<int Width>
+	class QuantizedWideBVH final
+	{
+	public:
+		static_assert(Width == 4 || Width == 8, "Only 4 and 8 wide nodes are supported");
+
+		using Node = QuantizedWideBVHNode<Width>;
+		static_assert(BVH::s_MaxLeafPrimitiveCount <= UINT8_MAX, "Leaf primitive counts do not fit the 8-bit counts of a quantized node");
+
+		static constexpr int s_Width{ Width };
+		static constexpr int s_MaxTraversalStackSize{ WideBVH<Width>::s_MaxTraversalStackSize };
+
+		QuantizedWideBVH() = default;
+		~QuantizedWideBVH() = default;
+
+		void Build(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+		const std::vector<QuantizedWideBVHNode<Width>>& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+
+		//Bytes used by the nodes and primitive indices
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(QuantizedWideBVHNode<Width>) + m_PrimitiveIndices.size() * sizeof(uint32_t); }
+		//Bytes the same tree takes as an uncompressed WideBVH
+		size_t GetUncompressedMemoryUsage() const { return m_UncompressedMemoryUsage; }
+		size_t GetMemorySaved() const { return m_UncompressedMemoryUsage - GetMemoryUsage(); }
+
+		//Same contract as WideBVH::IntersectChildren, the child boxes are decoded on the fly
+		static int IntersectChildren(const QuantizedWideBVHNode<Width>& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances);
+
+		//2^exponent, built directly from the float bits
+		static float DecodeScale(int exponent) { return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23); }
+		static float Dequantize(float origin, uint8_t q, float scale) { return origin + static_cast<float>(q) * scale; }
+
+	private:
+		std::vector<QuantizedWideBVHNode<Width>> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+
+		size_t m_UncompressedMemoryUsage{};
+
+		//Limits of a normal float exponent, so DecodeScale never produces a denormal or infinity
+		static constexpr int s_MinExponent{ -126 };
+		static constexpr int s_MaxExponent{ 127 };
+		static constexpr uint32_t s_QuantizeChunkSize{ 4096 };
+
+		static QuantizedWideBVHNode<Width> Quantize(const WideBVHNode<Width>& node);
+	};
+
+	template<int Width>
+	inline int QuantizedWideBVH<Width>::IntersectChildren(const QuantizedWideBVHNode<Width>& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+	{
+		const float scaleX{ DecodeScale(node.exponent[0]) };
+		const float scaleY{ DecodeScale(node.exponent[1]) };
+		const float scaleZ{ DecodeScale(node.exponent[2]) };
+
+		int hitMask{};
+
+#if defined(DAE_AVX2)
+		if constexpr (Width == 8)
+		{
+			const auto dequantize{ [](const uint8_t* q, float gridOrigin, float scale)
+				{
+					const __m256 values{ _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q)))) };
+					return _mm256_add_ps(_mm256_set1_ps(gridOrigin), _mm256_mul_ps(values, _mm256_set1_ps(scale)));
+				} };
+
+			hitMask = SlabTest_8(dequantize(node.qMinX, node.origin[0], scaleX), dequantize(node.qMinY, node.origin[1], scaleY), dequantize(node.qMinZ, node.origin[2], scaleZ),
+				dequantize(node.qMaxX, node.origin[0], scaleX), dequantize(node.qMaxY, node.origin[1], scaleY), dequantize(node.qMaxZ, node.origin[2], scaleZ),
+				origin, invDirection, tMin, tMax, distances);
+		}
+		else
+#endif
+		{
+#if defined(DAE_SSE)
+			const auto dequantize{ [](const uint8_t* q, float gridOrigin, float scale)
+				{
+					int packed{};
+					std::memcpy(&packed, q, sizeof(packed));
+
+					const __m128i zero{ _mm_setzero_si128() };
+					const __m128i values{ _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero) };
+					return _mm_add_ps(_mm_set1_ps(gridOrigin), _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(scale)));
+				} };
+
+			for (int i{}; i < Width; i += 4)
+			{
+				hitMask |= SlabTest_4(dequantize(node.qMinX + i, node.origin[0], scaleX), dequantize(node.qMinY + i, node.origin[1], scaleY), dequantize(node.qMinZ + i, node.origin[2], scaleZ),
+					dequantize(node.qMaxX + i, node.origin[0], scaleX), dequantize(node.qMaxY + i, node.origin[1], scaleY), dequantize(node.qMaxZ + i, node.origin[2], scaleZ),
+					origin, invDirection, tMin, tMax, distances + i) << i;
+			}
+#else
+			for (int i{}; i < Width; ++i)
+			{
+				hitMask |= SlabTest_1(Dequantize(node.origin[0], node.qMinX[i], scaleX), Dequantize(node.origin[1], node.qMinY[i], scaleY), Dequantize(node.origin[2], node.qMinZ[i], scaleZ),
+					Dequantize(node.origin[0], node.qMaxX[i], scaleX), Dequantize(node.origin[1], node.qMaxY[i], scaleY), Dequantize(node.origin[2], node.qMaxZ[i], scaleZ),
+					origin, invDirection, tMin, tMax, distances + i) << i;
+			}
+#endif
+		}
+
+		return hitMask & ((1 << node.childCount) - 1);
+	}
+}
@@ -51,7 +51,10 @@ int main(int argc, char* args[])
 	//const auto pScene = new Scene_W4_test();
 	//const auto pScene = new Scene_W4_ReferenceScene();
 	const auto pScene = new Scene_W4_BunnyScene();
+	pScene->SetThreadPool(pRenderer->GetThreadPool());
 	pScene->Initialize();
+	pScene->UpdateAccelerationStructure();
+	pScene->PrintAccelerationStructureStats();
 
 	//Start loop
 	pTimer->Start();
@@ -72,27 +75,49 @@ int main(int argc, char* args[])
 			case SDL_KEYUP:
 				if(e.key.keysym.scancode == SDL_SCANCODE_X)
 					takeScreenshot = true;
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F1)
+					pRenderer->ToggleCheckerboard();
 				else if (e.key.keysym.scancode == SDL_SCANCODE_F2)
 					pRenderer->ToggleShadows();
 				else if (e.key.keysym.scancode == SDL_SCANCODE_F3)
 					pRenderer->ToggleLightingMode();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+					pRenderer->TogglePacketTracing();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F5)
+					pRenderer->ToggleWavefront();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F6)
+					pRenderer->ToggleFastBRDF();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F7)
+					pRenderer->CycleTileScheduler();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F8)
+					pRenderer->SetScreenTileSize((pRenderer->GetScreenTileSize() >= 128) ? 8 : pRenderer->GetScreenTileSize() * 2);
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F9)
+					pRenderer->ToggleCostPredictiveTiles();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F10)
+					pRenderer->ToggleProgressive();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F11)
+					pRenderer->ToggleDynamicResolution();
 				break;
 			}
 		}
 
 		//--------- Update ---------
 		pScene->Update(pTimer);
+		pScene->UpdateAccelerationStructure();
 
 		//--------- Render ---------
 		pRenderer->Render(pScene);
 
 		//--------- Timer ---------
 		pTimer->Update();
+		pRenderer->UpdateResolutionScale(pTimer->GetElapsed());
 		printTimer += pTimer->GetElapsed();
 		if (printTimer >= 1.f)
 		{
 			printTimer = 0.f;
-			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			std::cout << "dFPS: " << pTimer->GetdFPS() << ", resolution scale: " << pRenderer->GetResolutionScale() << std::endl;
+			pRenderer->PrintOcclusionCacheStats();
+			pRenderer->PrintTileBalanceStats();
 		}
 
 		//Save screenshot after full render